@@ -0,0 +1,145 @@
+#include <cstring>
+#include "common.h"
+#include "gtest/gtest.h"
+
+namespace tmonkey {
+namespace {
+
+TEST(ArenaTests, Alignment) {
+  Arena arena;
+  for (size_t bytes : {1u, 3u, 17u, 100u, 4000u, 70000u}) {
+    auto addr = reinterpret_cast<uintptr_t>(arena.alloc(bytes));
+    ASSERT_EQ(addr % alignof(std::max_align_t), 0);
+  }
+}
+
+TEST(ArenaTests, ZeroBytes) {
+  Arena arena;
+  auto* empty = arena.alloc(0);
+  ASSERT_NE(empty, nullptr);
+  ASSERT_EQ(arena.alloc(16), empty);
+}
+
+TEST(ArenaTests, GeometricGrowth) {
+  Arena arena(64 * 1024);
+  for (int i = 0; i < 100000; i++) {
+    auto* p = arena.alloc(16);
+    std::memset(p, 0xab, 16);
+  }
+  // 1.6 MB of small objects: doubling up to the 64 KB cap needs far fewer than 400 4 KB blocks.
+  ASSERT_GE(arena.bytesReserved(), 1600000);
+  ASSERT_LE(arena.bytesReserved(), 1600000 + 2 * 64 * 1024);
+}
+
+TEST(ArenaTests, LargeObjectsKeepCurrentBlock) {
+  Arena arena;
+  auto* a = arena.alloc(16);
+  auto* big = arena.alloc(1 << 20);
+  auto* b = arena.alloc(16);
+  // The small allocations stay adjacent in the first block.
+  ASSERT_EQ(b - a, 16);
+  ASSERT_TRUE(big < a || big >= a + 4096);
+}
+
+TEST(ArenaTests, MarkRewind) {
+  Arena arena;
+  arena.alloc(32);
+  auto m = arena.mark();
+  auto* first = arena.alloc(64);
+  for (int i = 0; i < 1000; i++) {
+    arena.alloc(64);
+  }
+  arena.alloc(1 << 20);
+  auto reserved = arena.bytesReserved();
+
+  arena.rewind(m);
+  ASSERT_EQ(arena.alloc(64), first);
+  // Bump blocks are kept for reuse, the large allocation is gone.
+  ASSERT_EQ(arena.bytesReserved(), reserved - (1 << 20));
+
+  for (int i = 0; i < 1000; i++) {
+    arena.alloc(64);
+  }
+  ASSERT_EQ(arena.bytesReserved(), reserved - (1 << 20));
+}
+
+TEST(ArenaTests, Reset) {
+  Arena arena;
+  auto* first = arena.alloc(8);
+  for (int i = 0; i < 10000; i++) {
+    arena.alloc(64);
+  }
+  arena.alloc(1 << 20);
+
+  auto reserved = arena.bytesReserved() - (1 << 20);
+
+  arena.reset();
+  ASSERT_EQ(arena.bytesReserved(), reserved);
+  ASSERT_EQ(arena.alloc(8), first);
+  // The same workload refills the kept blocks without allocating.
+  for (int i = 0; i < 10000; i++) {
+    arena.alloc(64);
+  }
+  ASSERT_EQ(arena.bytesReserved(), reserved);
+}
+
+TEST(ArenaTests, ResetKeepsBoundedBlocks) {
+  Arena arena(64 * 1024);
+  for (int i = 0; i < 100000; i++) {
+    arena.alloc(64);
+  }
+  arena.reset();
+  // At most four 64 KB blocks worth survive, not the 6 MB the arena grew to.
+  ASSERT_GT(arena.bytesReserved(), 3 * 64 * 1024);
+  ASSERT_LE(arena.bytesReserved(), 4 * 64 * 1024);
+}
+
+TEST(ArenaTests, VirtualMemory) {
+  Arena arena(Arena::VirtualMemory{64 << 20});
+  auto* first = arena.alloc(8);
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(first) % (2 << 20), 0);
+
+  // The region is one contiguous bump range, committed in 2 MB steps.
+  auto* prev = first;
+  for (int i = 0; i < 100000; i++) {
+    auto* p = arena.alloc(48);
+    ASSERT_EQ(p - prev, i == 0 ? 16 : 48);
+    std::memset(p, 0xab, 48);
+    prev = p;
+  }
+  ASSERT_EQ(arena.bytesReserved(), 6 << 20);
+
+  auto m = arena.mark();
+  auto* big = arena.alloc(10 << 20);
+  std::memset(big, 1, 10 << 20);
+  ASSERT_EQ(arena.bytesReserved(), 16 << 20);
+  arena.rewind(m);
+  ASSERT_EQ(arena.alloc(10 << 20), big);
+
+  arena.rewind(m);
+  arena.releaseUnused();
+  ASSERT_EQ(arena.bytesReserved(), 6 << 20);
+
+  arena.reset();
+  ASSERT_EQ(arena.bytesReserved(), 2 << 20);
+  ASSERT_EQ(arena.alloc(8), first);
+  // Released pages come back zeroed, and count again once the bump pointer reaches them.
+  ASSERT_EQ(static_cast<unsigned char>(big[0]), 0);
+  arena.alloc(5 << 20);
+  ASSERT_EQ(arena.bytesReserved(), 6 << 20);
+}
+
+TEST(ArenaTests, VirtualMemoryExhausted) {
+  Arena arena(Arena::VirtualMemory{2 << 20});
+  auto* first = arena.alloc(1 << 20);
+  auto* second = arena.alloc(1 << 20);
+  ASSERT_EQ(second - first, 1 << 20);
+  // The region is full, so heap blocks take over.
+  for (int i = 0; i < 1000; i++) {
+    std::memset(arena.alloc(1024), 0, 1024);
+  }
+  ASSERT_GT(arena.bytesReserved(), 2 << 20);
+}
+
+}  // namespace
+}  // namespace tmonkey
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <deque>
+#include <span>
+#include <tuple>
 #include "common.h"
+#include "strintern.h"
 #include "token.h"
 
 namespace tmonkey {
@@ -29,11 +33,6 @@ namespace tmonkey {
   V(BlockStmt)           \
   V(ExprStmt)
 
-#define AST_GEN_VISIT_NODE_SWITCH_CASE(Name)  \
-  case AstNode::Kind::k##Name:                \
-    visit##Name(static_cast<const Name*>(n)); \
-    break;
-
 #define AST_NODE_SWITCH(GEN_CASE) \
   switch (n->kind()) {            \
     AST_NODE_LIST(GEN_CASE)       \
@@ -41,8 +40,6 @@ namespace tmonkey {
       break;                      \
   }
 
-#define GEN_AST_VISITORS(Name) void visit##Name(const AstNode* n);
-
 class BlockStmt;
 
 class AstNode {
@@ -157,32 +154,31 @@ public:
 
 class FnExpr final : public Expr {
 public:
-  explicit FnExpr(const std::vector<Expr*>& params, const BlockStmt* body)
+  explicit FnExpr(std::span<Expr*> params, const BlockStmt* body)
       : Expr(Kind::kFnExpr), params(params), body(body) {
     ASSERT_NO_NULLPTR(body);
   }
 
-  const std::vector<Expr*> params;
+  const std::span<Expr*> params;
   const BlockStmt* body;
 };
 
 class CallExpr final : public Expr {
 public:
-  explicit CallExpr(const Expr* callable, const std::vector<Expr*>& args)
+  explicit CallExpr(const Expr* callable, std::span<Expr*> args)
       : Expr(Kind::kCallExpr), callable(callable), args(args) {
     ASSERT_NO_NULLPTR(callable);
   }
 
   const Expr* callable;
-  const std::vector<Expr*> args;
+  const std::span<Expr*> args;
 };
 
 class ArrayExpr final : public Expr {
 public:
-  explicit ArrayExpr(const std::vector<Expr*>& elements)
-      : Expr(Kind::kArrayExpr), elements(elements) {}
+  explicit ArrayExpr(std::span<Expr*> elements) : Expr(Kind::kArrayExpr), elements(elements) {}
 
-  const std::vector<Expr*> elements;
+  const std::span<Expr*> elements;
 };
 
 class AssignExpr final : public Expr {
@@ -206,18 +202,20 @@ public:
 
 class HashMapExpr final : public Expr {
 public:
-  explicit HashMapExpr(const std::vector<std::pair<Expr*, Expr*>>& pairs)
+  explicit HashMapExpr(std::span<std::pair<Expr*, Expr*>> pairs)
       : Expr(Kind::kHashMapExpr), pairs(pairs) {}
 
-  const std::vector<std::pair<Expr*, Expr*>> pairs;
+  const std::span<std::pair<Expr*, Expr*>> pairs;
 };
 
 class IdentifierExpr final : public Expr {
 public:
-  IdentifierExpr(std::string_view identifier)
-      : Expr(Kind::kIdentifierExpr), identifier(identifier) {}
+  IdentifierExpr(std::string_view identifier, Symbol symbol = {})
+      : Expr(Kind::kIdentifierExpr), identifier(identifier), symbol(symbol) {}
 
   const std::string_view identifier;
+  // Empty unless the tree was parsed with an interner.
+  const Symbol symbol;
 };
 
 class NullExpr final : public Expr {
@@ -248,9 +246,12 @@ public:
 
 class StrExpr final : public Expr {
 public:
-  StrExpr(std::string_view value) : Expr(Kind::kStrExpr), value{value} {}
+  StrExpr(std::string_view value, Symbol symbol = {})
+      : Expr(Kind::kStrExpr), value{value}, symbol(symbol) {}
 
   const std::string_view value;
+  // Only hash-map keys are interned.
+  const Symbol symbol;
 };
 
 class LetStmt final : public Stmt {
@@ -276,9 +277,286 @@ public:
 
 class BlockStmt final : public Stmt {
 public:
-  BlockStmt(const std::vector<Stmt*>& body) : Stmt(Kind::kBlockStmt), body(body) {}
+  BlockStmt(std::span<Stmt*> body) : Stmt(Kind::kBlockStmt), body(body) {}
+
+  const std::span<Stmt*> body;
+};
+
+// Calls `fn` on every child of `n` in source order.
+template <typename Fn>
+void forEachChild(const AstNode* n, Fn&& fn) {
+  switch (n->kind()) {
+    case AstNode::Kind::kInfixExpr: {
+      const auto* e = static_cast<const InfixExpr*>(n);
+      fn(e->lhs);
+      fn(e->rhs);
+      break;
+    }
+    case AstNode::Kind::kPrefixExpr:
+      fn(static_cast<const PrefixExpr*>(n)->rhs);
+      break;
+    case AstNode::Kind::kIfExpr: {
+      const auto* e = static_cast<const IfExpr*>(n);
+      fn(e->cnd);
+      fn(e->coseq);
+      if (e->alt) {
+        fn(*e->alt);
+      }
+      break;
+    }
+    case AstNode::Kind::kWhileExpr: {
+      const auto* e = static_cast<const WhileExpr*>(n);
+      fn(e->cnd);
+      fn(e->coseq);
+      break;
+    }
+    case AstNode::Kind::kImportExpr:
+      fn(static_cast<const ImportExpr*>(n)->name);
+      break;
+    case AstNode::Kind::kFnExpr: {
+      const auto* e = static_cast<const FnExpr*>(n);
+      for (const auto* param : e->params) {
+        fn(param);
+      }
+      fn(e->body);
+      break;
+    }
+    case AstNode::Kind::kCallExpr: {
+      const auto* e = static_cast<const CallExpr*>(n);
+      fn(e->callable);
+      for (const auto* arg : e->args) {
+        fn(arg);
+      }
+      break;
+    }
+    case AstNode::Kind::kArrayExpr:
+      for (const auto* element : static_cast<const ArrayExpr*>(n)->elements) {
+        fn(element);
+      }
+      break;
+    case AstNode::Kind::kAssignExpr: {
+      const auto* e = static_cast<const AssignExpr*>(n);
+      fn(e->lhs);
+      fn(e->rhs);
+      break;
+    }
+    case AstNode::Kind::kIndexExpr: {
+      const auto* e = static_cast<const IndexExpr*>(n);
+      fn(e->lhs);
+      fn(e->idx);
+      break;
+    }
+    case AstNode::Kind::kHashMapExpr:
+      for (const auto& [key, val] : static_cast<const HashMapExpr*>(n)->pairs) {
+        fn(key);
+        fn(val);
+      }
+      break;
+    case AstNode::Kind::kLetStmt: {
+      const auto* s = static_cast<const LetStmt*>(n);
+      fn(s->identifier);
+      fn(s->rhs);
+      break;
+    }
+    case AstNode::Kind::kRetStmt:
+      fn(static_cast<const RetStmt*>(n)->expr);
+      break;
+    case AstNode::Kind::kBlockStmt:
+      for (const auto* stmt : static_cast<const BlockStmt*>(n)->body) {
+        fn(stmt);
+      }
+      break;
+    case AstNode::Kind::kExprStmt:
+      fn(static_cast<const ExprStmt*>(n)->expr);
+      break;
+    default:
+      break;
+  }
+}
+
+// Statically dispatched visitor. `Derived` defines visitName(const Name*) for the nodes it handles
+// and every other node just visits its children. Children are visited through Derived::visit(),
+// which a visitor may hide to run code around each node. It recurses once per level, so walks over
+// trees of any depth use AstPasses or AstWalker instead.
+template <typename Derived>
+class AstVisitor {
+public:
+  void visit(const AstNode* n) {
+    dispatch(n);
+  }
+
+  void dispatch(const AstNode* n) {
+    ASSERT_NO_NULLPTR(n);
+
+#define GEN_DISPATCH_CASE(Name)                         \
+  case AstNode::Kind::k##Name:                          \
+    derived().visit##Name(static_cast<const Name*>(n)); \
+    break;
+
+    AST_NODE_SWITCH(GEN_DISPATCH_CASE)
+
+#undef GEN_DISPATCH_CASE
+  }
+
+#define GEN_DEFAULT_VISIT(Name)     \
+  void visit##Name(const Name* n) { \
+    visitChildren(n);               \
+  }
+
+  AST_NODE_LIST(GEN_DEFAULT_VISIT)
+
+#undef GEN_DEFAULT_VISIT
+
+  void visitChildren(const AstNode* n) {
+    forEachChild(n, [this](const AstNode* child) {
+      if (child) {
+        derived().visit(child);
+      }
+    });
+  }
+
+private:
+  auto derived() -> Derived& {
+    return static_cast<Derived&>(*this);
+  }
+};
+
+// Walks a tree on its own stack for code that runs between the children of a node, like the
+// printers and code generators, so it handles trees of any depth. `Derived` keeps a
+// std::deque<Frame> frames_ whose Frame holds the `node` and the `step` it is at, and defines
+// resumeName(const Name*, Frame&) for the nodes it handles; other nodes finish at once. resumeName
+// runs the node's next step and returns, either after descend() to run a child's frame before the
+// node resumes, after finish() to drop the node's frame, or with neither to resume it right away.
+// A frame stays in place while deeper ones come and go, so resumeName may write to it after
+// descend(). Steps run through Derived::resume(), which a walker may hide to run code around each
+// of them.
+template <typename Derived>
+class AstWalker {
+public:
+  template <typename Frame>
+  void walk(const Frame& root) {
+    auto& frames = derived().frames_;
+    auto base = frames.size();
+    frames.push_back(root);
+    while (frames.size() > base) {
+      derived().resume(frames.back());
+    }
+  }
+
+protected:
+  template <typename Frame>
+  void descend(const Frame& f) {
+    derived().frames_.push_back(f);
+  }
+
+  void finish() {
+    derived().frames_.pop_back();
+  }
+
+  template <typename Frame>
+  void resume(Frame& f) {
+    const AstNode* n = f.node;
+    ASSERT_NO_NULLPTR(n);
+
+#define GEN_RESUME_CASE(Name)                                         \
+  case AstNode::Kind::k##Name:                                        \
+    if constexpr (requires { derived().resume##Name(nullptr, f); }) { \
+      derived().resume##Name(static_cast<const Name*>(n), f);         \
+    } else {                                                          \
+      finish();                                                       \
+    }                                                                 \
+    break;
+
+    AST_NODE_SWITCH(GEN_RESUME_CASE)
+
+#undef GEN_RESUME_CASE
+  }
+
+private:
+  auto derived() -> Derived& {
+    return static_cast<Derived&>(*this);
+  }
+};
+
+// Runs several passes over a tree in one traversal, so each node is loaded once however many
+// passes there are. A pass defines enterName(const Name*) and leaveName(const Name*) for the nodes
+// it handles, and may define enterNode(const AstNode*) and leaveNode(const AstNode*) to see every
+// node. Passes enter a node in the order given, before its children, and leave it in the same order
+// after them. The walk keeps its own stack, so it handles trees of any depth.
+template <typename... Passes>
+class AstPasses {
+public:
+  explicit AstPasses(Passes&... passes) : passes_{passes...} {}
+
+  NO_COPYABLE(AstPasses)
+
+  void run(const std::vector<AstNode*>& tree) {
+    for (const auto* n : tree) {
+      run(n);
+    }
+  }
+
+  void run(const AstNode* root) {
+    stack_.push_back({root, false});
+    while (!stack_.empty()) {
+      auto [n, leaving] = stack_.back();
+      stack_.pop_back();
+      if (leaving) {
+        std::apply([&](auto&... pass) { (leave(pass, n), ...); }, passes_);
+        continue;
+      }
+
+      std::apply([&](auto&... pass) { (enter(pass, n), ...); }, passes_);
+      stack_.push_back({n, true});
+      auto first = stack_.size();
+      forEachChild(n, [this](const AstNode* child) {
+        if (child) {
+          stack_.push_back({child, false});
+        }
+      });
+      std::reverse(stack_.begin() + static_cast<ptrdiff_t>(first), stack_.end());
+    }
+  }
+
+private:
+  template <typename Pass>
+  static void enter(Pass& pass, const AstNode* n) {
+    if constexpr (requires { pass.enterNode(n); }) {
+      pass.enterNode(n);
+    }
+
+#define GEN_ENTER_CASE(Name)                                 \
+  case AstNode::Kind::k##Name:                               \
+    if constexpr (requires { pass.enter##Name(nullptr); }) { \
+      pass.enter##Name(static_cast<const Name*>(n));         \
+    }                                                        \
+    break;
+
+    AST_NODE_SWITCH(GEN_ENTER_CASE)
+
+#undef GEN_ENTER_CASE
+  }
+
+  template <typename Pass>
+  static void leave(Pass& pass, const AstNode* n) {
+#define GEN_LEAVE_CASE(Name)                                 \
+  case AstNode::Kind::k##Name:                               \
+    if constexpr (requires { pass.leave##Name(nullptr); }) { \
+      pass.leave##Name(static_cast<const Name*>(n));         \
+    }                                                        \
+    break;
+
+    AST_NODE_SWITCH(GEN_LEAVE_CASE)
+
+#undef GEN_LEAVE_CASE
+
+    if constexpr (requires { pass.leaveNode(n); }) {
+      pass.leaveNode(n);
+    }
+  }
 
-  const std::vector<Stmt*> body;
+  std::tuple<Passes&...> passes_;
+  std::vector<std::pair<const AstNode*, bool>> stack_;
 };
 
 }  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,182 @@
+#include "bytecode.h"
+
+namespace tmonkey {
+
+auto opcodeStringify(Opcode op) -> const char* {
+  switch (op) {
+#define GEN_OPCODE_STR(Name, Operands) \
+  case Opcode::k##Name:                \
+    return #Name;
+
+    OPCODE_LIST(GEN_OPCODE_STR)
+
+#undef GEN_OPCODE_STR
+  }
+  return "";
+}
+
+auto opcodeOperands(Opcode op) -> int {
+  switch (op) {
+#define GEN_OPCODE_OPERANDS(Name, Operands) \
+  case Opcode::k##Name:                     \
+    return Operands;
+
+    OPCODE_LIST(GEN_OPCODE_OPERANDS)
+
+#undef GEN_OPCODE_OPERANDS
+  }
+  return 0;
+}
+
+auto regOpcodeStringify(RegOpcode op) -> const char* {
+  switch (op) {
+#define GEN_REG_OPCODE_STR(Name, Operands) \
+  case RegOpcode::k##Name:                 \
+    return #Name;
+
+    REG_OPCODE_LIST(GEN_REG_OPCODE_STR)
+
+#undef GEN_REG_OPCODE_STR
+  }
+  return "";
+}
+
+auto regOpcodeOperands(RegOpcode op) -> int {
+  switch (op) {
+#define GEN_REG_OPCODE_OPERANDS(Name, Operands) \
+  case RegOpcode::k##Name:                      \
+    return Operands;
+
+    REG_OPCODE_LIST(GEN_REG_OPCODE_OPERANDS)
+
+#undef GEN_REG_OPCODE_OPERANDS
+  }
+  return 0;
+}
+
+auto builtinLookup(std::string_view name) -> std::optional<uint32_t> {
+  constexpr std::string_view kNames[] = {
+#define GEN_BUILTIN_NAME(Name, Text) Text,
+      BUILTIN_LIST(GEN_BUILTIN_NAME)
+#undef GEN_BUILTIN_NAME
+  };
+  for (uint32_t i = 0; i < kBuiltinCount; i++) {
+    if (kNames[i] == name) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+auto ConstantPool::integer(int64_t v) -> uint32_t {
+  auto [it, fresh] = integers_.try_emplace(v, static_cast<uint32_t>(program_.constants.size()));
+  if (fresh) {
+    add({.kind = Constant::kInteger, .integer = v});
+  }
+  return it->second;
+}
+
+auto ConstantPool::number(double v) -> uint32_t {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  auto [it, fresh] = floats_.try_emplace(bits, static_cast<uint32_t>(program_.constants.size()));
+  if (fresh) {
+    add({.kind = Constant::kFloat, .number = v});
+  }
+  return it->second;
+}
+
+auto ConstantPool::string(std::string_view s) -> uint32_t {
+  auto id = program_.strings.intern(s);
+  if (id >= strings_.size()) {
+    strings_.resize(id + 1, kNone);
+  }
+  if (strings_[id] == kNone) {
+    strings_[id] = add({.kind = Constant::kString, .string = id});
+  }
+  return strings_[id];
+}
+
+auto ConstantPool::add(Constant c) -> uint32_t {
+  program_.constants.push_back(c);
+  return static_cast<uint32_t>(program_.constants.size() - 1);
+}
+
+namespace {
+
+auto constantStringify(const Program& program, const Constant& c) -> std::string {
+  switch (c.kind) {
+    case Constant::kInteger:
+      return std::format("{}", c.integer);
+    case Constant::kFloat:
+      return std::format("{}", c.number);
+    case Constant::kString:
+      return std::format("\"{}\"", program.strings.string(c.string).value_or(""));
+  }
+  return "";
+}
+
+void disassembleRegisters(const Program& program, const Function& fn, std::string& result) {
+  const auto* begin = fn.code.data();
+  const auto* end = begin + fn.code.size();
+  for (const auto* ip = begin; ip < end;) {
+    result += std::format("{:>4} ", ip - begin);
+    auto op = static_cast<RegOpcode>(*ip++);
+    result += regOpcodeStringify(op);
+    uint32_t operand = 0;
+    for (int n = 0; n < regOpcodeOperands(op); n++) {
+      operand = readOperand(ip);
+      result += std::format(" {}", operand);
+    }
+    if (isJump(op)) {
+      result += std::format(" {}", readJumpTarget(ip));
+    }
+    if (hasConstantOperand(op)) {
+      result += std::format(" ({})", constantStringify(program, program.constants[operand]));
+    }
+    result += "\n";
+  }
+}
+
+}  // namespace
+
+auto disassemble(const Program& program) -> std::string {
+  std::string result;
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    const auto& fn = program.functions[i];
+    if (program.format == Program::Format::kRegister) {
+      result += std::format(
+          "fn {} {} params: {} registers: {}\n", i,
+          fn.name.empty() ? "<anonymous>" : fn.name, fn.params, fn.locals);
+      disassembleRegisters(program, fn, result);
+      continue;
+    }
+
+    result += std::format(
+        "fn {} {} params: {} locals: {} stack: {}\n", i,
+        fn.name.empty() ? "<anonymous>" : fn.name, fn.params, fn.locals, fn.maxStack);
+
+    const auto* begin = fn.code.data();
+    const auto* end = begin + fn.code.size();
+    for (const auto* ip = begin; ip < end;) {
+      result += std::format("{:>4} ", ip - begin);
+      auto op = static_cast<Opcode>(*ip++);
+      result += opcodeStringify(op);
+      if (isJump(op)) {
+        result += std::format(" {}", readJumpTarget(ip));
+      }
+      uint32_t operand = 0;
+      for (int n = 0; n < opcodeOperands(op); n++) {
+        operand = readOperand(ip);
+        result += std::format(" {}", operand);
+      }
+      if (op == Opcode::kConst) {
+        result += std::format(" ({})", constantStringify(program, program.constants[operand]));
+      }
+      result += "\n";
+    }
+  }
+  return result;
+}
+
+}  // namespace tmonkey
\ No newline at end of file
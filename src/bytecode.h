@@ -0,0 +1,258 @@
+#pragma once
+
+#include "common.h"
+#include "strintern.h"
+
+namespace tmonkey {
+
+// Stack bytecode produced by Codegen. An instruction is a one-byte opcode followed by its
+// operands. Operands are unsigned LEB128 varints, except jump targets, which are 4-byte
+// little-endian code offsets so that forward jumps can be patched in place.
+//
+// V(Name, operands) lists each opcode with its number of varint operands:
+//   Const a          pushes constants[a]
+//   Add .. GtEq      pop the rhs, then the lhs, and push the result
+//   Jump, JumpIfFalse take a jump target; JumpIfFalse pops the condition and jumps on false or null
+//   CurrentClosure   pushes the closure being run, for functions that refer to themselves by name
+//   Closure a b      pops b captured values and pushes a closure over functions[a]
+//   Call a           pops a arguments and the callee and pushes the result
+//   Array a          pops a elements; HashMap a pops a key/value pairs
+//   Index            pops the index and the container and pushes the element
+//   SetIndex         pops the value, the index and the container, stores and pushes the value
+#define OPCODE_LIST(V) \
+  V(Const, 1)          \
+  V(Null, 0)           \
+  V(True, 0)           \
+  V(False, 0)          \
+  V(Pop, 0)            \
+  V(Dup, 0)            \
+  V(Add, 0)            \
+  V(Sub, 0)            \
+  V(Mul, 0)            \
+  V(Div, 0)            \
+  V(Eq, 0)             \
+  V(NotEq, 0)          \
+  V(Lt, 0)             \
+  V(LtEq, 0)           \
+  V(Gt, 0)             \
+  V(GtEq, 0)           \
+  V(Neg, 0)            \
+  V(Not, 0)            \
+  V(Jump, 0)           \
+  V(JumpIfFalse, 0)    \
+  V(GetGlobal, 1)      \
+  V(SetGlobal, 1)      \
+  V(GetLocal, 1)       \
+  V(SetLocal, 1)       \
+  V(GetFree, 1)        \
+  V(SetFree, 1)        \
+  V(GetBuiltin, 1)     \
+  V(CurrentClosure, 0) \
+  V(Closure, 2)        \
+  V(Call, 1)           \
+  V(Return, 0)         \
+  V(Array, 1)          \
+  V(HashMap, 1)        \
+  V(Index, 0)          \
+  V(SetIndex, 0)
+
+enum class Opcode : uint8_t {
+#define GEN_OPCODE(Name, Operands) k##Name,
+  OPCODE_LIST(GEN_OPCODE)
+#undef GEN_OPCODE
+};
+
+auto opcodeStringify(Opcode op) -> const char*;
+
+// Number of varint operands of `op`.
+auto opcodeOperands(Opcode op) -> int;
+
+inline auto isJump(Opcode op) -> bool {
+  return op == Opcode::kJump || op == Opcode::kJumpIfFalse;
+}
+
+constexpr size_t kJumpTargetBytes = 4;
+
+inline void writeOperand(std::vector<uint8_t>& code, uint32_t v) {
+  while (v >= 0x80) {
+    code.push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  code.push_back(static_cast<uint8_t>(v));
+}
+
+ALWAYS_INLINE auto readOperand(const uint8_t*& ip) -> uint32_t {
+  uint32_t v = *ip & 0x7f;
+  for (int shift = 7; *ip++ & 0x80; shift += 7) {
+    v |= static_cast<uint32_t>(*ip & 0x7f) << shift;
+  }
+  return v;
+}
+
+ALWAYS_INLINE auto readJumpTarget(const uint8_t*& ip) -> uint32_t {
+  uint32_t v;
+  memcpy(&v, ip, sizeof(v));
+  ip += sizeof(v);
+  return v;
+}
+
+// Register bytecode produced by RegCodegen. Operands name registers of the frame window, where
+// parameters come first, then let bindings, then temporaries. Operands are varints as above; a jump
+// target follows the operands of its instruction.
+//
+// V(Name, operands) lists each opcode with its number of varint operands; a is the destination:
+//   LoadK a k         a = constants[k]
+//   Move a b          a = b
+//   Add a b c .. GtEq a = b op c
+//   AddK a b k .. GtEqK a = b op constants[k], for a literal right operand
+//   Neg a b, Not a b  a = op b
+//   JumpIfFalse a     jumps if a is false or null
+//   SetGlobal g a     globals[g] = a; SetFree i a is the same for captured values
+//   Closure a f b n   a = closure over functions[f] capturing registers b .. b + n - 1
+//   Call a n          calls a with arguments a + 1 .. a + n and puts the result in a
+//   Array a b n       a = [b .. b + n - 1]; HashMap a b n takes n key/value register pairs
+//   Index a b c       a = b[c]
+//   SetIndex a b c    a[b] = c
+#define REG_OPCODE_LIST(V) \
+  V(LoadK, 2)              \
+  V(LoadNull, 1)           \
+  V(LoadTrue, 1)           \
+  V(LoadFalse, 1)          \
+  V(Move, 2)               \
+  V(Add, 3)                \
+  V(Sub, 3)                \
+  V(Mul, 3)                \
+  V(Div, 3)                \
+  V(Eq, 3)                 \
+  V(NotEq, 3)              \
+  V(Lt, 3)                 \
+  V(LtEq, 3)               \
+  V(Gt, 3)                 \
+  V(GtEq, 3)               \
+  V(AddK, 3)               \
+  V(SubK, 3)               \
+  V(MulK, 3)               \
+  V(DivK, 3)               \
+  V(EqK, 3)                \
+  V(NotEqK, 3)             \
+  V(LtK, 3)                \
+  V(LtEqK, 3)              \
+  V(GtK, 3)                \
+  V(GtEqK, 3)              \
+  V(Neg, 2)                \
+  V(Not, 2)                \
+  V(Jump, 0)               \
+  V(JumpIfFalse, 1)        \
+  V(GetGlobal, 2)          \
+  V(SetGlobal, 2)          \
+  V(GetFree, 2)            \
+  V(SetFree, 2)            \
+  V(GetBuiltin, 2)         \
+  V(CurrentClosure, 1)     \
+  V(Closure, 4)            \
+  V(Call, 2)               \
+  V(Return, 1)             \
+  V(Array, 3)              \
+  V(HashMap, 3)            \
+  V(Index, 3)              \
+  V(SetIndex, 3)
+
+enum class RegOpcode : uint8_t {
+#define GEN_REG_OPCODE(Name, Operands) k##Name,
+  REG_OPCODE_LIST(GEN_REG_OPCODE)
+#undef GEN_REG_OPCODE
+};
+
+auto regOpcodeStringify(RegOpcode op) -> const char*;
+auto regOpcodeOperands(RegOpcode op) -> int;
+
+inline auto isJump(RegOpcode op) -> bool {
+  return op == RegOpcode::kJump || op == RegOpcode::kJumpIfFalse;
+}
+
+// Whether the last operand is a constant index rather than a register.
+inline auto hasConstantOperand(RegOpcode op) -> bool {
+  return op == RegOpcode::kLoadK || (op >= RegOpcode::kAddK && op <= RegOpcode::kGtEqK);
+}
+
+struct Constant {
+  enum Kind : uint8_t {
+    kInteger,
+    kFloat,
+    kString,
+  };
+
+  Kind kind;
+  union {
+    int64_t integer;
+    double number;
+    // Id in Program::strings.
+    uint32_t string;
+  };
+};
+
+// Builtin functions, reached through GetBuiltin.
+#define BUILTIN_LIST(V) V(Puts, "puts")
+
+enum Builtin : uint8_t {
+#define GEN_BUILTIN(Name, Text) kBuiltin##Name,
+  BUILTIN_LIST(GEN_BUILTIN)
+#undef GEN_BUILTIN
+  kBuiltinCount,
+};
+
+auto builtinLookup(std::string_view name) -> std::optional<uint32_t>;
+
+struct Function {
+  std::string name;
+  uint32_t params = 0;
+  // Slots for parameters and let bindings; parameters come first. Register code counts its
+  // temporaries here too.
+  uint32_t locals = 0;
+  // The most operand stack slots the function uses above its locals; 0 for register code.
+  uint32_t maxStack = 0;
+  std::vector<uint8_t> code{};
+};
+
+struct Program {
+  enum class Format : uint8_t {
+    kStack,
+    kRegister,
+  };
+
+  Format format = Format::kStack;
+  // functions[0] runs the top-level statements.
+  std::vector<Function> functions;
+  std::vector<Constant> constants;
+  StringInterningMap strings;
+  std::vector<std::string> globals;
+};
+
+// Adds constants to a program, each distinct value once.
+class ConstantPool {
+public:
+  explicit ConstantPool(Program& program) : program_{program} {}
+
+  NO_COPYABLE(ConstantPool)
+
+  auto integer(int64_t v) -> uint32_t;
+  auto number(double v) -> uint32_t;
+  auto string(std::string_view s) -> uint32_t;
+
+private:
+  auto add(Constant c) -> uint32_t;
+
+  Program& program_;
+  std::unordered_map<int64_t, uint32_t> integers_;
+  // Keyed by bit pattern, so 0.0 and -0.0 stay apart.
+  std::unordered_map<uint64_t, uint32_t> floats_;
+  // Constant index by Program::strings id, kNone where a string has no constant yet.
+  std::vector<uint32_t> strings_;
+
+  static constexpr uint32_t kNone = ~0u;
+};
+
+// One line per instruction, prefixed with its code offset, one function after another.
+auto disassemble(const Program& program) -> std::string;
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include "common.h"
+
+namespace tmonkey {
+
+enum CharClass : uint8_t {
+  kCharSpace = 1 << 0,
+  kCharDigit = 1 << 1,
+  kCharAlpha = 1 << 2,
+  kCharUnderscore = 1 << 3,
+  // Bytes that can change the nesting depth or end a statement.
+  kCharStructural = 1 << 4,
+};
+
+inline constexpr auto kCharClassTable = [] {
+  std::array<uint8_t, 256> table{};
+  for (auto c : {' ', '\t', '\n', '\r'}) {
+    table[static_cast<uint8_t>(c)] |= kCharSpace;
+  }
+  for (size_t c = '0'; c <= '9'; c++) {
+    table[c] |= kCharDigit;
+  }
+  for (size_t c = 'a'; c <= 'z'; c++) {
+    table[c] |= kCharAlpha;
+    table[c - 'a' + 'A'] |= kCharAlpha;
+  }
+  table['_'] |= kCharUnderscore;
+  for (auto c : {'(', ')', '[', ']', '{', '}', ';', '"'}) {
+    table[static_cast<uint8_t>(c)] |= kCharStructural;
+  }
+  return table;
+}();
+
+constexpr auto charIs(char c, uint8_t classes) -> bool {
+  return (kCharClassTable[static_cast<uint8_t>(c)] & classes) != 0;
+}
+
+constexpr auto isSpace(char c) -> bool {
+  return charIs(c, kCharSpace);
+}
+
+constexpr auto isDigit(char c) -> bool {
+  return charIs(c, kCharDigit);
+}
+
+constexpr auto isIdentStart(char c) -> bool {
+  return charIs(c, kCharAlpha | kCharUnderscore);
+}
+
+constexpr auto isIdentChar(char c) -> bool {
+  return charIs(c, kCharAlpha | kCharUnderscore | kCharDigit);
+}
+
+constexpr auto isStructural(char c) -> bool {
+  return charIs(c, kCharStructural);
+}
+
+}  // namespace tmonkey
\ No newline at end of file
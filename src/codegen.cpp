@@ -2,65 +2,492 @@
 
 namespace tmonkey {
 
-// void Codegen::visitBinExpr(AstNode* n) {
-//   auto* e = static_cast<BinExpr*>(n);
-//   visit(e->getLhs());
-//   visit(e->getRhs());
-// }
-
-// void Codegen::visitUnaryExpr(AstNode* n) {
-//   auto* e = static_cast<UnaryExpr*>(n);
-// }
-
-// void Codegen::visitIfExpr(AstNode* n) {
-//   auto* e = static_cast<IfExpr*>(n);
-// }
-
-// void Codegen::visitFnExpr(AstNode* n) {
-//   auto* e = static_cast<FnExpr*>(n);
-// }
-
-// void Codegen::visitCallExpr(AstNode* n) {
-//   auto* e = static_cast<CallExpr*>(n);
-// }
-
-// void Codegen::visitLiteralExpr(AstNode* n) {
-//   auto* e = static_cast<LiteralExpr*>(n);
-// }
-
-// void Codegen::visitArrayExpr(AstNode* n) {
-//   auto* e = static_cast<ArrayExpr*>(n);
-// }
-
-// void Codegen::visitIndexExpr(AstNode* n) {
-//   auto* e = static_cast<IndexExpr*>(n);
-// }
-
-// void Codegen::visitMapExpr(AstNode* n) {
-//   auto* e = static_cast<MapExpr*>(n);
-// }
-
-// void Codegen::visitLetStmt(AstNode* n) {
-//   auto* s = static_cast<LetStmt*>(n);
-// }
-
-// void Codegen::visitRetStmt(AstNode* n) {
-//   auto* s = static_cast<RetStmt*>(n);
-// }
-
-// void Codegen::visitExprStmt(AstNode* n) {
-//   auto* s = static_cast<ExprStmt*>(n);
-//   // std::cout << std::format("{: >{}}-ExprStmt\n", "", indent_);
-//   visit(s->getExpr());
-// }
-
-// void Codegen::visitBlockStmt(AstNode* n) {
-//   auto* s = static_cast<BlockStmt*>(n);
-
-//   // std::cout << std::format("{: >{}}-BlockStmt\n", "", indent_);
-//   for (auto* s_ : s->getStmts()) {
-//     visit(s_);
-//   }
-// }
+namespace {
+
+// How many values `op` with operands `a` and `b` leaves on the stack minus how many it takes.
+auto stackEffect(Opcode op, uint32_t a, uint32_t b) -> int64_t {
+  switch (op) {
+    case Opcode::kConst:
+    case Opcode::kNull:
+    case Opcode::kTrue:
+    case Opcode::kFalse:
+    case Opcode::kDup:
+    case Opcode::kGetGlobal:
+    case Opcode::kGetLocal:
+    case Opcode::kGetFree:
+    case Opcode::kGetBuiltin:
+    case Opcode::kCurrentClosure:
+      return 1;
+    case Opcode::kNeg:
+    case Opcode::kNot:
+    case Opcode::kJump:
+      return 0;
+    case Opcode::kClosure:
+      return 1 - int64_t{b};
+    case Opcode::kCall:
+      return -int64_t{a};
+    case Opcode::kArray:
+      return 1 - int64_t{a};
+    case Opcode::kHashMap:
+      return 1 - 2 * int64_t{a};
+    case Opcode::kSetIndex:
+      return -2;
+    default:
+      return -1;
+  }
+}
+
+}  // namespace
+
+#define LOG_CODEGEN_ERR(msg) logError(std::format("codegen error: {}", (msg)))
+
+Codegen::Codegen() {
+  program_.functions.push_back({.name = "<main>"});
+  scopes_.push_back({.function = 0});
+}
+
+auto Codegen::compile(const std::vector<AstNode*>& tree, std::vector<std::string>* errors)
+    -> std::optional<Program> {
+  Codegen gen;
+  // Globals are declared up front so functions can call ones defined after them.
+  for (const auto* n : tree) {
+    if (n->kind() == AstNode::Kind::kLetStmt) {
+      gen.define(static_cast<const LetStmt*>(n)->identifier->identifier);
+    }
+  }
+  for (const auto* n : tree) {
+    gen.walk(Frame{.node = n});
+  }
+  gen.emit(Opcode::kNull);
+  gen.emit(Opcode::kReturn);
+  gen.program_.functions[0].maxStack = gen.scopes_[0].maxDepth;
+
+  if (errors) {
+    *errors = gen.errors_;
+  }
+  if (!gen.errors_.empty()) {
+    return std::nullopt;
+  }
+  return std::move(gen.program_);
+}
+
+void Codegen::resumeInfixExpr(const InfixExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      return visit(e->lhs);
+    case 1:
+      return visit(e->rhs);
+    default:
+      break;
+  }
+
+  switch (e->op.kind()) {
+    case Token::kPlus:
+      emit(Opcode::kAdd);
+      break;
+    case Token::kMinus:
+      emit(Opcode::kSub);
+      break;
+    case Token::kStar:
+      emit(Opcode::kMul);
+      break;
+    case Token::kSlash:
+      emit(Opcode::kDiv);
+      break;
+    case Token::kEqEq:
+      emit(Opcode::kEq);
+      break;
+    case Token::kNotEq:
+      emit(Opcode::kNotEq);
+      break;
+    case Token::kLt:
+      emit(Opcode::kLt);
+      break;
+    case Token::kLtEq:
+      emit(Opcode::kLtEq);
+      break;
+    case Token::kGt:
+      emit(Opcode::kGt);
+      break;
+    case Token::kGtEq:
+      emit(Opcode::kGtEq);
+      break;
+    default:
+      LOG_CODEGEN_ERR(std::format("unknown operator {}", tokenKindStringify(e->op.kind())));
+  }
+  finish();
+}
+
+void Codegen::resumePrefixExpr(const PrefixExpr* e, Frame& f) {
+  if (f.step++ == 0) {
+    return visit(e->rhs);
+  }
+
+  switch (e->op.kind()) {
+    case Token::kMinus:
+      emit(Opcode::kNeg);
+      break;
+    case Token::kBang:
+      emit(Opcode::kNot);
+      break;
+    default:
+      LOG_CODEGEN_ERR(std::format("unknown operator {}", tokenKindStringify(e->op.kind())));
+  }
+  finish();
+}
+
+void Codegen::resumeIfExpr(const IfExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      return visit(e->cnd);
+    case 1:
+      f.jump = emitJump(Opcode::kJumpIfFalse);
+      return blockValue(e->coseq);
+    case 2: {
+      auto toEnd = emitJump(Opcode::kJump);
+      patchJump(f.jump, code().size());
+      f.jump = toEnd;
+      setDepth(depth() - 1);
+      if (e->alt) {
+        return blockValue(*e->alt);
+      }
+      emit(Opcode::kNull);
+      break;
+    }
+    default:
+      break;
+  }
+  patchJump(f.jump, code().size());
+  finish();
+}
+
+void Codegen::resumeWhileExpr(const WhileExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      f.start = code().size();
+      return visit(e->cnd);
+    case 1:
+      f.jump = emitJump(Opcode::kJumpIfFalse);
+      return blockValue(e->coseq);
+    default:
+      break;
+  }
+  emit(Opcode::kPop);
+  patchJump(emitJump(Opcode::kJump), f.start);
+  patchJump(f.jump, code().size());
+  emit(Opcode::kNull);
+  finish();
+}
+
+void Codegen::resumeImportExpr(const ImportExpr*, Frame&) {
+  LOG_CODEGEN_ERR("import is not supported");
+  finish();
+}
+
+void Codegen::resumeFnExpr(const FnExpr* e, Frame& f) {
+  if (f.step++ == 0) {
+    auto index = static_cast<uint32_t>(program_.functions.size());
+    program_.functions.push_back({.name = std::string(f.name)});
+    scopes_.push_back({.function = index});
+    scopes_.back().self = f.name;
+
+    for (const auto* param : e->params) {
+      if (param->kind() != AstNode::Kind::kIdentifierExpr) {
+        LOG_CODEGEN_ERR(
+            std::format("expected identifier as parameter but got {}", param->stringify()));
+        continue;
+      }
+      define(static_cast<const IdentifierExpr*>(param)->identifier);
+    }
+    return blockValue(e->body);
+  }
+  emit(Opcode::kReturn);
+
+  auto state = std::move(scopes_.back());
+  scopes_.pop_back();
+  auto& fn = program_.functions[state.function];
+  fn.params = static_cast<uint32_t>(e->params.size());
+  // Parameters sharing a name still take a slot each.
+  fn.locals = std::max(static_cast<uint32_t>(state.locals.size()), fn.params);
+  fn.maxStack = state.maxDepth;
+
+  for (auto b : state.frees) {
+    load(b);
+  }
+  emit(Opcode::kClosure, state.function, static_cast<uint32_t>(state.frees.size()));
+  finish();
+}
+
+void Codegen::resumeCallExpr(const CallExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step == 0) {
+    return visit(e->callable);
+  }
+  if (step <= e->args.size()) {
+    return visit(e->args[step - 1]);
+  }
+  emit(Opcode::kCall, static_cast<uint32_t>(e->args.size()));
+  finish();
+}
+
+void Codegen::resumeArrayExpr(const ArrayExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step < e->elements.size()) {
+    return visit(e->elements[step]);
+  }
+  emit(Opcode::kArray, static_cast<uint32_t>(e->elements.size()));
+  finish();
+}
+
+void Codegen::resumeAssignExpr(const AssignExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (e->lhs->kind() == AstNode::Kind::kIndexExpr) {
+    const auto* target = static_cast<const IndexExpr*>(e->lhs);
+    switch (step) {
+      case 0:
+        return visit(target->lhs);
+      case 1:
+        return visit(target->idx);
+      case 2:
+        return visit(e->rhs);
+      default:
+        emit(Opcode::kSetIndex);
+        return finish();
+    }
+  }
+
+  auto name = static_cast<const IdentifierExpr*>(e->lhs)->identifier;
+  if (step == 0) {
+    auto b = resolve(name);
+    if (!b) {
+      LOG_CODEGEN_ERR(std::format("undefined variable {}", name));
+      return finish();
+    }
+    f.binding = *b;
+    return visit(e->rhs);
+  }
+  emit(Opcode::kDup);
+  switch (f.binding.scope) {
+    case Scope::kGlobal:
+      emit(Opcode::kSetGlobal, f.binding.index);
+      break;
+    case Scope::kLocal:
+      emit(Opcode::kSetLocal, f.binding.index);
+      break;
+    case Scope::kFree:
+      emit(Opcode::kSetFree, f.binding.index);
+      break;
+    case Scope::kBuiltin:
+    case Scope::kCurrentClosure:
+      LOG_CODEGEN_ERR(std::format("can't assign to {}", name));
+      break;
+  }
+  finish();
+}
+
+void Codegen::resumeIndexExpr(const IndexExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      return visit(e->lhs);
+    case 1:
+      return visit(e->idx);
+    default:
+      emit(Opcode::kIndex);
+      return finish();
+  }
+}
+
+void Codegen::resumeHashMapExpr(const HashMapExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step < 2 * e->pairs.size()) {
+    const auto& [key, val] = e->pairs[step / 2];
+    return visit(step % 2 == 0 ? key : val);
+  }
+  emit(Opcode::kHashMap, static_cast<uint32_t>(e->pairs.size()));
+  finish();
+}
+
+void Codegen::resumeIdentifierExpr(const IdentifierExpr* e, Frame&) {
+  auto b = resolve(e->identifier);
+  if (!b) {
+    LOG_CODEGEN_ERR(std::format("undefined variable {}", e->identifier));
+    return finish();
+  }
+  load(*b);
+  finish();
+}
+
+void Codegen::resumeNullExpr(const NullExpr*, Frame&) {
+  emit(Opcode::kNull);
+  finish();
+}
+
+void Codegen::resumeBoolExpr(const BoolExpr* e, Frame&) {
+  emit(e->value ? Opcode::kTrue : Opcode::kFalse);
+  finish();
+}
+
+void Codegen::resumeIntegerExpr(const IntegerExpr* e, Frame&) {
+  emit(Opcode::kConst, constants_.integer(e->value));
+  finish();
+}
+
+void Codegen::resumeFloatExpr(const FloatExpr* e, Frame&) {
+  emit(Opcode::kConst, constants_.number(e->value));
+  finish();
+}
+
+void Codegen::resumeStrExpr(const StrExpr* e, Frame&) {
+  emit(Opcode::kConst, constants_.string(e->value));
+  finish();
+}
+
+void Codegen::resumeLetStmt(const LetStmt* s, Frame& f) {
+  auto name = s->identifier->identifier;
+  if (f.step++ == 0) {
+    if (s->rhs->kind() == AstNode::Kind::kFnExpr) {
+      return compileFunction(static_cast<const FnExpr*>(s->rhs), name);
+    }
+    return visit(s->rhs);
+  }
+
+  auto b = define(name);
+  emit(b.scope == Scope::kGlobal ? Opcode::kSetGlobal : Opcode::kSetLocal, b.index);
+  finish();
+}
+
+void Codegen::resumeRetStmt(const RetStmt* s, Frame& f) {
+  if (f.step++ == 0) {
+    return visit(s->expr);
+  }
+  emit(Opcode::kReturn);
+  finish();
+}
+
+void Codegen::resumeExprStmt(const ExprStmt* s, Frame& f) {
+  if (f.step++ == 0) {
+    return visit(s->expr);
+  }
+  emit(Opcode::kPop);
+  finish();
+}
+
+// As a statement a block's value is popped.
+void Codegen::resumeBlockStmt(const BlockStmt* s, Frame& f) {
+  auto step = f.step++;
+  const auto& body = s->body;
+  if (step < body.size()) {
+    // The value of a block is that of its last statement if it is an expression statement.
+    const auto* stmt = body[step];
+    if (step + 1 == body.size() && stmt->kind() == AstNode::Kind::kExprStmt) {
+      return visit(static_cast<const ExprStmt*>(stmt)->expr);
+    }
+    return visit(stmt);
+  }
+  if (body.empty() || body.back()->kind() != AstNode::Kind::kExprStmt) {
+    emit(Opcode::kNull);
+  }
+  if (!f.value) {
+    emit(Opcode::kPop);
+  }
+  finish();
+}
+
+auto Codegen::resolve(std::string_view name) -> std::optional<Binding> {
+  return resolveIn(scopes_.size() - 1, name);
+}
+
+auto Codegen::resolveIn(size_t depth, std::string_view name) -> std::optional<Binding> {
+  if (depth == 0) {
+    if (auto it = globals_.find(name); it != globals_.end()) {
+      return Binding{Scope::kGlobal, it->second};
+    }
+    if (auto builtin = builtinLookup(name)) {
+      return Binding{Scope::kBuiltin, *builtin};
+    }
+    return std::nullopt;
+  }
+
+  auto& state = scopes_[depth];
+  if (auto it = state.locals.find(name); it != state.locals.end()) {
+    return Binding{Scope::kLocal, it->second};
+  }
+  if (auto it = state.freeIndex.find(name); it != state.freeIndex.end()) {
+    return Binding{Scope::kFree, it->second};
+  }
+  if (!state.self.empty() && state.self == name) {
+    return Binding{Scope::kCurrentClosure, 0};
+  }
+
+  auto outer = resolveIn(depth - 1, name);
+  if (!outer || outer->scope == Scope::kGlobal || outer->scope == Scope::kBuiltin) {
+    return outer;
+  }
+  auto index = static_cast<uint32_t>(state.frees.size());
+  state.frees.push_back(*outer);
+  state.freeIndex.emplace(name, index);
+  return Binding{Scope::kFree, index};
+}
+
+auto Codegen::define(std::string_view name) -> Binding {
+  if (scopes_.size() == 1) {
+    auto [it, fresh] = globals_.try_emplace(name, static_cast<uint32_t>(globals_.size()));
+    if (fresh) {
+      program_.globals.emplace_back(name);
+    }
+    return {Scope::kGlobal, it->second};
+  }
+  auto& locals = scopes_.back().locals;
+  auto it = locals.try_emplace(name, static_cast<uint32_t>(locals.size())).first;
+  return {Scope::kLocal, it->second};
+}
+
+void Codegen::load(Binding b) {
+  switch (b.scope) {
+    case Scope::kGlobal:
+      emit(Opcode::kGetGlobal, b.index);
+      break;
+    case Scope::kLocal:
+      emit(Opcode::kGetLocal, b.index);
+      break;
+    case Scope::kFree:
+      emit(Opcode::kGetFree, b.index);
+      break;
+    case Scope::kBuiltin:
+      emit(Opcode::kGetBuiltin, b.index);
+      break;
+    case Scope::kCurrentClosure:
+      emit(Opcode::kCurrentClosure);
+      break;
+  }
+}
+
+void Codegen::emit(Opcode op, uint32_t a, uint32_t b) {
+  auto& c = code();
+  c.push_back(static_cast<uint8_t>(op));
+  auto operands = opcodeOperands(op);
+  if (operands > 0) {
+    writeOperand(c, a);
+  }
+  if (operands > 1) {
+    writeOperand(c, b);
+  }
+
+  auto& state = scopes_.back();
+  state.depth = static_cast<uint32_t>(std::max(int64_t{0}, state.depth + stackEffect(op, a, b)));
+  state.maxDepth = std::max(state.maxDepth, state.depth);
+}
+
+auto Codegen::emitJump(Opcode op) -> size_t {
+  emit(op);
+  auto at = code().size();
+  code().resize(at + kJumpTargetBytes);
+  return at;
+}
+
+void Codegen::patchJump(size_t at, size_t target) {
+  auto v = static_cast<uint32_t>(target);
+  memcpy(code().data() + at, &v, sizeof(v));
+}
 
 }  // namespace tmonkey
\ No newline at end of file
@@ -1,17 +1,138 @@
 #pragma once
 
 #include "ast.h"
+#include "bytecode.h"
 #include "common.h"
 
 namespace tmonkey {
-class Codegen {
+
+// Lowers a tree to bytecode. Top-level lets are globals and lets inside a function are locals of
+// that function; blocks don't open a scope. A function refers to the variables of enclosing
+// functions through copies captured when its closure is created, so assigning to one only changes
+// the copy. An if, a block and a function body evaluate to their last expression statement, or to
+// null if there is none.
+class Codegen : public AstWalker<Codegen> {
 public:
+  // Nullopt if the tree can't be compiled, e.g. it uses an undefined variable; `errors` then says
+  // why.
+  static auto compile(
+      const std::vector<AstNode*>& tree, std::vector<std::string>* errors = nullptr)
+      -> std::optional<Program>;
+
+private:
+  friend class AstWalker<Codegen>;
+
+  enum class Scope : uint8_t {
+    kGlobal,
+    kLocal,
+    kFree,
+    kBuiltin,
+    kCurrentClosure,
+  };
+
+  struct Binding {
+    Scope scope;
+    uint32_t index;
+  };
+
+  struct FunctionState {
+    uint32_t function = 0;
+    std::unordered_map<std::string_view, uint32_t> locals{};
+    // Captured bindings of the enclosing function, in GetFree order.
+    std::vector<Binding> frees{};
+    std::unordered_map<std::string_view, uint32_t> freeIndex{};
+    // The let name the function is bound to, so its body can call it.
+    std::string_view self{};
+    // Values on the operand stack at the current instruction, and the most there ever are.
+    uint32_t depth = 0;
+    uint32_t maxDepth = 0;
+  };
+
+  struct Frame {
+    const AstNode* node;
+    size_t step = 0;
+    // A block frame leaves the block's value on the stack rather than popping it.
+    bool value = false;
+    // The let name a function is bound to.
+    std::string_view name{};
+    // Where an if or while patches its jump, and where a while loops back to.
+    size_t jump = 0;
+    size_t start = 0;
+    // The variable an assignment stores to.
+    Binding binding{};
+  };
+
+  Codegen();
+
   void visit(const AstNode* n) {
-    AST_NODE_SWITCH(AST_GEN_VISIT_NODE_SWITCH_CASE)
+    descend(Frame{.node = n});
   }
 
-private:
-  AST_NODE_LIST(GEN_AST_VISITORS)
+  // Compiles a block that leaves exactly one value on the stack.
+  void blockValue(const BlockStmt* s) {
+    descend(Frame{.node = s, .value = true});
+  }
+
+  void compileFunction(const FnExpr* e, std::string_view name) {
+    descend(Frame{.node = e, .name = name});
+  }
+
+  void resumeInfixExpr(const InfixExpr* e, Frame& f);
+  void resumePrefixExpr(const PrefixExpr* e, Frame& f);
+  void resumeIfExpr(const IfExpr* e, Frame& f);
+  void resumeWhileExpr(const WhileExpr* e, Frame& f);
+  void resumeImportExpr(const ImportExpr* e, Frame& f);
+  void resumeFnExpr(const FnExpr* e, Frame& f);
+  void resumeCallExpr(const CallExpr* e, Frame& f);
+  void resumeArrayExpr(const ArrayExpr* e, Frame& f);
+  void resumeAssignExpr(const AssignExpr* e, Frame& f);
+  void resumeIndexExpr(const IndexExpr* e, Frame& f);
+  void resumeHashMapExpr(const HashMapExpr* e, Frame& f);
+  void resumeIdentifierExpr(const IdentifierExpr* e, Frame& f);
+  void resumeNullExpr(const NullExpr* e, Frame& f);
+  void resumeBoolExpr(const BoolExpr* e, Frame& f);
+  void resumeIntegerExpr(const IntegerExpr* e, Frame& f);
+  void resumeFloatExpr(const FloatExpr* e, Frame& f);
+  void resumeStrExpr(const StrExpr* e, Frame& f);
+  void resumeLetStmt(const LetStmt* s, Frame& f);
+  void resumeRetStmt(const RetStmt* s, Frame& f);
+  void resumeExprStmt(const ExprStmt* s, Frame& f);
+  void resumeBlockStmt(const BlockStmt* s, Frame& f);
+
+  auto resolve(std::string_view name) -> std::optional<Binding>;
+  auto resolveIn(size_t depth, std::string_view name) -> std::optional<Binding>;
+  auto define(std::string_view name) -> Binding;
+  void load(Binding b);
+
+  auto code() -> std::vector<uint8_t>& {
+    return program_.functions[scopes_.back().function].code;
+  }
+
+  void emit(Opcode op, uint32_t a = 0, uint32_t b = 0);
+
+  // Moves the tracked stack depth, e.g. back to where both arms of an if start.
+  void setDepth(uint32_t depth) {
+    scopes_.back().depth = depth;
+  }
+
+  auto depth() const -> uint32_t {
+    return scopes_.back().depth;
+  }
+
+  // Emits a jump with a target to be patched, and returns where the target goes.
+  auto emitJump(Opcode op) -> size_t;
+  void patchJump(size_t at, size_t target);
+
+  void logError(std::string msg) {
+    errors_.push_back(std::move(msg));
+  }
+
+  Program program_;
+  ConstantPool constants_{program_};
+  std::vector<FunctionState> scopes_;
+  std::deque<Frame> frames_;
+  std::unordered_map<std::string_view, uint32_t> globals_;
+  std::vector<std::string> errors_;
 };
 
 }  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "codegen.h"
+#include "common.h"
+#include "gtest/gtest.h"
+#include "parser.h"
+#include "reg_codegen.h"
+
+namespace tmonkey {
+namespace {
+
+auto compile(std::string_view src, std::vector<std::string>* errors = nullptr)
+    -> std::optional<Program> {
+  Arena arena;
+  std::vector<std::string> parseErrors;
+  auto tree = parse(src, arena, &parseErrors);
+  EXPECT_TRUE(parseErrors.empty());
+  return Codegen::compile(tree, errors);
+}
+
+auto compileRegisters(std::string_view src, std::vector<std::string>* errors = nullptr)
+    -> std::optional<Program> {
+  Arena arena;
+  std::vector<std::string> parseErrors;
+  auto tree = parse(src, arena, &parseErrors);
+  EXPECT_TRUE(parseErrors.empty());
+  return RegCodegen::compile(tree, errors);
+}
+
+TEST(CodegenTests, Basics) {
+  auto program = compile("let x = 1 + 2.5;\nif (x > 1) { puts(x) } else { -x };");
+  ASSERT_TRUE(program);
+  ASSERT_EQ(
+      disassemble(*program),
+      "fn 0 <main> params: 0 locals: 0 stack: 2\n"
+      "   0 Const 0 (1)\n"
+      "   2 Const 1 (2.5)\n"
+      "   4 Add\n"
+      "   5 SetGlobal 0\n"
+      "   7 GetGlobal 0\n"
+      "   9 Const 0 (1)\n"
+      "  11 Gt\n"
+      "  12 JumpIfFalse 28\n"
+      "  17 GetBuiltin 0\n"
+      "  19 GetGlobal 0\n"
+      "  21 Call 1\n"
+      "  23 Jump 31\n"
+      "  28 GetGlobal 0\n"
+      "  30 Neg\n"
+      "  31 Pop\n"
+      "  32 Null\n"
+      "  33 Return\n");
+}
+
+TEST(CodegenTests, Constants) {
+  auto program = compile("[1, 1, 2.5, 2.5, \"a\", \"a\", 0.0, 1, \"b\", \"a\"];");
+  ASSERT_TRUE(program);
+  ASSERT_EQ(program->constants.size(), 5u);
+
+  // Operands past 127 take more than one byte.
+  std::string src = "[";
+  for (int i = 0; i < 300; i++) {
+    src += std::format("{}, ", i);
+  }
+  src += "];";
+  program = compile(src);
+  ASSERT_TRUE(program);
+  ASSERT_EQ(program->constants.size(), 300u);
+  auto dis = disassemble(*program);
+  ASSERT_NE(dis.find(" Const 299 (299)\n"), std::string::npos) << dis;
+  ASSERT_NE(dis.find(" Array 300\n"), std::string::npos) << dis;
+}
+
+TEST(CodegenTests, Functions) {
+  auto program = compile(
+      "let fib = fn(n) { if (n < 2) { return n; }; fib(n - 1) + fib(n - 2) };\n"
+      "let counter = fn(x) { fn() { x = x + 1 } };\n"
+      "let c = counter(0);\n"
+      "c();");
+  ASSERT_TRUE(program);
+  ASSERT_EQ(program->functions.size(), 4u);
+  ASSERT_EQ(program->globals, (std::vector<std::string>{"fib", "counter", "c"}));
+
+  const auto& fib = program->functions[1];
+  ASSERT_EQ(fib.name, "fib");
+  ASSERT_EQ(fib.params, 1u);
+  ASSERT_EQ(fib.locals, 1u);
+  // fib(n - 1) + fib(n - 2) holds the first result, the callee, n and 1 or 2.
+  ASSERT_EQ(fib.maxStack, 4u);
+
+  auto dis = disassemble(*program);
+  ASSERT_NE(dis.find("CurrentClosure\n"), std::string::npos) << dis;
+  // The inner function captures x from counter.
+  ASSERT_NE(dis.find("GetLocal 0\n   2 Closure 3 1\n"), std::string::npos) << dis;
+  ASSERT_NE(dis.find("SetFree 0\n"), std::string::npos) << dis;
+}
+
+TEST(CodegenTests, Collections) {
+  auto program = compile(
+      "let a = [1, {\"k\": 2}];\n"
+      "a[1][\"k\"] = 3;\n"
+      "let i = 0;\n"
+      "while (i < 3) { i = i + 1; };");
+  ASSERT_TRUE(program);
+  auto dis = disassemble(*program);
+  ASSERT_NE(dis.find("HashMap 1\n"), std::string::npos) << dis;
+  ASSERT_NE(dis.find("Index\n"), std::string::npos) << dis;
+  ASSERT_NE(dis.find("SetIndex\n"), std::string::npos) << dis;
+  ASSERT_NE(dis.find("Dup\n"), std::string::npos) << dis;
+}
+
+TEST(CodegenTests, Errors) {
+  std::vector<std::string> errors;
+  ASSERT_FALSE(compile("let a = b;", &errors));
+  ASSERT_EQ(errors, std::vector<std::string>{"codegen error: undefined variable b"});
+  ASSERT_FALSE(compile("puts = 1;", &errors));
+  ASSERT_EQ(errors, std::vector<std::string>{"codegen error: can't assign to puts"});
+  ASSERT_FALSE(compile("fn(1) { 1 };", &errors));
+  ASSERT_EQ(errors.size(), 1u);
+
+  // Later globals are visible in earlier functions.
+  ASSERT_TRUE(compile("let f = fn() { g() };\nlet g = fn() { 1 };", &errors));
+  ASSERT_TRUE(errors.empty());
+}
+
+TEST(CodegenTests, Registers) {
+  auto program = compileRegisters(
+      "let i = 0;\n"
+      "let s = 0;\n"
+      "while (i < 10) { s = s + i * 2; i = i + 1; };\n"
+      "return s;");
+  ASSERT_TRUE(program);
+  ASSERT_EQ(
+      disassemble(*program),
+      "fn 0 <main> params: 0 registers: 3\n"
+      "   0 LoadK 0 0 (0)\n"
+      "   3 LoadK 1 0 (0)\n"
+      "   6 LtK 2 0 1 (10)\n"
+      "  10 JumpIfFalse 2 33\n"
+      "  16 MulK 2 0 2 (2)\n"
+      "  20 Add 1 1 2\n"
+      "  24 AddK 0 0 3 (1)\n"
+      "  28 Jump 6\n"
+      "  33 Return 1\n"
+      "  35 LoadNull 2\n"
+      "  37 Return 2\n");
+
+  // An if used as a statement leaves no value, so without an else it is just the conditional
+  // jump over its block.
+  program = compileRegisters("let f = fn(n) { if (n < 2) { return n; }; n };");
+  ASSERT_TRUE(program);
+  ASSERT_EQ(
+      disassemble(*program).substr(disassemble(*program).find("fn 1")),
+      "fn 1 f params: 1 registers: 3\n"
+      "   0 LtK 2 0 0 (2)\n"
+      "   4 JumpIfFalse 2 12\n"
+      "  10 Return 0\n"
+      "  12 Move 1 0\n"
+      "  15 Return 1\n");
+}
+
+TEST(CodegenTests, RegisterFunctions) {
+  auto program = compileRegisters(
+      "let fib = fn(n) { if (n < 2) { return n; }; fib(n - 1) + fib(n - 2) };\n"
+      "let counter = fn(x) { let step = 1; fn() { x = x + step } };\n"
+      "let total = 0;\n"
+      "puts(fib(10), counter(1)());");
+  ASSERT_TRUE(program);
+  // fib is used inside a function, so it stays a global; counter and total get registers.
+  ASSERT_EQ(program->globals, std::vector<std::string>{"fib"});
+  ASSERT_EQ(program->functions[1].params, 1u);
+  auto dis = disassemble(*program);
+  // The results of both recursive calls land where Add reads them.
+  ASSERT_NE(dis.find("Call 2 1\n"), std::string::npos) << dis;
+  ASSERT_NE(dis.find("Add 1 2 3\n"), std::string::npos) << dis;
+  // The closure captures x and step from the registers of counter.
+  ASSERT_NE(dis.find("Closure 2 3 3 2\n"), std::string::npos) << dis;
+
+  std::vector<std::string> errors;
+  ASSERT_FALSE(compileRegisters("let a = b;", &errors));
+  ASSERT_EQ(errors, std::vector<std::string>{"codegen error: undefined variable b"});
+  ASSERT_FALSE(compileRegisters("puts = 1;", &errors));
+  ASSERT_EQ(errors, std::vector<std::string>{"codegen error: can't assign to puts"});
+}
+
+}  // namespace
+}  // namespace tmonkey
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <format>
 #include <functional>
 #include <iostream>
@@ -11,6 +14,8 @@
 #include <type_traits>
 #include <unordered_map>
 #include <variant>
+#include <vector>
+#include "virtual_memory.h"
 
 namespace tmonkey {
 
@@ -24,78 +29,236 @@ namespace tmonkey {
 
 #define ASSERT_NO_NULLPTR(PTR) static_assert(!std::is_null_pointer_v<decltype(PTR)>);
 
+// For small helpers used in the VM's dispatch loop, which is too big for the compiler to inline
+// into on its own.
+#if defined(__GNUC__)
+#define ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// Bump allocator for AST nodes. Blocks grow geometrically from kDefaultBlockSize up to a
+// configurable cap; requests too big to share a block get their own allocation so the current
+// block keeps serving small ones. Nothing allocated from the arena has its destructor run.
+//
+// With the VirtualMemory backend the first block is one large mmap reservation, backed by
+// transparent huge pages where available and committed in kCommitChunk steps as the bump pointer
+// reaches it. Heap blocks take over if the reservation runs out.
 class Arena {
   static constexpr size_t kDefaultBlockSize = 4096;
   static constexpr size_t kAlignment = alignof(std::max_align_t);
+  static constexpr size_t kCommitChunk = 2 << 20;
+  static constexpr size_t kResetKeepBlocks = 4;
 
 public:
-  explicit Arena() {}
+  static constexpr size_t kDefaultMaxBlockSize = 1 << 20;
+
+  struct VirtualMemory {
+    size_t reserveBytes = size_t{64} << 30;
+  };
+
+  // Position of the bump pointer, see rewind().
+  struct Mark {
+    size_t block;
+    size_t used;
+    size_t large;
+  };
+
+  explicit Arena(size_t maxBlockSize = kDefaultMaxBlockSize)
+      : maxBlockSize_{std::max(maxBlockSize, kDefaultBlockSize)} {}
+
+  // Falls back to heap blocks if the address space can't be reserved.
+  explicit Arena(VirtualMemory vm, size_t maxBlockSize = kDefaultMaxBlockSize)
+      : Arena(maxBlockSize) {
+    reserveRegion(vm.reserveBytes);
+  }
 
   NO_COPYABLE(Arena)
   NO_MOVABLE(Arena)
 
   ~Arena() {
-    for (auto* b : blocks_) {
-      delete[] b;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      if (i == 0 && region_) {
+        releaseVirtual(blocks_[0].data, blocks_[0].size);
+      } else {
+        delete[] blocks_[i].data;
+      }
+    }
+    for (auto& l : large_) {
+      delete[] l.data;
     }
   }
 
   auto alloc(size_t bytes) -> char* {
     auto alignmentBytes = (bytes + (kAlignment - 1)) & ~(kAlignment - 1);
 
-    if (alignmentBytes > bytesRemaining_) {
-      auto size = std::max(alignmentBytes, kDefaultBlockSize);
-      blocks_.push_back(new char[size]);
-      bytesRemaining_ = size;
+    // An empty arena has no block to point into, even for zero bytes.
+    if (blocks_.empty() || alignmentBytes > bytesRemaining()) {
+      auto next = nextBlockSize();
+      if (alignmentBytes > next / 4) {
+        return allocLarge(alignmentBytes);
+      }
+      // Blocks kept by rewind()/reset() are reused before new ones are allocated.
+      if (!blocks_.empty()) {
+        currBlock_++;
+      }
+      if (currBlock_ == blocks_.size()) {
+        blocks_.push_back({new char[next], next});
+      }
       bytesAllocated_ = 0;
     }
 
-    auto* block = blocks_.back() + bytesAllocated_;
-    bytesRemaining_ -= alignmentBytes;
+    auto* block = blocks_[currBlock_].data + bytesAllocated_;
     bytesAllocated_ += alignmentBytes;
 
+    if (region_ && currBlock_ == 0 && bytesAllocated_ > committed_) {
+      commit(bytesAllocated_);
+    }
+
     return block;
   }
 
-private:
-  size_t bytesAllocated_ = 0;
-  size_t bytesRemaining_ = 0;
-  std::vector<char*> blocks_;
-};
-
-class StringInterningMap {
-public:
-  StringInterningMap() = default;
+  auto mark() const -> Mark {
+    return {currBlock_, bytesAllocated_, large_.size()};
+  }
 
-  NO_COPYABLE(StringInterningMap)
+  // Releases everything allocated since `m`. Bump blocks are kept for reuse, large allocations
+  // are freed.
+  void rewind(Mark m) {
+    for (auto i = m.large; i < large_.size(); i++) {
+      delete[] large_[i].data;
+    }
+    large_.resize(m.large);
+    currBlock_ = m.block;
+    bytesAllocated_ = m.used;
+  }
 
-  StringInterningMap(StringInterningMap&& other) noexcept {
-    if (&other != this) {
-      map_ = std::move(other.map_);
-      vec_ = std::move(other.vec_);
+  // Releases everything but keeps the leading bump blocks, up to kResetKeepBlocks max-size blocks
+  // worth, so a reused arena refills the same blocks instead of growing from malloc again. A
+  // virtual region keeps its first commit chunk and hands the rest of its pages back to the OS.
+  void reset() {
+    size_t keep = 0;
+    size_t kept = 0;
+    for (; keep < blocks_.size(); keep++) {
+      auto size = keep == 0 && region_ ? 0 : blocks_[keep].size;
+      if (kept + size > kResetKeepBlocks * maxBlockSize_) {
+        break;
+      }
+      kept += size;
+    }
+    for (auto i = keep; i < blocks_.size(); i++) {
+      delete[] blocks_[i].data;
     }
+    blocks_.resize(keep);
+    rewind({0, 0, 0});
+    releaseUnused();
   }
 
-  auto intern(std::string_view s) -> size_t {
-    if (auto it = map_.find(s); it != map_.end()) {
-      return it->second;
+  // Returns the pages of the virtual region above the bump pointer to the OS and stops counting
+  // them as committed. They stay mapped and are faulted back in as zero pages on reuse. A no-op
+  // for heap blocks.
+  void releaseUnused() {
+    if (!region_) {
+      return;
+    }
+    auto used = currBlock_ == 0 ? bytesAllocated_ : blocks_[0].size;
+    auto keep = std::max(roundUp(used, kCommitChunk), kCommitChunk);
+    if (keep < committed_) {
+      decommitVirtual(blocks_[0].data + keep, committed_ - keep);
+      committed_ = keep;
     }
-    vec_.push_back(std::make_unique<std::string>(s));
-    auto idx = vec_.size() - 1;
-    map_[s] = idx;
-    return idx;
   }
 
-  auto string(size_t idx) -> std::optional<std::string_view> {
-    if (idx >= vec_.size()) {
-      return {};
+  // Bytes obtained from the heap or committed in the virtual region, including unused tails.
+  auto bytesReserved() const -> size_t {
+    size_t total = 0;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      total += i == 0 && region_ ? committed_ : blocks_[i].size;
     }
-    return std::string_view(*vec_[idx]);
+    for (auto& l : large_) {
+      total += l.size;
+    }
+    return total;
   }
 
 private:
-  std::unordered_map<std::string_view, size_t> map_;
-  std::vector<std::unique_ptr<std::string>> vec_;
+  struct Block {
+    char* data;
+    size_t size;
+  };
+
+  auto bytesRemaining() const -> size_t {
+    return blocks_.empty() ? 0 : blocks_[currBlock_].size - bytesAllocated_;
+  }
+
+  auto nextBlockSize() const -> size_t {
+    if (currBlock_ + 1 < blocks_.size()) {
+      return blocks_[currBlock_ + 1].size;
+    }
+    return blocks_.empty() ? kDefaultBlockSize : std::min(blocks_.back().size * 2, maxBlockSize_);
+  }
+
+  static auto roundUp(size_t n, size_t to) -> size_t {
+    return (n + to - 1) / to * to;
+  }
+
+  void reserveRegion(size_t bytes) {
+    bytes = roundUp(std::max(bytes, kCommitChunk), kCommitChunk);
+    // Aligned to a chunk so the region starts on a huge page boundary.
+    auto* start = reserveVirtual(bytes, kCommitChunk);
+    if (!start) {
+      return;
+    }
+    region_ = true;
+    blocks_.push_back({start, bytes});
+  }
+
+  void commit(size_t used) {
+    auto target = std::min(roundUp(used, kCommitChunk), blocks_[0].size);
+    if (!commitVirtual(blocks_[0].data + committed_, target - committed_)) {
+      std::cerr << "arena: out of memory committing virtual region\n";
+      std::abort();
+    }
+    committed_ = target;
+  }
+
+  auto allocLarge(size_t bytes) -> char* {
+    large_.push_back({new char[bytes], bytes});
+    return large_.back().data;
+  }
+
+  size_t maxBlockSize_;
+  bool region_ = false;
+  size_t committed_ = 0;
+  size_t currBlock_ = 0;
+  size_t bytesAllocated_ = 0;
+  std::vector<Block> blocks_;
+  std::vector<Block> large_;
 };
 
+// Fast non-cryptographic 64-bit hash over 8-byte words.
+inline auto hashBytes(std::string_view s, uint64_t seed = 0) -> uint64_t {
+  constexpr uint64_t kMul = 0x9e3779b97f4a7c15ull;
+  auto mix = [](uint64_t x) {
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ull;
+    return x ^ (x >> 32);
+  };
+
+  auto h = seed ^ (s.size() * kMul);
+  const auto* p = s.data();
+  auto n = s.size();
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    h = (h ^ mix(w)) * kMul;
+  }
+  if (n > 0) {
+    uint64_t w = 0;
+    std::memcpy(&w, p, n);
+    h = (h ^ mix(w)) * kMul;
+  }
+  return mix(h);
+}
+
 }  // namespace tmonkey
\ No newline at end of file
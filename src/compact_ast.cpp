@@ -0,0 +1,729 @@
+#include "compact_ast.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+
+namespace tmonkey {
+
+struct CompactAst::Storage {
+  std::vector<compact::NodeRef> refs;
+#define GEN_STORAGE_TABLE(Name) std::vector<compact::Name> Name##s;
+  COMPACT_AST_TABLE_LIST(GEN_STORAGE_TABLE)
+#undef GEN_STORAGE_TABLE
+};
+
+class CompactAstBuilder {
+public:
+  explicit CompactAstBuilder(std::string_view source)
+      : source_{source}, storage_{std::make_unique<CompactAst::Storage>()} {}
+
+  auto build(const std::vector<AstNode*>& tree) -> CompactAst {
+    AstPasses<CompactAstBuilder>(*this).run(tree);
+
+    CompactAst ast(source_);
+    ast.roots_ = flushList(0);
+    ast.refs_ = storage_->refs;
+#define GEN_VIEW(Name) ast.Name##s_ = storage_->Name##s;
+    COMPACT_AST_TABLE_LIST(GEN_VIEW)
+#undef GEN_VIEW
+    ast.storage_ = std::move(storage_);
+    return ast;
+  }
+
+  // A node is left after its children, whose refs are then on top of scratch_ in source order.
+  void leaveNode(const AstNode* n) {
+    scratch_.push_back(lower(n));
+  }
+
+private:
+  template <typename T>
+  auto add(std::vector<T>& table, AstNode::Kind kind, T node) -> compact::NodeRef {
+    if (table.size() > compact::NodeRef::kMaxIndex) {
+      std::cerr << std::format("compact ast: too many {} nodes\n", static_cast<int>(kind));
+      std::abort();
+    }
+    table.push_back(node);
+    return compact::NodeRef(kind, static_cast<uint32_t>(table.size() - 1));
+  }
+
+  auto str(std::string_view s) const -> compact::Str {
+    return {static_cast<uint32_t>(s.data() - source_.data()), static_cast<uint32_t>(s.size())};
+  }
+
+  // Moves the refs pushed since `base` into one contiguous run of the ref list.
+  auto flushList(size_t base) -> compact::List {
+    auto& refs = storage_->refs;
+    compact::List l = {
+      static_cast<uint32_t>(refs.size()), static_cast<uint32_t>(scratch_.size() - base)};
+    refs.insert(refs.end(), scratch_.begin() + static_cast<ptrdiff_t>(base), scratch_.end());
+    scratch_.resize(base);
+    return l;
+  }
+
+  auto pop() -> compact::NodeRef {
+    auto ref = scratch_.back();
+    scratch_.pop_back();
+    return ref;
+  }
+
+  auto popList(size_t count) -> compact::List {
+    return flushList(scratch_.size() - count);
+  }
+
+  // Adds `n` for the refs of its children, popping them off scratch_.
+  auto lower(const AstNode* n) -> compact::NodeRef;
+
+  std::string_view source_;
+  std::unique_ptr<CompactAst::Storage> storage_;
+  std::vector<compact::NodeRef> scratch_;
+};
+
+auto CompactAstBuilder::lower(const AstNode* n) -> compact::NodeRef {
+  using Kind = AstNode::Kind;
+
+  switch (n->kind()) {
+    case Kind::kInfixExpr: {
+      const auto* e = static_cast<const InfixExpr*>(n);
+      auto rhs = pop();
+      auto lhs = pop();
+      return add(storage_->InfixExprs, n->kind(), {e->op.kind(), lhs, rhs});
+    }
+    case Kind::kPrefixExpr: {
+      const auto* e = static_cast<const PrefixExpr*>(n);
+      return add(storage_->PrefixExprs, n->kind(), {e->op.kind(), pop()});
+    }
+    case Kind::kIfExpr: {
+      auto alt = static_cast<const IfExpr*>(n)->alt ? pop() : compact::NodeRef();
+      auto coseq = pop();
+      auto cnd = pop();
+      return add(storage_->IfExprs, n->kind(), {cnd, coseq, alt});
+    }
+    case Kind::kWhileExpr: {
+      auto coseq = pop();
+      return add(storage_->WhileExprs, n->kind(), {pop(), coseq});
+    }
+    case Kind::kImportExpr:
+      return add(storage_->ImportExprs, n->kind(), {pop()});
+    case Kind::kFnExpr: {
+      auto body = pop();
+      auto params = popList(static_cast<const FnExpr*>(n)->params.size());
+      return add(storage_->FnExprs, n->kind(), {params, body});
+    }
+    case Kind::kCallExpr: {
+      auto args = popList(static_cast<const CallExpr*>(n)->args.size());
+      return add(storage_->CallExprs, n->kind(), {pop(), args});
+    }
+    case Kind::kArrayExpr: {
+      const auto* e = static_cast<const ArrayExpr*>(n);
+      return add(storage_->ArrayExprs, n->kind(), {popList(e->elements.size())});
+    }
+    case Kind::kAssignExpr: {
+      auto rhs = pop();
+      return add(storage_->AssignExprs, n->kind(), {pop(), rhs});
+    }
+    case Kind::kIndexExpr: {
+      auto idx = pop();
+      return add(storage_->IndexExprs, n->kind(), {pop(), idx});
+    }
+    case Kind::kHashMapExpr: {
+      // Keys and values alternate.
+      auto pairs = static_cast<const HashMapExpr*>(n)->pairs.size();
+      return add(storage_->HashMapExprs, n->kind(), {popList(2 * pairs)});
+    }
+    case Kind::kIdentifierExpr: {
+      const auto* e = static_cast<const IdentifierExpr*>(n);
+      return add(storage_->IdentifierExprs, n->kind(), {str(e->identifier), e->symbol.id});
+    }
+    case Kind::kNullExpr:
+      return compact::NodeRef(n->kind(), 0);
+    case Kind::kBoolExpr:
+      return compact::NodeRef(n->kind(), static_cast<const BoolExpr*>(n)->value ? 1 : 0);
+    case Kind::kIntegerExpr:
+      return add(storage_->IntegerExprs, n->kind(), {static_cast<const IntegerExpr*>(n)->value});
+    case Kind::kFloatExpr:
+      return add(storage_->FloatExprs, n->kind(), {static_cast<const FloatExpr*>(n)->value});
+    case Kind::kStrExpr:
+      return add(storage_->StrExprs, n->kind(), {str(static_cast<const StrExpr*>(n)->value)});
+    case Kind::kLetStmt: {
+      auto rhs = pop();
+      return add(storage_->LetStmts, n->kind(), {pop(), rhs});
+    }
+    case Kind::kRetStmt:
+      return add(storage_->RetStmts, n->kind(), {pop()});
+    case Kind::kBlockStmt: {
+      const auto* s = static_cast<const BlockStmt*>(n);
+      return add(storage_->BlockStmts, n->kind(), {popList(s->body.size())});
+    }
+    case Kind::kExprStmt:
+      return add(storage_->ExprStmts, n->kind(), {pop()});
+    case Kind::kExpr:
+    case Kind::kStmt:
+      break;
+  }
+
+  return compact::NodeRef();
+}
+
+auto CompactAst::build(const std::vector<AstNode*>& tree, std::string_view source) -> CompactAst {
+  return CompactAstBuilder(source).build(tree);
+}
+
+namespace {
+
+class CompactAstExpander {
+public:
+  CompactAstExpander(const CompactAst& ast, Arena& arena, InternerRef interner)
+      : ast_{ast}, arena_{arena}, interner_{interner} {}
+
+  auto expandRoots() -> std::vector<AstNode*> {
+    auto roots = ast_.roots();
+    for (size_t i = roots.size(); i-- > 0;) {
+      stack_.push_back({roots[i], Step::kEnter});
+    }
+
+    // Nodes are created after their children, which are then on top of nodes_ in source order.
+    while (!stack_.empty()) {
+      auto [ref, step] = stack_.back();
+      stack_.pop_back();
+      switch (step) {
+        case Step::kEnter: {
+          stack_.push_back({ref, Step::kLeave});
+          auto first = stack_.size();
+          pushChildren(ref);
+          std::reverse(stack_.begin() + static_cast<ptrdiff_t>(first), stack_.end());
+          break;
+        }
+        case Step::kLeave:
+          nodes_.push_back(create(ref));
+          break;
+        case Step::kKey: {
+          // String keys are interned, as the parser does.
+          auto text = ast_.text(ast_.getStrExpr(ref).value);
+          nodes_.push_back(createNode<StrExpr>(text, interner_.symbol(text)));
+          break;
+        }
+      }
+    }
+    return std::move(nodes_);
+  }
+
+private:
+  enum class Step : uint8_t {
+    kEnter,
+    kLeave,
+    // A string hash-map key.
+    kKey,
+  };
+
+  template <typename T, typename... Args>
+  auto createNode(Args&&... args) -> T* {
+    return new (arena_.alloc(sizeof(T))) T(std::forward<Args>(args)...);
+  }
+
+  template <typename T>
+  auto pop() -> T* {
+    auto* n = nodes_.back();
+    nodes_.pop_back();
+    return static_cast<T*>(n);
+  }
+
+  template <typename T>
+  auto popList(compact::List l) -> std::span<T*> {
+    if (l.count == 0) {
+      return {};
+    }
+    auto* data = reinterpret_cast<T**>(arena_.alloc(l.count * sizeof(T*)));
+    auto first = nodes_.size() - l.count;
+    for (size_t i = 0; i < l.count; i++) {
+      data[i] = static_cast<T*>(nodes_[first + i]);
+    }
+    nodes_.resize(first);
+    return {data, l.count};
+  }
+
+  auto op(Token::Kind kind) const -> Token {
+    return Token(tokenKindStringify(kind), kind);
+  }
+
+  void push(compact::NodeRef ref) {
+    stack_.push_back({ref, Step::kEnter});
+  }
+
+  void pushList(compact::List l) {
+    for (auto ref : ast_.list(l)) {
+      push(ref);
+    }
+  }
+
+  // Pushes the children of `ref` in source order.
+  void pushChildren(compact::NodeRef ref);
+  // Creates the node for `ref` from its children, popping them off nodes_.
+  auto create(compact::NodeRef ref) -> AstNode*;
+
+  const CompactAst& ast_;
+  Arena& arena_;
+  InternerRef interner_;
+  std::vector<std::pair<compact::NodeRef, Step>> stack_;
+  std::vector<AstNode*> nodes_;
+};
+
+void CompactAstExpander::pushChildren(compact::NodeRef ref) {
+  using Kind = AstNode::Kind;
+
+  switch (ref.kind()) {
+    case Kind::kInfixExpr: {
+      const auto& e = ast_.getInfixExpr(ref);
+      push(e.lhs);
+      push(e.rhs);
+      break;
+    }
+    case Kind::kPrefixExpr:
+      push(ast_.getPrefixExpr(ref).rhs);
+      break;
+    case Kind::kIfExpr: {
+      const auto& e = ast_.getIfExpr(ref);
+      push(e.cnd);
+      push(e.coseq);
+      if (!e.alt.isNull()) {
+        push(e.alt);
+      }
+      break;
+    }
+    case Kind::kWhileExpr: {
+      const auto& e = ast_.getWhileExpr(ref);
+      push(e.cnd);
+      push(e.coseq);
+      break;
+    }
+    case Kind::kImportExpr:
+      push(ast_.getImportExpr(ref).name);
+      break;
+    case Kind::kFnExpr: {
+      const auto& e = ast_.getFnExpr(ref);
+      pushList(e.params);
+      push(e.body);
+      break;
+    }
+    case Kind::kCallExpr: {
+      const auto& e = ast_.getCallExpr(ref);
+      push(e.callable);
+      pushList(e.args);
+      break;
+    }
+    case Kind::kArrayExpr:
+      pushList(ast_.getArrayExpr(ref).elements);
+      break;
+    case Kind::kAssignExpr: {
+      const auto& e = ast_.getAssignExpr(ref);
+      push(e.lhs);
+      push(e.rhs);
+      break;
+    }
+    case Kind::kIndexExpr: {
+      const auto& e = ast_.getIndexExpr(ref);
+      push(e.lhs);
+      push(e.idx);
+      break;
+    }
+    case Kind::kHashMapExpr: {
+      auto refs = ast_.list(ast_.getHashMapExpr(ref).pairs);
+      for (size_t i = 0; i < refs.size(); i++) {
+        auto isKey = i % 2 == 0 && refs[i].kind() == Kind::kStrExpr;
+        stack_.push_back({refs[i], isKey ? Step::kKey : Step::kEnter});
+      }
+      break;
+    }
+    case Kind::kLetStmt: {
+      const auto& s = ast_.getLetStmt(ref);
+      push(s.identifier);
+      push(s.rhs);
+      break;
+    }
+    case Kind::kRetStmt:
+      push(ast_.getRetStmt(ref).expr);
+      break;
+    case Kind::kBlockStmt:
+      pushList(ast_.getBlockStmt(ref).body);
+      break;
+    case Kind::kExprStmt:
+      push(ast_.getExprStmt(ref).expr);
+      break;
+    default:
+      break;
+  }
+}
+
+auto CompactAstExpander::create(compact::NodeRef ref) -> AstNode* {
+  using Kind = AstNode::Kind;
+
+  switch (ref.kind()) {
+    case Kind::kInfixExpr: {
+      auto* rhs = pop<Expr>();
+      return createNode<InfixExpr>(op(ast_.getInfixExpr(ref).op), pop<Expr>(), rhs);
+    }
+    case Kind::kPrefixExpr:
+      return createNode<PrefixExpr>(op(ast_.getPrefixExpr(ref).op), pop<Expr>());
+    case Kind::kIfExpr: {
+      std::optional<const BlockStmt*> alt;
+      if (!ast_.getIfExpr(ref).alt.isNull()) {
+        alt = pop<BlockStmt>();
+      }
+      auto* coseq = pop<BlockStmt>();
+      return createNode<IfExpr>(pop<Expr>(), coseq, alt);
+    }
+    case Kind::kWhileExpr: {
+      auto* coseq = pop<BlockStmt>();
+      return createNode<WhileExpr>(pop<Expr>(), coseq);
+    }
+    case Kind::kImportExpr:
+      return createNode<ImportExpr>(pop<Expr>());
+    case Kind::kFnExpr: {
+      auto* body = pop<BlockStmt>();
+      return createNode<FnExpr>(popList<Expr>(ast_.getFnExpr(ref).params), body);
+    }
+    case Kind::kCallExpr: {
+      auto args = popList<Expr>(ast_.getCallExpr(ref).args);
+      return createNode<CallExpr>(pop<Expr>(), args);
+    }
+    case Kind::kArrayExpr:
+      return createNode<ArrayExpr>(popList<Expr>(ast_.getArrayExpr(ref).elements));
+    case Kind::kAssignExpr: {
+      auto* rhs = pop<Expr>();
+      return createNode<AssignExpr>(pop<Expr>(), rhs);
+    }
+    case Kind::kIndexExpr: {
+      auto* idx = pop<Expr>();
+      return createNode<IndexExpr>(pop<Expr>(), idx);
+    }
+    case Kind::kHashMapExpr: {
+      auto n = ast_.getHashMapExpr(ref).pairs.count / 2;
+      if (n == 0) {
+        return createNode<HashMapExpr>(std::span<std::pair<Expr*, Expr*>>());
+      }
+      using Pair = std::pair<Expr*, Expr*>;
+      auto* pairs = reinterpret_cast<Pair*>(arena_.alloc(n * sizeof(Pair)));
+      auto first = nodes_.size() - 2 * n;
+      for (size_t i = 0; i < n; i++) {
+        auto* key = static_cast<Expr*>(nodes_[first + 2 * i]);
+        new (&pairs[i]) Pair(key, static_cast<Expr*>(nodes_[first + 2 * i + 1]));
+      }
+      nodes_.resize(first);
+      return createNode<HashMapExpr>(std::span<Pair>(pairs, n));
+    }
+    case Kind::kIdentifierExpr: {
+      auto text = ast_.text(ast_.getIdentifierExpr(ref).identifier);
+      return createNode<IdentifierExpr>(text, interner_.symbol(text));
+    }
+    case Kind::kNullExpr:
+      return createNode<NullExpr>();
+    case Kind::kBoolExpr:
+      return createNode<BoolExpr>(ast_.boolValue(ref));
+    case Kind::kIntegerExpr:
+      return createNode<IntegerExpr>(ast_.getIntegerExpr(ref).value);
+    case Kind::kFloatExpr:
+      return createNode<FloatExpr>(ast_.getFloatExpr(ref).value);
+    case Kind::kStrExpr:
+      return createNode<StrExpr>(ast_.text(ast_.getStrExpr(ref).value));
+    case Kind::kLetStmt: {
+      auto* rhs = pop<Expr>();
+      return createNode<LetStmt>(pop<IdentifierExpr>(), rhs);
+    }
+    case Kind::kRetStmt:
+      return createNode<RetStmt>(pop<Expr>());
+    case Kind::kBlockStmt:
+      return createNode<BlockStmt>(popList<Stmt>(ast_.getBlockStmt(ref).body));
+    case Kind::kExprStmt:
+      return createNode<ExprStmt>(pop<Expr>());
+    case Kind::kExpr:
+    case Kind::kStmt:
+      break;
+  }
+
+  return nullptr;
+}
+
+}  // namespace
+
+auto CompactAst::expand(Arena& arena, InternerRef interner) const -> std::vector<AstNode*> {
+  return CompactAstExpander(*this, arena, interner).expandRoots();
+}
+
+CompactAst::CompactAst(std::string_view source) : source_{source} {}
+
+CompactAst::CompactAst(CompactAst&& other) noexcept = default;
+
+CompactAst::~CompactAst() = default;
+
+auto CompactAst::nodeCount() const -> size_t {
+  size_t count = 0;
+#define GEN_COUNT(Name) count += Name##s_.size();
+  COMPACT_AST_TABLE_LIST(GEN_COUNT)
+#undef GEN_COUNT
+  return count;
+}
+
+auto CompactAst::bytes() const -> size_t {
+  auto total = refs_.size() * sizeof(compact::NodeRef);
+#define GEN_BYTES(Name) total += Name##s_.size() * sizeof(compact::Name);
+  COMPACT_AST_TABLE_LIST(GEN_BYTES)
+#undef GEN_BYTES
+  return total;
+}
+
+// .tmast layout: the header, then the ref list and every node table, each 8-byte aligned. Table
+// offsets are relative to the start of the file. The element size of each table is recorded so a
+// file written by a build with a different node layout is rejected rather than misread.
+namespace {
+
+enum CacheTableIndex : uint32_t {
+  kCacheRefs,
+#define GEN_CACHE_TABLE_INDEX(Name) kCache##Name,
+  COMPACT_AST_TABLE_LIST(GEN_CACHE_TABLE_INDEX)
+#undef GEN_CACHE_TABLE_INDEX
+  kCacheTables,
+};
+
+// "TMAST", a format version and the byte order mark.
+constexpr uint64_t kCacheMagic = 0x01'0001'5453414d54ull;
+
+struct CacheTable {
+  uint64_t offset;
+  uint32_t count;
+  uint32_t elementSize;
+};
+
+constexpr auto alignUp(size_t n) -> size_t {
+  return (n + 7) & ~size_t{7};
+}
+
+}  // namespace
+
+struct CompactAst::CacheHeader {
+  uint64_t magic;
+  uint64_t sourceHash;
+  uint64_t sourceSize;
+  compact::List roots;
+  CacheTable tables[kCacheTables];
+};
+
+namespace {
+
+// What a NodeRef field may point to.
+enum class RefSlot {
+  kExpr,
+  kStmt,
+  kBlock,
+  // A BlockStmt or null.
+  kOptionalBlock,
+  kIdentifier,
+};
+
+}  // namespace
+
+// Checks what the builder guarantees and a cache file might not: refs fit their slot and their
+// kind's table, lists fit the ref list, strings fit the source and operators are tokens. No node
+// may be referenced twice, the roots included, so what expand() reaches from the roots is a tree.
+auto CompactAst::validate() const -> bool {
+  using Kind = AstNode::Kind;
+  constexpr auto kKinds = static_cast<size_t>(Kind::kExprStmt) + 1;
+
+  std::array<size_t, kKinds> sizes = {};
+#define GEN_TABLE_SIZE(Name) sizes[static_cast<size_t>(Kind::k##Name)] = Name##s_.size();
+  COMPACT_AST_TABLE_LIST(GEN_TABLE_SIZE)
+#undef GEN_TABLE_SIZE
+  std::array<std::vector<bool>, kKinds> referenced;
+  for (size_t k = 0; k < kKinds; k++) {
+    referenced[k].resize(sizes[k]);
+  }
+
+  auto ref = [&](compact::NodeRef r, RefSlot slot) {
+    if (r.isNull()) {
+      return slot == RefSlot::kOptionalBlock;
+    }
+    auto kind = r.kind();
+    switch (slot) {
+      case RefSlot::kExpr:
+        if (kind <= Kind::kExpr || kind >= Kind::kStmt) {
+          return false;
+        }
+        break;
+      case RefSlot::kStmt:
+        if (kind <= Kind::kStmt || static_cast<size_t>(kind) >= kKinds) {
+          return false;
+        }
+        break;
+      case RefSlot::kBlock:
+      case RefSlot::kOptionalBlock:
+        if (kind != Kind::kBlockStmt) {
+          return false;
+        }
+        break;
+      case RefSlot::kIdentifier:
+        if (kind != Kind::kIdentifierExpr) {
+          return false;
+        }
+        break;
+    }
+    if (kind == Kind::kNullExpr || kind == Kind::kBoolExpr) {
+      return r.index() <= (kind == Kind::kBoolExpr ? 1u : 0u);
+    }
+    auto k = static_cast<size_t>(kind);
+    if (r.index() >= sizes[k] || referenced[k][r.index()]) {
+      return false;
+    }
+    referenced[k][r.index()] = true;
+    return true;
+  };
+  auto refList = [&](compact::List l, RefSlot slot) {
+    if (l.start > refs_.size() || l.count > refs_.size() - l.start) {
+      return false;
+    }
+    return std::ranges::all_of(list(l), [&](compact::NodeRef r) { return ref(r, slot); });
+  };
+  auto str = [&](compact::Str s) {
+    return s.offset <= source_.size() && s.length <= source_.size() - s.offset;
+  };
+  auto op = [](Token::Kind kind) {
+    return kind <= Token::kEof;
+  };
+  auto all = [](const auto& table, auto valid) {
+    return std::ranges::all_of(table, valid);
+  };
+
+  using Slot = RefSlot;
+  return refList(roots_, Slot::kStmt) &&
+         all(InfixExprs_,
+             [&](auto& e) {
+               return op(e.op) && ref(e.lhs, Slot::kExpr) && ref(e.rhs, Slot::kExpr);
+             }) &&
+         all(PrefixExprs_, [&](auto& e) { return op(e.op) && ref(e.rhs, Slot::kExpr); }) &&
+         all(IfExprs_,
+             [&](auto& e) {
+               return ref(e.cnd, Slot::kExpr) && ref(e.coseq, Slot::kBlock) &&
+                      ref(e.alt, Slot::kOptionalBlock);
+             }) &&
+         all(WhileExprs_,
+             [&](auto& e) { return ref(e.cnd, Slot::kExpr) && ref(e.coseq, Slot::kBlock); }) &&
+         all(ImportExprs_, [&](auto& e) { return ref(e.name, Slot::kExpr); }) &&
+         all(FnExprs_,
+             [&](auto& e) {
+               return refList(e.params, Slot::kExpr) && ref(e.body, Slot::kBlock);
+             }) &&
+         all(CallExprs_,
+             [&](auto& e) {
+               return ref(e.callable, Slot::kExpr) && refList(e.args, Slot::kExpr);
+             }) &&
+         all(ArrayExprs_, [&](auto& e) { return refList(e.elements, Slot::kExpr); }) &&
+         all(AssignExprs_,
+             [&](auto& e) { return ref(e.lhs, Slot::kExpr) && ref(e.rhs, Slot::kExpr); }) &&
+         all(IndexExprs_,
+             [&](auto& e) { return ref(e.lhs, Slot::kExpr) && ref(e.idx, Slot::kExpr); }) &&
+         all(HashMapExprs_,
+             [&](auto& e) { return e.pairs.count % 2 == 0 && refList(e.pairs, Slot::kExpr); }) &&
+         all(IdentifierExprs_, [&](auto& e) { return str(e.identifier); }) &&
+         all(StrExprs_, [&](auto& e) { return str(e.value); }) &&
+         all(LetStmts_,
+             [&](auto& s) {
+               return ref(s.identifier, Slot::kIdentifier) && ref(s.rhs, Slot::kExpr);
+             }) &&
+         all(RetStmts_, [&](auto& s) { return ref(s.expr, Slot::kExpr); }) &&
+         all(BlockStmts_, [&](auto& s) { return refList(s.body, Slot::kStmt); }) &&
+         all(ExprStmts_, [&](auto& s) { return ref(s.expr, Slot::kExpr); });
+}
+
+auto CompactAst::write(const char* path) const -> bool {
+  CacheHeader header = {kCacheMagic, hashBytes(source_), source_.size(), roots_, {}};
+
+  std::vector<std::span<const std::byte>> tables;
+  auto offset = alignUp(sizeof(CacheHeader));
+  auto addTable = [&]<typename T>(std::span<const T> table) {
+    header.tables[tables.size()] = {
+      offset, static_cast<uint32_t>(table.size()), static_cast<uint32_t>(sizeof(T))};
+    tables.push_back(std::as_bytes(table));
+    offset = alignUp(offset + table.size_bytes());
+  };
+  addTable(refs_);
+#define GEN_ADD_TABLE(Name) addTable(Name##s_);
+  COMPACT_AST_TABLE_LIST(GEN_ADD_TABLE)
+#undef GEN_ADD_TABLE
+
+  // Symbol ids belong to the interner of this process, so they aren't cached.
+  std::vector identifiers(IdentifierExprs_.begin(), IdentifierExprs_.end());
+  for (auto& e : identifiers) {
+    e.symbol = Symbol::kNone;
+  }
+  tables[kCacheIdentifierExpr] = std::as_bytes(std::span(identifiers));
+
+  auto tmp = std::format("{}.{}.tmp", path, getpid());
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  std::string buf(sizeof(CacheHeader), '\0');
+  std::memcpy(buf.data(), &header, sizeof(header));
+  for (auto& t : tables) {
+    buf.resize(alignUp(buf.size()), '\0');
+    buf.append(reinterpret_cast<const char*>(t.data()), t.size());
+  }
+
+  auto ok = true;
+  for (size_t done = 0; ok && done < buf.size();) {
+    auto n = ::write(fd, buf.data() + done, buf.size() - done);
+    ok = n > 0;
+    done += ok ? static_cast<size_t>(n) : 0;
+  }
+  auto err = errno;
+  ok = ::close(fd) == 0 && ok;
+  if (ok && ::rename(tmp.c_str(), path) == 0) {
+    return true;
+  }
+  err = ok ? errno : err;
+  ::unlink(tmp.c_str());
+  errno = err;
+  return false;
+}
+
+auto CompactAst::load(const char* path, std::string_view source) -> std::optional<CompactAst> {
+  auto file = MappedFile::open(path);
+  if (!file) {
+    return {};
+  }
+
+  auto data = file->text();
+  if (data.size() < sizeof(CacheHeader)) {
+    return {};
+  }
+  CacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != kCacheMagic || header.sourceSize != source.size() ||
+      header.sourceHash != hashBytes(source)) {
+    return {};
+  }
+
+  CompactAst ast(source);
+  size_t next = 0;
+  auto view = [&]<typename T>(std::span<const T>& table) {
+    const auto& t = header.tables[next++];
+    if (t.elementSize != sizeof(T) || t.offset % alignof(T) != 0 || t.offset > data.size() ||
+        (data.size() - t.offset) / sizeof(T) < t.count) {
+      return false;
+    }
+    table = {reinterpret_cast<const T*>(data.data() + t.offset), t.count};
+    return true;
+  };
+  auto valid = view(ast.refs_);
+#define GEN_VIEW_TABLE(Name) valid = valid && view(ast.Name##s_);
+  COMPACT_AST_TABLE_LIST(GEN_VIEW_TABLE)
+#undef GEN_VIEW_TABLE
+  ast.roots_ = header.roots;
+  if (!valid || !ast.validate()) {
+    return {};
+  }
+
+  ast.mapping_.emplace(std::move(*file));
+  return ast;
+}
+
+}  // namespace tmonkey
\ No newline at end of file
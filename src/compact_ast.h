@@ -0,0 +1,254 @@
+#pragma once
+
+#include <span>
+#include "ast.h"
+#include "common.h"
+#include "source.h"
+
+namespace tmonkey {
+
+// Compact AST representation: every node kind lives in its own typed array and nodes reference
+// each other through 32-bit NodeRefs. Operators are stored as a 1-byte Token::Kind and strings as
+// an offset/length pair into the source, so most nodes take 8 or 12 bytes.
+namespace compact {
+
+// The high 5 bits hold the AstNode::Kind, the low 27 bits the index into that kind's array.
+// NullExpr and BoolExpr have no array: null uses index 0 and a bool stores its value as the index.
+class NodeRef {
+  static constexpr uint32_t kIndexBits = 27;
+  static constexpr uint32_t kIndexMask = (1u << kIndexBits) - 1;
+
+public:
+  static constexpr uint32_t kMaxIndex = kIndexMask;
+
+  constexpr NodeRef() = default;
+  constexpr NodeRef(AstNode::Kind kind, uint32_t index)
+      : bits_{(static_cast<uint32_t>(kind) << kIndexBits) | index} {}
+
+  auto kind() const -> AstNode::Kind {
+    return static_cast<AstNode::Kind>(bits_ >> kIndexBits);
+  }
+
+  auto index() const -> uint32_t {
+    return bits_ & kIndexMask;
+  }
+
+  auto isNull() const -> bool {
+    return bits_ == kNullBits;
+  }
+
+  auto operator==(const NodeRef&) const -> bool = default;
+
+private:
+  static constexpr uint32_t kNullBits = ~0u;
+
+  uint32_t bits_ = kNullBits;
+};
+
+// A run of NodeRefs in the ref list, see CompactAst::list().
+struct List {
+  uint32_t start;
+  uint32_t count;
+};
+
+// A byte range of the source text.
+struct Str {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct InfixExpr {
+  Token::Kind op;
+  NodeRef lhs;
+  NodeRef rhs;
+};
+
+struct PrefixExpr {
+  Token::Kind op;
+  NodeRef rhs;
+};
+
+struct IfExpr {
+  NodeRef cnd;
+  NodeRef coseq;
+  // Null when there is no else branch.
+  NodeRef alt;
+};
+
+struct WhileExpr {
+  NodeRef cnd;
+  NodeRef coseq;
+};
+
+struct ImportExpr {
+  NodeRef name;
+};
+
+struct FnExpr {
+  List params;
+  NodeRef body;
+};
+
+struct CallExpr {
+  NodeRef callable;
+  List args;
+};
+
+struct ArrayExpr {
+  List elements;
+};
+
+struct AssignExpr {
+  NodeRef lhs;
+  NodeRef rhs;
+};
+
+struct IndexExpr {
+  NodeRef lhs;
+  NodeRef idx;
+};
+
+// Keys and values are interleaved: key0, val0, key1, val1, ...
+struct HashMapExpr {
+  List pairs;
+};
+
+struct IdentifierExpr {
+  Str identifier;
+  // Symbol::kNone when the tree was parsed without an interner.
+  uint32_t symbol;
+};
+
+struct IntegerExpr {
+  int64_t value;
+};
+
+struct FloatExpr {
+  double value;
+};
+
+struct StrExpr {
+  Str value;
+};
+
+struct LetStmt {
+  NodeRef identifier;
+  NodeRef rhs;
+};
+
+struct RetStmt {
+  NodeRef expr;
+};
+
+struct BlockStmt {
+  List body;
+};
+
+struct ExprStmt {
+  NodeRef expr;
+};
+
+}  // namespace compact
+
+#define COMPACT_AST_TABLE_LIST(V) \
+  V(InfixExpr)                    \
+  V(PrefixExpr)                   \
+  V(IfExpr)                       \
+  V(WhileExpr)                    \
+  V(ImportExpr)                   \
+  V(FnExpr)                       \
+  V(CallExpr)                     \
+  V(ArrayExpr)                    \
+  V(AssignExpr)                   \
+  V(IndexExpr)                    \
+  V(HashMapExpr)                  \
+  V(IdentifierExpr)               \
+  V(IntegerExpr)                  \
+  V(FloatExpr)                    \
+  V(StrExpr)                      \
+  V(LetStmt)                      \
+  V(RetStmt)                      \
+  V(BlockStmt)                    \
+  V(ExprStmt)
+
+// The tables are views, backed either by the vectors the builder filled or by a mapped .tmast
+// file. Nothing in them is a pointer, so a cache file is mapped rather than read; load() still
+// checks every node once, and expand() rebuilds the pointer tree, both in O(nodes).
+class CompactAst {
+public:
+  // Lowers a parsed tree. All string views in the tree must point into `source`.
+  static auto build(const std::vector<AstNode*>& tree, std::string_view source) -> CompactAst;
+
+  // Maps a .tmast file written for `source`. Returns nullopt when the file is missing or malformed,
+  // or when it was written for different text. Every ref, list and string range is checked, and
+  // the nodes must form a tree, so a corrupt file is rejected rather than crashing expand().
+  static auto load(const char* path, std::string_view source) -> std::optional<CompactAst>;
+
+  NO_COPYABLE(CompactAst)
+
+  CompactAst(CompactAst&& other) noexcept;
+  ~CompactAst();
+
+  // Writes the .tmast file through a temporary, so readers never map a partial file. Returns
+  // false and leaves errno set on failure.
+  auto write(const char* path) const -> bool;
+
+  // Rebuilds the pointer tree in `arena`, as parse() returned it for the source; with an interner,
+  // identifiers and string hash-map keys are interned again. The tree points into the source, not
+  // into the tables, so it outlives this CompactAst.
+  auto expand(Arena& arena, InternerRef interner = {}) const -> std::vector<AstNode*>;
+
+  auto source() const -> std::string_view {
+    return source_;
+  }
+
+  auto roots() const -> std::span<const compact::NodeRef> {
+    return list(roots_);
+  }
+
+  auto list(compact::List l) const -> std::span<const compact::NodeRef> {
+    return refs_.subspan(l.start, l.count);
+  }
+
+  auto text(compact::Str s) const -> std::string_view {
+    return source_.substr(s.offset, s.length);
+  }
+
+  auto boolValue(compact::NodeRef ref) const -> bool {
+    return ref.index() != 0;
+  }
+
+#define GEN_COMPACT_ACCESSOR(Name)                                      \
+  auto get##Name(compact::NodeRef ref) const -> const compact::Name& { \
+    return Name##s_[ref.index()];                                       \
+  }
+  COMPACT_AST_TABLE_LIST(GEN_COMPACT_ACCESSOR)
+#undef GEN_COMPACT_ACCESSOR
+
+  auto nodeCount() const -> size_t;
+  // Bytes held by the node arrays and the ref list.
+  auto bytes() const -> size_t;
+
+private:
+  friend class CompactAstBuilder;
+  struct Storage;
+  struct CacheHeader;
+
+  explicit CompactAst(std::string_view source);
+
+  auto validate() const -> bool;
+
+  std::string_view source_;
+  compact::List roots_ = {0, 0};
+  std::span<const compact::NodeRef> refs_;
+
+#define GEN_COMPACT_TABLE(Name) std::span<const compact::Name> Name##s_;
+  COMPACT_AST_TABLE_LIST(GEN_COMPACT_TABLE)
+#undef GEN_COMPACT_TABLE
+
+  // Exactly one of these backs the tables.
+  std::unique_ptr<Storage> storage_;
+  std::optional<MappedFile> mapping_;
+};
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "driver.h"
+#include <cerrno>
+#include <cstring>
+#include "compact_ast.h"
+#include "parser.h"
+#include "thread_pool.h"
+
+namespace tmonkey {
+
+// Files at least this big are split across all workers once the rest of the batch is done.
+constexpr size_t kSplitFileBytes = 8 * 1024 * 1024;
+
+auto parseFiles(const std::vector<std::string>& paths, size_t threads) -> ParsedFiles {
+  ParsedFiles result;
+  result.files_.resize(paths.size());
+
+  ThreadPool pool(threads);
+  // Files whose tree came from a .tmast cache.
+  std::vector<uint8_t> cached(paths.size());
+  auto splitFile = [&](const ParsedFile& parsed, size_t i) {
+    return pool.size() > 1 && parsed.file && !cached[i] &&
+           parsed.file->text().size() >= kSplitFileBytes;
+  };
+  for (size_t i = 0; i < pool.size(); i++) {
+    result.arenas_.push_back(std::make_unique<Arena>());
+  }
+
+  pool.run(paths.size(), [&](size_t worker, size_t i) {
+    auto& parsed = result.files_[i];
+    parsed.path = paths[i];
+    auto file = MappedFile::open(paths[i].c_str());
+    if (!file) {
+      parsed.errors.push_back(std::strerror(errno));
+      return;
+    }
+    parsed.file.emplace(std::move(*file));
+    auto cachePath = std::format("{}.tmast", paths[i]);
+    if (auto ast = CompactAst::load(cachePath.c_str(), parsed.file->text())) {
+      parsed.tree = ast->expand(*result.arenas_[worker], *result.symbols_);
+      cached[i] = 1;
+      return;
+    }
+    if (splitFile(parsed, i)) {
+      return;
+    }
+    parsed.tree =
+        parse(parsed.file->text(), *result.arenas_[worker], &parsed.errors, *result.symbols_);
+  });
+
+  for (size_t i = 0; i < result.files_.size(); i++) {
+    auto& parsed = result.files_[i];
+    if (splitFile(parsed, i)) {
+      parsed.tree = parseParallel(
+          parsed.file->text(), pool, result.arenas_, &parsed.errors, *result.symbols_);
+    }
+  }
+
+  return result;
+}
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ast.h"
+#include "common.h"
+#include "source.h"
+#include "strintern.h"
+
+namespace tmonkey {
+
+struct ParsedFile {
+  std::string path;
+  // Nullopt when the file couldn't be mapped; `errors` then holds the reason.
+  std::optional<MappedFile> file;
+  std::vector<AstNode*> tree;
+  std::vector<std::string> errors;
+};
+
+// Trees of a parseFiles() batch. Each worker allocated its nodes from its own arena, and the
+// identifiers of every file share one symbol table, so the arenas, the mappings and the interner
+// are kept alive together.
+class ParsedFiles {
+public:
+  ParsedFiles() : symbols_{std::make_unique<ConcurrentStringInterningMap>()} {}
+
+  NO_COPYABLE(ParsedFiles)
+
+  ParsedFiles(ParsedFiles&& other) noexcept = default;
+
+  // In the order the paths were given.
+  auto files() const -> const std::vector<ParsedFile>& {
+    return files_;
+  }
+
+  auto symbols() const -> const ConcurrentStringInterningMap& {
+    return *symbols_;
+  }
+
+private:
+  friend auto parseFiles(const std::vector<std::string>& paths, size_t threads) -> ParsedFiles;
+
+  std::vector<ParsedFile> files_;
+  std::vector<std::unique_ptr<Arena>> arenas_;
+  std::unique_ptr<ConcurrentStringInterningMap> symbols_;
+};
+
+// Maps and parses `paths` on `threads` workers. Files of 8 MB and more are each split across all
+// workers with parseParallel() after the rest of the batch. A file with a valid <path>.tmast next
+// to it, see `tmonkey cache`, is expanded from the cache instead of being parsed.
+auto parseFiles(const std::vector<std::string>& paths, size_t threads) -> ParsedFiles;
+
+}  // namespace tmonkey
\ No newline at end of file
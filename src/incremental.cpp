@@ -0,0 +1,179 @@
+#include "incremental.h"
+
+namespace tmonkey {
+
+namespace {
+
+// Nodes of replaced statements stay in the arena until it outgrows the live tree by this much.
+constexpr size_t kArenaSlack = 1024 * 1024;
+
+enum class Reparse {
+  kDone,
+  // The last reparsed statement may continue into the next one.
+  kExtend,
+  kFailed,
+};
+
+}  // namespace
+
+void GapBuffer::replace(size_t offset, size_t removed, std::string_view inserted) {
+  moveGap(offset);
+  gapEnd_ += removed;
+  if (gapEnd_ - gapBegin_ < inserted.size()) {
+    // Grows geometrically, so a run of insertions is amortized.
+    auto tail = buf_.size() - gapEnd_;
+    auto grown = std::max(buf_.size() * 2, size() + inserted.size() + 64);
+    buf_.resize(grown);
+    memmove(buf_.data() + grown - tail, buf_.data() + gapEnd_, tail);
+    gapEnd_ = grown - tail;
+  }
+  memcpy(buf_.data() + gapBegin_, inserted.data(), inserted.size());
+  gapBegin_ += inserted.size();
+}
+
+void GapBuffer::copy(size_t begin, size_t end, char* out) const {
+  if (begin < gapBegin_) {
+    auto n = std::min(end, gapBegin_) - begin;
+    memcpy(out, buf_.data() + begin, n);
+    out += n;
+    begin += n;
+  }
+  if (begin < end) {
+    auto gap = gapEnd_ - gapBegin_;
+    memcpy(out, buf_.data() + begin + gap, end - begin);
+  }
+}
+
+void GapBuffer::moveGap(size_t offset) {
+  if (offset < gapBegin_) {
+    auto n = gapBegin_ - offset;
+    memmove(buf_.data() + gapEnd_ - n, buf_.data() + offset, n);
+    gapBegin_ -= n;
+    gapEnd_ -= n;
+  } else if (offset > gapBegin_) {
+    auto n = offset - gapBegin_;
+    memmove(buf_.data() + gapBegin_, buf_.data() + gapEnd_, n);
+    gapBegin_ += n;
+    gapEnd_ += n;
+  }
+}
+
+IncrementalParser::IncrementalParser(std::string source, InternerRef interner)
+    : interner_{interner}, text_{std::move(source)} {
+  parseAll();
+}
+
+void IncrementalParser::edit(size_t offset, size_t removed, std::string_view inserted) {
+  auto size = text_.size();
+  offset = std::min(offset, size);
+  removed = std::min(removed, size - offset);
+  text_.replace(offset, removed, inserted);
+  auto delta = static_cast<int64_t>(inserted.size()) - static_cast<int64_t>(removed);
+
+  // After an error the statement ranges don't describe the text well enough to patch them. A full
+  // parse also drops the nodes of statements replaced by earlier edits.
+  auto garbage = arena_->bytesReserved() > 2 * liveBytes_ + kArenaSlack;
+  if (!errors_.empty() || stmts_.empty() || garbage) {
+    parseAll();
+    return;
+  }
+
+  // Every statement touching [offset, offset + removed], widened by one on each side since text
+  // inserted next to a statement can join it with its neighbour.
+  auto first = std::lower_bound(
+      stmts_.begin(), stmts_.end(), offset, [](const Stmt& s, size_t o) { return s.end < o; });
+  auto last = std::upper_bound(
+      stmts_.begin(), stmts_.end(), offset + removed,
+      [](size_t o, const Stmt& s) { return o < s.begin; });
+  auto lo = static_cast<size_t>(first - stmts_.begin());
+  auto hi = static_cast<size_t>(last - stmts_.begin());
+  lo = lo > 0 ? lo - 1 : 0;
+  hi = std::min(hi, stmts_.size() - 1);
+  hi = std::max(hi, lo);
+  // The statement kept before the region must have ended on a ';', or it could absorb the
+  // reparsed text.
+  while (lo > 0 && !stmts_[lo - 1].terminated) {
+    lo--;
+  }
+
+  for (;;) {
+    auto mark = arena_->mark();
+    size = text_.size();
+    size_t begin = lo == 0 ? 0 : stmts_[lo].begin;
+    size_t end =
+        hi + 1 < stmts_.size() ? static_cast<size_t>(stmts_[hi + 1].begin + delta) : size;
+
+    std::vector<std::string> errors;
+    auto ranges = parseStatements(copyText(begin, end), *arena_, &errors, interner_);
+
+    auto result = Reparse::kDone;
+    if (!errors.empty()) {
+      result = Reparse::kFailed;
+    } else if (end != size && !ranges.empty() && !ranges.back().terminated) {
+      result = Reparse::kExtend;
+    }
+
+    if (result != Reparse::kDone) {
+      arena_->rewind(mark);
+      if (result == Reparse::kFailed || hi + 1 == stmts_.size()) {
+        parseAll();
+        return;
+      }
+      hi++;
+      continue;
+    }
+
+    std::vector<Stmt> replaced;
+    replaced.reserve(ranges.size());
+    for (auto& r : ranges) {
+      replaced.push_back({
+        r.stmt,
+        static_cast<uint32_t>(r.begin + begin),
+        static_cast<uint32_t>(r.end + begin),
+        r.terminated,
+      });
+    }
+    for (auto i = hi + 1; i < stmts_.size(); i++) {
+      stmts_[i].begin = static_cast<uint32_t>(stmts_[i].begin + delta);
+      stmts_[i].end = static_cast<uint32_t>(stmts_[i].end + delta);
+    }
+    auto at = stmts_.begin() + static_cast<ptrdiff_t>(lo);
+    at = stmts_.erase(at, at + static_cast<ptrdiff_t>(hi + 1 - lo));
+    stmts_.insert(at, replaced.begin(), replaced.end());
+    reparsed_ = ranges.size();
+    rebuildTree();
+    return;
+  }
+}
+
+void IncrementalParser::parseAll() {
+  arena_ = std::make_unique<Arena>();
+  auto ranges = parseStatements(copyText(0, text_.size()), *arena_, &errors_, interner_);
+  stmts_.clear();
+  for (auto& r : ranges) {
+    stmts_.push_back({r.stmt, r.begin, r.end, r.terminated});
+  }
+  liveBytes_ = arena_->bytesReserved();
+  reparsed_ = stmts_.size();
+  rebuildTree();
+}
+
+auto IncrementalParser::copyText(size_t begin, size_t end) -> std::string_view {
+  if (begin == end) {
+    return {};
+  }
+  auto* text = arena_->alloc(end - begin);
+  text_.copy(begin, end, text);
+  return {text, end - begin};
+}
+
+void IncrementalParser::rebuildTree() {
+  tree_.clear();
+  for (auto& s : stmts_) {
+    if (s.node) {
+      tree_.push_back(s.node);
+    }
+  }
+}
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "ast.h"
+#include "common.h"
+#include "parser.h"
+#include "strintern.h"
+
+namespace tmonkey {
+
+// Text with a gap at the last edit. An edit moves only the bytes between it and the previous one,
+// so typing in one place costs the size of the keystroke.
+class GapBuffer {
+public:
+  explicit GapBuffer(std::string text) : buf_{std::move(text)}, gapBegin_{buf_.size()} {
+    gapEnd_ = gapBegin_;
+  }
+
+  void replace(size_t offset, size_t removed, std::string_view inserted);
+
+  auto size() const -> size_t {
+    return buf_.size() - (gapEnd_ - gapBegin_);
+  }
+
+  // Copies the bytes in [begin, end) to `out`.
+  void copy(size_t begin, size_t end, char* out) const;
+
+  // The whole text. Closes the gap first, which moves the bytes after the last edit.
+  auto view() -> std::string_view {
+    moveGap(size());
+    return std::string_view(buf_).substr(0, gapBegin_);
+  }
+
+private:
+  void moveGap(size_t offset);
+
+  std::string buf_;
+  size_t gapBegin_;
+  size_t gapEnd_;
+};
+
+// Keeps the tree of an edited buffer up to date. An edit re-lexes and reparses only the top-level
+// statements it touches, plus their neighbours, and every other statement node is shared with the
+// previous tree. A reparse copies just its text into the arena, where the nodes parsed from it can
+// point; the next full parse starts a new arena and drops those copies with the replaced nodes.
+class IncrementalParser {
+public:
+  explicit IncrementalParser(std::string source, InternerRef interner = {});
+
+  NO_COPYABLE(IncrementalParser)
+
+  // Replaces `removed` bytes at `offset` with `inserted`.
+  void edit(size_t offset, size_t removed, std::string_view inserted);
+
+  // Valid until the next edit.
+  auto source() -> std::string_view {
+    return text_.view();
+  }
+
+  // Equal to what parse() returns for source().
+  auto tree() const -> const std::vector<AstNode*>& {
+    return tree_;
+  }
+
+  auto errors() const -> const std::vector<std::string>& {
+    return errors_;
+  }
+
+  // Statements parsed by the last edit or full parse.
+  auto reparsed() const -> size_t {
+    return reparsed_;
+  }
+
+private:
+  struct Stmt {
+    AstNode* node;
+    uint32_t begin;
+    uint32_t end;
+    bool terminated;
+  };
+
+  void parseAll();
+  // Copies [begin, end) of the text into the arena.
+  auto copyText(size_t begin, size_t end) -> std::string_view;
+  void rebuildTree();
+
+  InternerRef interner_;
+  GapBuffer text_;
+  std::unique_ptr<Arena> arena_;
+  // Arena size right after the last full parse; replaced nodes are only reclaimed by the next one.
+  size_t liveBytes_ = 0;
+  std::vector<Stmt> stmts_;
+  std::vector<AstNode*> tree_;
+  std::vector<std::string> errors_;
+  size_t reparsed_ = 0;
+};
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -1,128 +1,173 @@
 #include "lexer.h"
+#include "charclass.h"
+#include "scan.h"
 
 namespace tmonkey {
 
-auto isAlpha(char c) -> bool {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
-}
-
-auto isAlphaNumeric(char c) -> bool {
-  return (c >= '0' && c <= '9') || isAlpha(c);
-}
-
 auto Lexer::next() -> Token {
-  for (;;) {
-    start_ = curr_;
-    auto c = advance();
+  // Tokens often follow each other directly, so check one byte before calling into the kernel.
+  if (isSpace(peek())) {
+    skip(scanWhitespace);
+  }
+  start_ = curr_;
+  auto c = advance();
 
-    switch (c) {
-      case '\n':
-      case '\t':
-      case '\r':
-      case ' ':
-        continue;
-      case '+':
-        return makeToken(Token::kPlus);
-      case '-':
-        return makeToken(Token::kMinus);
-      case '*':
-        return makeToken(Token::kStar);
-      case '/':
-        return makeToken(Token::kSlash);
-      case '=':
-        return match('=') ? makeToken(Token::kEqEq) : makeToken(Token::kEq);
-      case '!':
-        return match('=') ? makeToken(Token::kNotEq) : makeToken(Token::kBang);
-      case '<':
-        return match('=') ? makeToken(Token::kLtEq) : makeToken(Token::kLt);
-      case '>':
-        return match('=') ? makeToken(Token::kGtEq) : makeToken(Token::kGt);
-      case '{':
-        return makeToken(Token::kLBrace);
-      case '}':
-        return makeToken(Token::kRBrace);
-      case '(':
-        return makeToken(Token::kLParen);
-      case ')':
-        return makeToken(Token::kRParen);
-      case '[':
-        return makeToken(Token::kLBracket);
-      case ']':
-        return makeToken(Token::kRBracket);
-      case ':':
-        return makeToken(Token::kColon);
-      case ';':
-        return makeToken(Token::kSemicolon);
-      case ',':
-        return makeToken(Token::kComma);
-      case '.':
-        return makeToken(Token::kDot);
-      case '"': {
-        while (peek() != '"') {
-          char c = advance();
-          if (c == '\0') {
-            break;
-          }
-        }
-        auto offset = 1;
-        if (peek() == '"') {
-          advance();
-          offset = 2;
-        }
-        auto substr = text_.substr(start_ + 1, curr_ - start_ - offset);
-        return Token(substr, Token::kString);
+  switch (c) {
+    case '+':
+      return makeToken(Token::kPlus);
+    case '-':
+      return makeToken(Token::kMinus);
+    case '*':
+      return makeToken(Token::kStar);
+    case '/':
+      return makeToken(Token::kSlash);
+    case '=':
+      return match('=') ? makeToken(Token::kEqEq) : makeToken(Token::kEq);
+    case '!':
+      return match('=') ? makeToken(Token::kNotEq) : makeToken(Token::kBang);
+    case '<':
+      return match('=') ? makeToken(Token::kLtEq) : makeToken(Token::kLt);
+    case '>':
+      return match('=') ? makeToken(Token::kGtEq) : makeToken(Token::kGt);
+    case '{':
+      return makeToken(Token::kLBrace);
+    case '}':
+      return makeToken(Token::kRBrace);
+    case '(':
+      return makeToken(Token::kLParen);
+    case ')':
+      return makeToken(Token::kRParen);
+    case '[':
+      return makeToken(Token::kLBracket);
+    case ']':
+      return makeToken(Token::kRBracket);
+    case ':':
+      return makeToken(Token::kColon);
+    case ';':
+      return makeToken(Token::kSemicolon);
+    case ',':
+      return makeToken(Token::kComma);
+    case '.':
+      return makeToken(Token::kDot);
+    case '"': {
+      skip(scanStringBody);
+      size_t offset = 1;
+      if (peek() == '"') {
+        advance();
+        offset = 2;
       }
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9': {
-        auto seeDot = false;
-        for (;;) {
-          auto c = peek();
-          if (c >= '0' && c <= '9') {
-            curr_++;
-            continue;
-          }
-          if (c == '.') {
-            if (seeDot) {
-              break;
-            }
-            seeDot = true;
-            curr_++;
-            continue;
-          }
-          break;
-        }
-        auto substr = text_.substr(start_, curr_ - start_);
-        if (seeDot) {
-          return Token(substr, Token::kFloat);
-        } else {
-          return Token(substr, Token::kInteger);
-        }
+      auto substr = text_.substr(start_ + 1, curr_ - start_ - offset);
+      return Token(substr, Token::kString);
+    }
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9': {
+      skip(scanDigits);
+      if (match('.')) {
+        skip(scanDigits);
+        return makeToken(Token::kFloat);
       }
-      default: {
-        if (!(isAlpha(c) || c == '_')) {
-          return Token("", Token::kEof);
-        }
-        while (isAlphaNumeric(peek()) || peek() == '_') {
-          advance();
-        }
-        auto substr = text_.substr(start_, curr_ - start_);
-        if (auto it = keywords_.find(substr); it != keywords_.end()) {
-          return Token(substr, it->second);
-        }
-        return Token(substr, Token::kIdentifier);
+      return makeToken(Token::kInteger);
+    }
+    default: {
+      if (!isIdentStart(c)) {
+        curr_ = start_;
+        return Token("", Token::kEof);
       }
+      skip(scanIdentifier);
+      auto substr = text_.substr(start_, curr_ - start_);
+      return Token(substr, keywordKind(substr));
     }
   }
 
   return Token("", Token::kEof);
 }
 
+auto Lexer::tokenizeAll() -> TokenBuffer {
+  TokenBuffer buf(text_);
+  // Roughly one token per four bytes of typical source.
+  buf.reserve(text_.size() / 4 + 1);
+
+  while (pushNext(buf) != Token::kEof) {
+  }
+
+  return buf;
+}
+
+auto Lexer::pushNext(TokenBuffer& buf) -> Token::Kind {
+  // TokenBuffer rejected sources whose offsets don't fit 32 bits.
+  auto tok = next();
+  if (tok.kind() == Token::kEof) {
+    buf.push(Token::kEof, static_cast<uint32_t>(text_.size()), 0);
+  } else {
+    auto start = static_cast<uint32_t>(tok.text().data() - text_.data());
+    buf.push(tok.kind(), start, static_cast<uint32_t>(tok.text().size()));
+  }
+  return tok.kind();
+}
+
+void StreamLexer::feed(std::string_view chunk) {
+  if (pos_ >= buf_.size() / 2) {
+    buf_.erase(0, pos_);
+    scanned_ -= pos_;
+    pos_ = 0;
+  }
+  buf_.append(chunk);
+}
+
+auto StreamLexer::next() -> std::optional<Token> {
+  const auto* data = buf_.data();
+  if (scanned_ == pos_) {
+    // Whitespace before a token is dropped as soon as it is seen.
+    pos_ = static_cast<size_t>(scanWhitespace(data + pos_, data + buf_.size()) - data);
+    scanned_ = pos_;
+  }
+  if (!finished_ && !tokenComplete()) {
+    return {};
+  }
+
+  Lexer lex(std::string_view(buf_).substr(pos_));
+  auto tok = lex.next();
+  pos_ += lex.offset();
+  scanned_ = pos_;
+  fraction_ = false;
+  return tok;
+}
+
+auto StreamLexer::tokenComplete() -> bool {
+  const auto* end = buf_.data() + buf_.size();
+  const auto* begin = buf_.data() + pos_;
+  if (begin == end) {
+    return false;
+  }
+
+  const auto* p = buf_.data() + std::max(scanned_, pos_ + 1);
+  auto c = *begin;
+  if (c == '"') {
+    p = scanStringBody(p, end);
+  } else if (isDigit(c)) {
+    p = scanDigits(p, end);
+    if (p != end && *p == '.' && !fraction_) {
+      fraction_ = true;
+      p = scanDigits(p + 1, end);
+    }
+  } else if (isIdentStart(c)) {
+    p = scanIdentifier(p, end);
+  } else {
+    // The longest operator is two bytes.
+    p = std::min(begin + 2, end);
+    scanned_ = static_cast<size_t>(p - buf_.data());
+    return p - begin == 2;
+  }
+  scanned_ = static_cast<size_t>(p - buf_.data());
+  return p != end;
+}
+
 }  // namespace tmonkey
\ No newline at end of file
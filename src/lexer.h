@@ -1,11 +1,59 @@
 #pragma once
 
-#include <unordered_map>
 #include "common.h"
 #include "token.h"
 
 namespace tmonkey {
 
+// Maps an identifier to its keyword kind, or kIdentifier. Dispatches on length and first byte so
+// every candidate is compared against at most two keywords.
+constexpr auto keywordKind(std::string_view s) -> Token::Kind {
+  switch (s.size()) {
+    case 2:
+      if (s == "fn") {
+        return Token::kFn;
+      }
+      if (s == "if") {
+        return Token::kIf;
+      }
+      break;
+    case 3:
+      if (s == "let") {
+        return Token::kLet;
+      }
+      break;
+    case 4:
+      switch (s[0]) {
+        case 'e':
+          return s == "else" ? Token::kElse : Token::kIdentifier;
+        case 'n':
+          return s == "null" ? Token::kNull : Token::kIdentifier;
+        case 'p':
+          return s == "puts" ? Token::kPuts : Token::kIdentifier;
+        case 't':
+          return s == "true" ? Token::kTrue : Token::kIdentifier;
+      }
+      break;
+    case 5:
+      if (s == "while") {
+        return Token::kWhile;
+      }
+      if (s == "false") {
+        return Token::kFalse;
+      }
+      break;
+    case 6:
+      if (s == "return") {
+        return Token::kReturn;
+      }
+      if (s == "import") {
+        return Token::kImport;
+      }
+      break;
+  }
+  return Token::kIdentifier;
+}
+
 class Lexer {
 public:
   Lexer(std::string_view text) : text_{text} {}
@@ -15,11 +63,24 @@ public:
 
   auto next() -> Token;
 
-private:
+  // Lexes the remaining input in one pass. The buffer always ends with a kEof token.
+  auto tokenizeAll() -> TokenBuffer;
+
+  // Lexes one token into `buf`, which must cover the same text, and returns its kind.
+  auto pushNext(TokenBuffer& buf) -> Token::Kind;
+
+  // Offset just past the last token returned by next().
+  auto offset() const -> size_t {
+    return curr_;
+  }
+
+  // Whether the text is used up. next() also returns kEof at a byte that starts no token, and
+  // stays there.
   auto isAtEnd() const -> bool {
     return curr_ == text_.size();
   }
 
+private:
   auto peek() -> char {
     if (isAtEnd()) {
       return '\0';
@@ -38,6 +99,12 @@ private:
     return Token(text_.substr(start_, curr_ - start_), kind);
   }
 
+  template <typename Scan>
+  void skip(Scan scan) {
+    const auto* end = text_.data() + text_.size();
+    curr_ = static_cast<size_t>(scan(text_.data() + curr_, end) - text_.data());
+  }
+
   auto match(char c) -> bool {
     if (peek() == c) {
       advance();
@@ -46,16 +113,47 @@ private:
     return false;
   }
 
-  int start_ = -1;
-  int curr_ = 0;
+  size_t start_ = 0;
+  size_t curr_ = 0;
   std::string_view text_;
+};
+
+// Lexes input that arrives in chunks, e.g. from a pipe. A token cut by a chunk boundary is held
+// back until the next feed() or finish() completes it; the scan of such a token resumes where it
+// stopped, so a token spanning many chunks is still read in linear time. Token text points into
+// an internal buffer and stays valid until the next feed(). Lexed bytes are dropped once they are
+// at least half the buffer, so memory is bounded by about twice the chunk size plus the longest
+// token.
+class StreamLexer {
+public:
+  StreamLexer() = default;
+
+  NO_COPYABLE(StreamLexer)
+  NO_MOVABLE(StreamLexer)
+
+  void feed(std::string_view chunk);
+
+  // Marks the end of input; tokens touching the end are no longer held back.
+  void finish() {
+    finished_ = true;
+  }
+
+  // Returns the next complete token, or nullopt when more input is needed. Once finished, the
+  // input ends with a kEof token.
+  auto next() -> std::optional<Token>;
+
+private:
+  // Whether the token at pos_ ends before the end of the buffer, so that Lexer can read all of
+  // it. Scans on from scanned_ and moves it to where the token is known to extend.
+  auto tokenComplete() -> bool;
 
-  std::unordered_map<std::string_view, Token::Kind> keywords_ = {
-    {"let", Token::kLet},     {"return", Token::kReturn}, {"fn", Token::kFn},
-    {"let", Token::kElse},    {"if", Token::kIf},         {"else", Token::kElse},
-    {"while", Token::kWhile}, {"puts", Token::kPuts},     {"true", Token::kTrue},
-    {"false", Token::kFalse}, {"null", Token::kNull},     {"import", Token::kImport},
-  };
+  std::string buf_;
+  // Start of the next token, and how far its scan got.
+  size_t pos_ = 0;
+  size_t scanned_ = 0;
+  // The number being scanned has passed its '.'.
+  bool fraction_ = false;
+  bool finished_ = false;
 };
 
 }  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <chrono>
+#include "common.h"
+#include "lexer.h"
+#include "scan.h"
+
+namespace tmonkey {
+namespace {
+
+// Synthesizes a machine-generated looking script of roughly `bytes` size.
+auto makeSource(size_t bytes) -> std::string {
+  std::string src;
+  src.reserve(bytes + 256);
+  for (size_t i = 0; src.size() < bytes; i++) {
+    src += std::format(
+        "let generated_identifier_{} = fn(argument_value, other_argument) {{\n"
+        "    let s = \"a fairly long string literal number {} used by generated code\";\n"
+        "    if (argument_value <= {}.{}) {{ return other_argument * 12345678; }}\n"
+        "    return [argument_value, {{\"key_{}\": s}}, 987654321];\n"
+        "}};\n",
+        i, i, i, i % 100, i);
+  }
+  return src;
+}
+
+// MB/s of the fastest of `iters` runs of `fn` over `src`, which is steadier than the mean on a
+// busy machine.
+template <typename Fn>
+auto measure(std::string_view src, int iters, Fn fn) -> double {
+  size_t sink = 0;
+  double best = 0;
+  for (int i = 0; i < iters; i++) {
+    auto begin = std::chrono::steady_clock::now();
+    sink += fn(src.data(), src.data() + src.size());
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    best = std::max(best, static_cast<double>(src.size()) / secs / (1024.0 * 1024.0));
+  }
+  if (sink == 0) {
+    std::cerr << "nothing found\n";
+  }
+  return best;
+}
+
+auto countTokens(const char* p, const char* end) -> size_t {
+  return Lexer(std::string_view(p, static_cast<size_t>(end - p))).tokenizeAll().size();
+}
+
+auto countStructural(const char* p, const char* end) -> size_t {
+  size_t n = 1;
+  while ((p = scanToStructural(p, end)) != end) {
+    p++;
+    n++;
+  }
+  return n;
+}
+
+auto countLines(const char* p, const char* end) -> size_t {
+  std::vector<size_t> lines;
+  collectLineStarts(p, end, lines);
+  return lines.size() + 1;
+}
+
+auto stringBodyLength(const char* p, const char* end) -> size_t {
+  return static_cast<size_t>(scanStringBody(p, end) - p);
+}
+
+}  // namespace
+}  // namespace tmonkey
+
+int main(int argc, char* argv[]) {
+  using namespace tmonkey;
+
+  size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+  int iters = argc > 2 ? std::atoi(argv[2]) : 5;
+
+  auto src = makeSource(megabytes * 1024 * 1024);
+  auto body = std::string(src.size(), 'x');
+  auto best = scanIsa();
+
+  for (auto isa : {ScanIsa::kScalar, ScanIsa::kSse42, ScanIsa::kAvx2}) {
+    setScanIsa(isa);
+    if (scanIsa() != isa) {
+      continue;
+    }
+    std::cout << std::format(
+        "lexer {:>8}: {} MB/s\n", scanIsaStringify(isa),
+        static_cast<int64_t>(measure(src, iters, countTokens)));
+    // Single kernels, over runs long enough for the vector width to show.
+    std::cout << std::format(
+        "  structural {} MB/s, lines {} MB/s, string body {} MB/s\n",
+        static_cast<int64_t>(measure(src, iters, countStructural)),
+        static_cast<int64_t>(measure(src, iters, countLines)),
+        static_cast<int64_t>(measure(body, iters, stringBodyLength)));
+  }
+
+  setScanIsa(best);
+  return 0;
+}
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "lexer.h"
+#include "charclass.h"
 #include "common.h"
+#include "scan.h"
+#include "source.h"
 #include "gtest/gtest.h"
 
 namespace tmonkey {
@@ -59,6 +62,20 @@ TEST(LexerTests, Basics) {
   LEXER_ASSERT_EQ("_ident_123", Token::kIdentifier, "_ident_123");
 }
 
+TEST(LexerKeywordTests, Basics) {
+  static_assert(keywordKind("let") == Token::kLet);
+  static_assert(keywordKind("else") == Token::kElse);
+  static_assert(keywordKind("false") == Token::kFalse);
+  static_assert(keywordKind("lets") == Token::kIdentifier);
+  static_assert(keywordKind("") == Token::kIdentifier);
+
+  LEXER_ASSERT_EQ("true", Token::kTrue, "true");
+  LEXER_ASSERT_EQ("false", Token::kFalse, "false");
+  LEXER_ASSERT_EQ("nul", Token::kIdentifier, "nul");
+  LEXER_ASSERT_EQ("elsewhere", Token::kIdentifier, "elsewhere");
+  LEXER_ASSERT_EQ("Let", Token::kIdentifier, "Let");
+}
+
 TEST(LexerLetTests, Basics) {
   Lexer lex("let _abc_123 = 123;");
 
@@ -96,5 +113,193 @@ TEST(LexerStringBuf1Tests, Basics) {
   ASSERT_EQ(tok.kind(), Token::kSemicolon);
 }
 
+TEST(LexerTokenizeAllTests, Basics) {
+  std::string_view src = "let s = \"hi\";\nfoo(3.14)";
+  auto buf = Lexer(src).tokenizeAll();
+
+  std::vector<Token::Kind> kinds = {
+    Token::kLet,       Token::kIdentifier, Token::kEq,     Token::kString,
+    Token::kSemicolon, Token::kIdentifier, Token::kLParen, Token::kFloat,
+    Token::kRParen,    Token::kEof,
+  };
+  ASSERT_EQ(buf.size(), kinds.size());
+  for (size_t i = 0; i < kinds.size(); i++) {
+    ASSERT_EQ(buf.kind(i), kinds[i]);
+  }
+
+  ASSERT_EQ(buf.text(3), "hi");
+  ASSERT_EQ(buf.start(3), 9);
+  ASSERT_EQ(buf.text(7), "3.14");
+  ASSERT_EQ(buf.start(9), src.size());
+  ASSERT_EQ(buf.length(9), 0);
+
+  Lexer lex(src);
+  for (size_t i = 0; i < buf.size(); i++) {
+    auto tok = lex.next();
+    ASSERT_EQ(tok.kind(), buf.kind(i));
+    ASSERT_EQ(tok.text(), buf.token(i).text());
+  }
+}
+
+TEST(StreamLexerTests, ChunkBoundaries) {
+  std::string_view src =
+      "let fibo = fn(x) { if (x <= 1) { return x; } return fibo(x - 1) + fibo(x - 2); };\n"
+      "let s = \"a string, split anywhere\"; let f = 3.14159 != 2.5;  puts(s, f)  ";
+
+  std::vector<std::pair<Token::Kind, std::string>> expected;
+  Lexer lex(src);
+  for (;;) {
+    auto tok = lex.next();
+    expected.push_back({tok.kind(), std::string(tok.text())});
+    if (tok.kind() == Token::kEof) {
+      break;
+    }
+  }
+
+  for (size_t chunkSize = 1; chunkSize <= src.size(); chunkSize++) {
+    StreamLexer stream;
+    std::vector<std::pair<Token::Kind, std::string>> got;
+    auto drain = [&] {
+      while (auto tok = stream.next()) {
+        got.push_back({tok->kind(), std::string(tok->text())});
+        if (tok->kind() == Token::kEof) {
+          break;
+        }
+      }
+    };
+
+    for (size_t i = 0; i < src.size(); i += chunkSize) {
+      stream.feed(src.substr(i, chunkSize));
+      drain();
+    }
+    stream.finish();
+    drain();
+
+    ASSERT_EQ(got, expected) << "chunk size " << chunkSize;
+  }
+}
+
+TEST(StreamLexerTests, LongTokens) {
+  // Each token spans thousands of chunks; rescanning a held back token from its start on every
+  // feed would take minutes here.
+  auto ident = std::string(1 << 20, 'a');
+  auto number = std::string(1 << 20, '1') + "." + std::string(1 << 20, '2');
+  auto body = std::string(1 << 20, 'x');
+  auto src = ident + " " + number + " \"" + body + "\"" + std::string(1 << 20, ' ') + ";";
+
+  StreamLexer stream;
+  std::vector<std::pair<Token::Kind, size_t>> got;
+  auto drain = [&] {
+    while (auto tok = stream.next()) {
+      got.push_back({tok->kind(), tok->text().size()});
+      if (tok->kind() == Token::kEof) {
+        break;
+      }
+    }
+  };
+  for (size_t i = 0; i < src.size(); i += 64) {
+    stream.feed(std::string_view(src).substr(i, 64));
+    drain();
+  }
+  stream.finish();
+  drain();
+
+  std::vector<std::pair<Token::Kind, size_t>> expected = {
+      {Token::kIdentifier, ident.size()},
+      {Token::kFloat, number.size()},
+      {Token::kString, body.size()},
+      {Token::kSemicolon, 1},
+      {Token::kEof, 0},
+  };
+  ASSERT_EQ(got, expected);
+}
+
+TEST(SourceMapTests, Locate) {
+  // Lines long enough for the SIMD newline scan to see several blocks.
+  auto line = std::string(40, 'a');
+  auto src = line + "\n\n" + line + "\nxy";
+
+  auto best = scanIsa();
+  for (auto isa : {ScanIsa::kScalar, ScanIsa::kSse42, ScanIsa::kAvx2}) {
+    setScanIsa(isa);
+    SourceMap map(src);
+
+    auto loc = map.locate(0);
+    ASSERT_EQ(loc.line, 1);
+    ASSERT_EQ(loc.column, 1);
+
+    loc = map.locate(40);
+    ASSERT_EQ(loc.line, 1);
+    ASSERT_EQ(loc.column, 41);
+
+    loc = map.locate(41);
+    ASSERT_EQ(loc.line, 2);
+    ASSERT_EQ(loc.column, 1);
+
+    loc = map.locate(src.size() - 1);
+    ASSERT_EQ(loc.line, 4);
+    ASSERT_EQ(loc.column, 2);
+  }
+  setScanIsa(best);
+}
+
+TEST(LexerScanTests, AllIsas) {
+  // Runs long enough to cross several 16 and 32 byte blocks, with a non-ASCII byte inside.
+  auto ident = "_" + std::string(70, 'a') + "Z09";
+  auto spaces = std::string(45, ' ') + "\t\r\n" + std::string(33, ' ');
+  auto digits = std::string(67, '7');
+  auto body = std::string(40, 'x') + "\xc3\xa9 {}[]" + std::string(40, 'y');
+  auto src = spaces + ident + spaces + digits + "." + digits + "\"" + body + "\"" + ident + "\xc3";
+
+  auto best = scanIsa();
+  for (auto isa : {ScanIsa::kScalar, ScanIsa::kSse42, ScanIsa::kAvx2}) {
+    setScanIsa(isa);
+    Lexer lex(src);
+
+    auto tok = lex.next();
+    ASSERT_EQ(tok.kind(), Token::kIdentifier);
+    ASSERT_EQ(tok.text(), ident);
+
+    tok = lex.next();
+    ASSERT_EQ(tok.kind(), Token::kFloat);
+    ASSERT_EQ(tok.text(), digits + "." + digits);
+
+    tok = lex.next();
+    ASSERT_EQ(tok.kind(), Token::kString);
+    ASSERT_EQ(tok.text(), body);
+
+    tok = lex.next();
+    ASSERT_EQ(tok.kind(), Token::kIdentifier);
+    ASSERT_EQ(tok.text(), ident);
+
+    ASSERT_EQ(lex.next().kind(), Token::kEof);
+
+    const auto* end = src.data() + src.size();
+    const auto* p = scanToStructural(src.data(), end);
+    ASSERT_EQ('"', *p);
+    p = scanToStructural(p + 1, end);
+    ASSERT_EQ('{', *p);
+    ASSERT_EQ(']', *scanToStructural(p + 3, end));
+    ASSERT_EQ(end, scanToStructural(src.data() + src.rfind('"') + 1, end));
+  }
+  setScanIsa(best);
+}
+
+TEST(LexerScanTests, StructuralBytes) {
+  auto best = scanIsa();
+  for (auto isa : {ScanIsa::kScalar, ScanIsa::kSse42, ScanIsa::kAvx2}) {
+    setScanIsa(isa);
+    for (unsigned b = 0; b < 256; b++) {
+      auto c = static_cast<char>(b);
+      std::string src(64, 'a');
+      src[40] = c;
+      const auto* end = src.data() + src.size();
+      auto expected = isStructural(c) ? src.data() + 40 : end;
+      ASSERT_EQ(expected, scanToStructural(src.data(), end)) << scanIsaStringify(isa) << " " << b;
+    }
+  }
+  setScanIsa(best);
+}
+
 }  // namespace
 }  // namespace tmonkey
\ No newline at end of file
@@ -1,9 +1,283 @@
+#include <cerrno>
+#include <cstring>
+#include <thread>
 #include "ast.h"
 #include "codegen.h"
 #include "common.h"
+#include "compact_ast.h"
+#include "driver.h"
+#include "lexer.h"
 #include "parser.h"
+#include "pretty.h"
+#include "reg_codegen.h"
+#include "source.h"
 #include "token.h"
+#include "vm.h"
 
-int main(int argc, char* argv[]) {
+namespace {
+
+constexpr const char* kUsage =
+    "usage: tmonkey <file>...\n"
+    "       tmonkey parse [-j N] [-f text|json|sexpr] <file>...\n"
+    "       tmonkey lex < <file>\n"
+    "       tmonkey cache <file>...\n"
+    "       tmonkey compile [-r] <file>...\n"
+    "       tmonkey run [-r] <file>...\n";
+
+// Prints the tokens of stdin one per line as they complete, reading it in chunks so a pipe of
+// any size is lexed in bounded memory.
+auto lexStdin() -> int {
+  constexpr size_t kChunkSize = 64 * 1024;
+  auto chunk = std::make_unique<char[]>(kChunkSize);
+  tmonkey::StreamLexer lexer;
+  tmonkey::PrettySink out(stdout);
+
+  // False once kEof has been printed.
+  auto drain = [&] {
+    while (auto tok = lexer.next()) {
+      out.write(tmonkey::tokenKindStringify(tok->kind()));
+      switch (tok->kind()) {
+        case tmonkey::Token::kString:
+        case tmonkey::Token::kInteger:
+        case tmonkey::Token::kFloat:
+        case tmonkey::Token::kIdentifier:
+          out.put(' ');
+          out.write(tok->text());
+          break;
+        default:
+          break;
+      }
+      out.put('\n');
+      if (tok->kind() == tmonkey::Token::kEof) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  for (auto more = true; more;) {
+    auto n = std::fread(chunk.get(), 1, kChunkSize, stdin);
+    if (n == 0) {
+      lexer.finish();
+    } else {
+      lexer.feed(std::string_view(chunk.get(), n));
+    }
+    more = drain() && n != 0;
+  }
+
+  if (std::ferror(stdin) || !out.flush()) {
+    std::cerr << std::format("tmonkey: {}\n", std::strerror(errno));
+    return 1;
+  }
   return 0;
+}
+
+// Keeps a <file>.tmast next to every file, written on a miss and mapped on a hit. parse, compile
+// and run expand the tree from it instead of parsing the file.
+auto cacheFiles(char** paths, int count) -> int {
+  int status = 0;
+  for (int i = 0; i < count; i++) {
+    auto file = tmonkey::MappedFile::open(paths[i]);
+    if (!file) {
+      std::cerr << std::format("tmonkey: {}: {}\n", paths[i], std::strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    auto cachePath = std::format("{}.tmast", paths[i]);
+    if (auto ast = tmonkey::CompactAst::load(cachePath.c_str(), file->text())) {
+      std::cout << std::format("{}: cached, {} nodes\n", paths[i], ast->nodeCount());
+      continue;
+    }
+
+    tmonkey::Arena arena;
+    std::vector<std::string> errors;
+    auto tree = tmonkey::parse(file->text(), arena, &errors);
+    if (!errors.empty()) {
+      for (auto& err : errors) {
+        std::cerr << std::format("{}:{}\n", paths[i], err);
+      }
+      status = 1;
+      continue;
+    }
+
+    auto ast = tmonkey::CompactAst::build(tree, file->text());
+    if (!ast.write(cachePath.c_str())) {
+      std::cerr << std::format("tmonkey: {}: {}\n", cachePath, std::strerror(errno));
+      status = 1;
+      continue;
+    }
+    std::cout << std::format("{}: written, {} nodes\n", paths[i], ast.nodeCount());
+  }
+  return status;
+}
+
+// Expands the tree from <path>.tmast when it matches `text`, and parses `text` otherwise.
+auto parseCached(const char* path, std::string_view text, tmonkey::Arena& arena,
+                 std::vector<std::string>* errors) -> std::vector<tmonkey::AstNode*> {
+  auto cachePath = std::format("{}.tmast", path);
+  if (auto ast = tmonkey::CompactAst::load(cachePath.c_str(), text)) {
+    return ast->expand(arena);
+  }
+  return tmonkey::parse(text, arena, errors);
+}
+
+auto compile(const std::vector<tmonkey::AstNode*>& tree, bool registers,
+             std::vector<std::string>* errors) -> std::optional<tmonkey::Program> {
+  return registers ? tmonkey::RegCodegen::compile(tree, errors)
+                   : tmonkey::Codegen::compile(tree, errors);
+}
+
+// Prints the bytecode of every file, register code with -r.
+auto compileFiles(char** paths, int count, bool registers) -> int {
+  int status = 0;
+  for (int i = 0; i < count; i++) {
+    auto file = tmonkey::MappedFile::open(paths[i]);
+    if (!file) {
+      std::cerr << std::format("tmonkey: {}: {}\n", paths[i], std::strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    tmonkey::Arena arena;
+    std::vector<std::string> errors;
+    auto tree = parseCached(paths[i], file->text(), arena, &errors);
+    auto program = errors.empty() ? compile(tree, registers, &errors) : std::nullopt;
+    if (!program) {
+      for (auto& err : errors) {
+        std::cerr << std::format("{}:{}\n", paths[i], err);
+      }
+      status = 1;
+      continue;
+    }
+    std::cout << tmonkey::disassemble(*program);
+  }
+  return status;
+}
+
+// Compiles and runs every file, as register code with -r; puts writes to stdout.
+auto runFiles(char** paths, int count, bool registers) -> int {
+  int status = 0;
+  tmonkey::PrettySink out(stdout);
+  for (int i = 0; i < count; i++) {
+    auto file = tmonkey::MappedFile::open(paths[i]);
+    if (!file) {
+      out.flush();
+      std::cerr << std::format("tmonkey: {}: {}\n", paths[i], std::strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    tmonkey::Arena arena;
+    std::vector<std::string> errors;
+    auto tree = parseCached(paths[i], file->text(), arena, &errors);
+    auto program = errors.empty() ? compile(tree, registers, &errors) : std::nullopt;
+    if (program) {
+      tmonkey::Vm vm(*program, out);
+      if (!vm.run()) {
+        errors.push_back(vm.error());
+      }
+    }
+    if (!errors.empty()) {
+      out.flush();
+      for (auto& err : errors) {
+        std::cerr << std::format("{}:{}\n", paths[i], err);
+      }
+      status = 1;
+    }
+  }
+  if (!out.flush()) {
+    std::cerr << std::format("tmonkey: {}\n", std::strerror(errno));
+    status = 1;
+  }
+  return status;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int arg = 1;
+  size_t threads = 1;
+  auto format = tmonkey::PrettyFormat::kText;
+
+  if (arg < argc && std::string_view(argv[arg]) == "lex") {
+    if (argc != 2) {
+      std::cerr << kUsage;
+      return 1;
+    }
+    return lexStdin();
+  }
+
+  if (arg < argc && std::string_view(argv[arg]) == "cache") {
+    if (argc < 3) {
+      std::cerr << kUsage;
+      return 1;
+    }
+    return cacheFiles(argv + 2, argc - 2);
+  }
+
+  if (arg < argc && (std::string_view(argv[arg]) == "compile" ||
+                     std::string_view(argv[arg]) == "run")) {
+    auto run = std::string_view(argv[arg++]) == "run";
+    auto registers = arg < argc && std::string_view(argv[arg]) == "-r";
+    if (registers) {
+      arg++;
+    }
+    if (arg >= argc) {
+      std::cerr << kUsage;
+      return 1;
+    }
+    return run ? runFiles(argv + arg, argc - arg, registers)
+               : compileFiles(argv + arg, argc - arg, registers);
+  }
+
+  if (arg < argc && std::string_view(argv[arg]) == "parse") {
+    arg++;
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+      std::string_view opt(argv[arg]);
+      std::string_view val(argv[arg + 1]);
+      if (opt == "-j" && std::atoi(argv[arg + 1]) > 0) {
+        threads = static_cast<size_t>(std::atoi(argv[arg + 1]));
+      } else if (opt == "-f" && (val == "text" || val == "json" || val == "sexpr")) {
+        format = val == "text"   ? tmonkey::PrettyFormat::kText
+                 : val == "json" ? tmonkey::PrettyFormat::kJson
+                                 : tmonkey::PrettyFormat::kSexpr;
+      } else {
+        std::cerr << kUsage;
+        return 1;
+      }
+    }
+  }
+
+  if (arg >= argc) {
+    std::cerr << kUsage;
+    return 1;
+  }
+
+  auto parsed = tmonkey::parseFiles(std::vector<std::string>(argv + arg, argv + argc), threads);
+
+  int status = 0;
+  tmonkey::PrettySink out(stdout);
+  for (auto& file : parsed.files()) {
+    if (!file.file) {
+      out.flush();
+      std::cerr << std::format("tmonkey: {}: {}\n", file.path, file.errors.front());
+      status = 1;
+      continue;
+    }
+    if (!file.errors.empty()) {
+      out.flush();
+    }
+    for (auto& err : file.errors) {
+      std::cerr << std::format("{}:{}\n", file.path, err);
+    }
+    tmonkey::AstPrettyfier::print(file.tree, out, format);
+  }
+  if (!out.flush()) {
+    std::cerr << std::format("tmonkey: {}\n", std::strerror(errno));
+    status = 1;
+  }
+
+  return status;
 }
\ No newline at end of file
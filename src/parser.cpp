@@ -1,6 +1,8 @@
 #include "parser.h"
 #include <charconv>
 #include "lexer.h"
+#include "scan.h"
+#include "source.h"
 
 namespace tmonkey {
 
@@ -48,25 +50,73 @@ auto precedence(Token::Kind kind) -> uint8_t {
 
 class Parser {
 public:
-  Parser(std::string_view source, Arena& arena) : arena_{arena}, lex_(source) {}
+  // A streaming parser lexes on demand instead of tokenizing the whole source up front.
+  Parser(std::string_view source, Arena& arena, InternerRef interner, bool streaming = false)
+      : arena_{arena},
+        interner_{interner},
+        lexer_(source),
+        streaming_{streaming},
+        toks_(streaming ? TokenBuffer(source) : lexer_.tokenizeAll()),
+        sourceMap_(source) {
+    lexUntil(1);
+    if (interner_) {
+      putsSymbol_ = interner_.symbol("puts");
+    }
+  }
 
-  auto parse() -> std::vector<AstNode*>;
+  auto parse(std::vector<StmtRange>* ranges = nullptr) -> std::vector<AstNode*>;
+  void parseEach(const std::function<bool(Stmt*)>& fn);
+
+  auto errors() const -> const std::vector<std::string>& {
+    return errors_;
+  }
+
+  // False if lexing stopped at a byte that starts no token, which ends the input early.
+  auto lexedAll() const -> bool {
+    return lexer_.isAtEnd();
+  }
 
 private:
+  auto curKind() const -> Token::Kind {
+    return toks_.kind(pos_);
+  }
+
+  auto peekKind() const -> Token::Kind {
+    return pos_ + 1 < toks_.size() ? toks_.kind(pos_ + 1) : Token::kEof;
+  }
+
+  auto curText() const -> std::string_view {
+    return toks_.text(pos_);
+  }
+
+  // Prefixes the message with the line and column of the current token.
+  void logError(std::string msg) {
+    auto loc = sourceMap_.locate(toks_.start(pos_));
+    errors_.push_back(std::format("{}:{}: {}", loc.line, loc.column, msg));
+  }
+
+  // Makes sure the token at `i` exists, unless the input ends before it.
+  void lexUntil(size_t i) {
+    while (streaming_ && toks_.size() <= i &&
+           (toks_.size() == 0 || toks_.kind(toks_.size() - 1) != Token::kEof)) {
+      lexer_.pushNext(toks_);
+    }
+  }
+
+  // `puts` is reserved in every interner, so it is resolved once rather than per use.
+  auto curSymbol() -> Symbol {
+    return curKind() == Token::kPuts ? putsSymbol_ : interner_.symbol(curText());
+  }
+
   void advance();
   auto matchPeek(Token::Kind kind) -> bool;
 
-  auto parseInfixExpr(Expr* lhs) -> InfixExpr*;
-  auto parsePrefixExpr() -> PrefixExpr*;
   auto parseIfExpr() -> IfExpr*;
   auto parseWhileExpr() -> WhileExpr*;
   auto parseImportExpr() -> ImportExpr*;
   auto parseFnExpr() -> FnExpr*;
-  auto parseExprList(Token::Kind end) -> std::optional<std::vector<Expr*>>;
-  auto parseCallExpr(Expr* callable) -> CallExpr*;
+  auto parseExprList(Token::Kind end) -> std::optional<std::span<Expr*>>;
   auto parseArrayExpr() -> ArrayExpr*;
-  auto parseAssignExpr(Expr* expr) -> AssignExpr*;
-  auto parseIndexExpr(Expr* expr) -> IndexExpr*;
   auto parseHashMapExpr() -> HashMapExpr*;
   auto parseIdentifierExpr() -> IdentifierExpr*;
   auto parseNullExpr() -> NullExpr*;
@@ -74,10 +124,8 @@ private:
   auto parseIntegerExpr() -> IntegerExpr*;
   auto parseFloatExpr() -> FloatExpr*;
   auto parseStrExpr() -> StrExpr*;
-  auto parseGroupExpr() -> Expr*;
 
   auto handlePrefixExpr(Token::Kind kind) -> Expr*;
-  auto handleInfixExpr(Token::Kind kind, Expr* expr) -> Expr*;
 
   auto parseExpr(int prec) -> Expr*;
 
@@ -92,77 +140,285 @@ private:
     return new (arena_.alloc(sizeof(T))) T(std::forward<Args>(args)...);
   }
 
+  // Collects child nodes on a scratch stack shared by every list being parsed, then copies them
+  // into the arena in one piece. Nested lists push above the outer list's entries and pop them
+  // again, so after warm-up building a list never touches the heap.
+  template <typename T>
+  class ScratchList {
+  public:
+    explicit ScratchList(std::vector<T>& stack) : stack_{stack}, base_{stack.size()} {}
+
+    // Adopts the entries pushed onto `stack` since it was `base` long.
+    ScratchList(std::vector<T>& stack, size_t base) : stack_{stack}, base_{base} {}
+
+    NO_COPYABLE(ScratchList)
+
+    ~ScratchList() {
+      stack_.resize(base_);
+    }
+
+    void push(T v) {
+      stack_.push_back(v);
+    }
+
+    auto flush(Arena& arena) -> std::span<T> {
+      auto n = stack_.size() - base_;
+      if (n == 0) {
+        return {};
+      }
+      auto* data = reinterpret_cast<T*>(arena.alloc(n * sizeof(T)));
+      std::uninitialized_copy(stack_.begin() + static_cast<ptrdiff_t>(base_), stack_.end(), data);
+      stack_.resize(base_);
+      return {data, n};
+    }
+
+  private:
+    std::vector<T>& stack_;
+    size_t base_;
+  };
+
 private:
   Arena& arena_;
-  Lexer lex_;
+  InternerRef interner_;
+  Symbol putsSymbol_;
+  Lexer lexer_;
+  bool streaming_;
+  TokenBuffer toks_;
+  size_t pos_ = 0;
+  SourceMap sourceMap_;
   std::vector<std::string> errors_;
 
-  Token curTok_ = Token("", Token::kEof);
-  Token peekTok_ = Token("", Token::kEof);
+  // A construct whose operand parseExpr() is still parsing. Nesting is kept on this stack instead
+  // of the call stack, so expression depth is only bounded by memory.
+  struct ExprFrame {
+    enum Kind : uint8_t {
+      kRoot,
+      kPrefix,
+      kInfix,
+      kAssign,
+      kGroup,
+      kCall,
+      kIndex,
+    };
+
+    Kind kind;
+    // Operators binding tighter than this extend the operand.
+    int prec;
+    Token op;
+    Expr* lhs;
+    // Where the call's arguments start on exprScratch_.
+    size_t args;
+  };
+
+  std::vector<ExprFrame> exprFrames_;
+  // How many parseExpr calls are running, i.e. how deep lists, blocks and functions nest.
+  size_t exprDepth_ = 0;
+  // Set when a statement nests too deeply. Parsing stops there, since resyncing inside it would
+  // report every closing bracket that follows.
+  bool tooDeep_ = false;
+  std::vector<Expr*> exprScratch_;
+  std::vector<Stmt*> stmtScratch_;
+  std::vector<std::pair<Expr*, Expr*>> pairScratch_;
 };
 
-#define LOG_PARSE_ERR(msg) errors_.push_back(std::format("parser error: {} {}", __func__, (msg)))
-
-auto Parser::parse() -> std::vector<AstNode*> {
-  // set peek and curr toks
-  advance();
-  advance();
+#define LOG_PARSE_ERR(msg) logError(std::format("parser error: {} {}", __func__, (msg)))
 
+auto Parser::parse(std::vector<StmtRange>* ranges) -> std::vector<AstNode*> {
   std::vector<AstNode*> tree;
 
-  while (curTok_.kind() != Token::kEof) {
-    if (auto* stmt = parseStmt(); stmt) {
+  while (curKind() != Token::kEof && !tooDeep_) {
+    auto begin = toks_.start(pos_);
+    auto* stmt = parseStmt();
+    if (stmt) {
       tree.push_back(stmt);
     }
+    if (ranges) {
+      // The statement's last token is the current one; the loop only advances past it below.
+      auto end = toks_.start(pos_) + toks_.length(pos_);
+      ranges->push_back({stmt, begin, end, curKind() == Token::kSemicolon});
+    }
     advance();
   }
 
   return tree;
 }
 
+void Parser::parseEach(const std::function<bool(Stmt*)>& fn) {
+  while (curKind() != Token::kEof && !tooDeep_) {
+    auto mark = arena_.mark();
+    auto* stmt = parseStmt();
+    advance();
+    // Tokens of finished statements are never looked at again.
+    toks_.drop(pos_);
+    pos_ = 0;
+    if (!stmt || !fn(stmt)) {
+      arena_.rewind(mark);
+    }
+  }
+}
+
 void Parser::advance() {
-  curTok_ = peekTok_;
-  peekTok_ = lex_.next();
+  lexUntil(pos_ + 2);
+  if (pos_ + 1 < toks_.size()) {
+    pos_++;
+  }
 }
 
 auto Parser::matchPeek(Token::Kind kind) -> bool {
-  if (peekTok_.kind() == kind) {
+  if (peekKind() == kind) {
     advance();
     return true;
   }
-  errors_.push_back(std::format(
+  logError(std::format(
       "parser error: {} expected next token to be: {} got: {}", __func__, tokenKindStringify(kind),
-      tokenKindStringify(peekTok_.kind())));
+      tokenKindStringify(peekKind())));
   return false;
 }
 
+#define LOG_UNKNOWN_TOK_HANDLE_ERR(tok_kind) \
+  logError(                                  \
+      std::format("parser error: {} unknown token: {}", __func__, tokenKindStringify(tok_kind)))
+
 auto Parser::parseExpr(int prec) -> Expr* {
-  auto* lhs = handlePrefixExpr(curTok_.kind());
-  if (!lhs) {
+  // Operators and groups nest on exprFrames_, but lists, blocks and functions recurse.
+  if (exprDepth_ == kMaxNestingDepth) {
+    tooDeep_ = true;
+    logError(std::format("parser error: parseExpr nesting deeper than {}", kMaxNestingDepth));
     return nullptr;
   }
+  exprDepth_++;
 
-  while (peekTok_.kind() != Token::kSemicolon && prec < precedence(peekTok_.kind())) {
-    auto peekTokKind = peekTok_.kind();
-    advance();
-    lhs = handleInfixExpr(peekTokKind, lhs);
-  }
-
-  return lhs;
-}
-
-auto Parser::parseInfixExpr(Expr* lhs) -> InfixExpr* {
-  auto tokOp = curTok_;
-  advance();
-  auto* rhs = parseExpr(precedence(tokOp.kind()));
-  return createNode<InfixExpr>(tokOp, lhs, rhs);
-}
+  // Blocks and lists inside the expression parse their own expressions on top of these frames.
+  auto base = exprFrames_.size();
+  auto scratch = exprScratch_.size();
+  auto fail = [&]() -> Expr* {
+    exprFrames_.erase(exprFrames_.begin() + static_cast<ptrdiff_t>(base), exprFrames_.end());
+    exprScratch_.resize(scratch);
+    exprDepth_--;
+    return nullptr;
+  };
+  auto push = [&](ExprFrame::Kind kind, int framePrec, Expr* lhs = nullptr) {
+    exprFrames_.push_back({kind, framePrec, toks_.token(pos_), lhs, exprScratch_.size()});
+  };
+
+  push(ExprFrame::kRoot, prec);
+  for (;;) {
+    // Descend through prefix operators and groups to the next operand.
+    Expr* expr;
+    switch (curKind()) {
+      case Token::kMinus:
+      case Token::kBang:
+        push(ExprFrame::kPrefix, kPrecOrderPrefix);
+        advance();
+        continue;
+      case Token::kLParen:
+        push(ExprFrame::kGroup, 0);
+        advance();
+        continue;
+      default:
+        expr = handlePrefixExpr(curKind());
+        if (!expr) {
+          return fail();
+        }
+    }
 
-auto Parser::parsePrefixExpr() -> PrefixExpr* {
-  auto tokOp = curTok_;
-  advance();
-  auto* rhs = parseExpr(kPrecOrderPrefix);
-  return createNode<PrefixExpr>(tokOp, rhs);
+    // Extend the operand with the operators of the innermost frame, and close every frame the
+    // operand completes, until an operator needs a new operand.
+    for (;;) {
+      auto frame = exprFrames_.back();
+      auto kind = peekKind();
+      if (kind != Token::kSemicolon && frame.prec < precedence(kind)) {
+        advance();
+        switch (kind) {
+          case Token::kPlus:
+          case Token::kMinus:
+          case Token::kSlash:
+          case Token::kStar:
+          case Token::kEqEq:
+          case Token::kNotEq:
+          case Token::kLt:
+          case Token::kLtEq:
+          case Token::kGt:
+          case Token::kGtEq:
+            push(ExprFrame::kInfix, precedence(kind), expr);
+            break;
+          case Token::kEq:
+            if (expr->kind() != Expr::Kind::kIdentifierExpr &&
+                expr->kind() != Expr::Kind::kIndexExpr) {
+              logError(std::format(
+                  "expected identifier or index expr on left but got {}", expr->stringify()));
+              return fail();
+            }
+            push(ExprFrame::kAssign, 0, expr);
+            break;
+          case Token::kLParen:
+            push(ExprFrame::kCall, 0, expr);
+            if (peekKind() == Token::kRParen) {
+              advance();
+              exprFrames_.pop_back();
+              expr = createNode<CallExpr>(expr, std::span<Expr*>{});
+              continue;
+            }
+            break;
+          case Token::kLBracket:
+            push(ExprFrame::kIndex, 0, expr);
+            break;
+          default:
+            LOG_UNKNOWN_TOK_HANDLE_ERR(kind);
+            return fail();
+        }
+        advance();
+        break;
+      }
+
+      exprFrames_.pop_back();
+      switch (frame.kind) {
+        case ExprFrame::kRoot:
+          exprDepth_--;
+          return expr;
+        case ExprFrame::kPrefix:
+          expr = createNode<PrefixExpr>(frame.op, expr);
+          break;
+        case ExprFrame::kInfix:
+          expr = createNode<InfixExpr>(frame.op, frame.lhs, expr);
+          break;
+        case ExprFrame::kAssign:
+          expr = createNode<AssignExpr>(frame.lhs, expr);
+          break;
+        case ExprFrame::kGroup:
+          if (!matchPeek(Token::kRParen)) {
+            return fail();
+          }
+          break;
+        case ExprFrame::kCall:
+          exprScratch_.push_back(expr);
+          if (peekKind() != Token::kRParen && !matchPeek(Token::kComma)) {
+            return fail();
+          }
+          if (peekKind() != Token::kRParen) {
+            // On to the next argument.
+            exprFrames_.push_back(frame);
+            advance();
+            expr = nullptr;
+            break;
+          }
+          advance();
+          expr = createNode<CallExpr>(
+              frame.lhs, ScratchList<Expr*>(exprScratch_, frame.args).flush(arena_));
+          break;
+        case ExprFrame::kIndex:
+          if (!matchPeek(Token::kRBracket)) {
+            logError(std::format("unmatched {}", tokenKindStringify(peekKind())));
+            return fail();
+          }
+          expr = createNode<IndexExpr>(frame.lhs, expr);
+          break;
+      }
+      if (!expr) {
+        break;
+      }
+    }
+  }
 }
 
 auto Parser::parseIfExpr() -> IfExpr* {
@@ -187,7 +443,7 @@ auto Parser::parseIfExpr() -> IfExpr* {
   }
 
   BlockStmt* altStmt = nullptr;
-  if (peekTok_.kind() == Token::kElse) {
+  if (peekKind() == Token::kElse) {
     advance();
 
     if (!matchPeek(Token::kLBrace)) {
@@ -259,10 +515,10 @@ auto Parser::parseFnExpr() -> FnExpr* {
   return createNode<FnExpr>(*argsExpr, blockStmt);
 }
 
-auto Parser::parseExprList(Token::Kind end) -> std::optional<std::vector<Expr*>> {
-  std::vector<Expr*> elements;
+auto Parser::parseExprList(Token::Kind end) -> std::optional<std::span<Expr*>> {
+  ScratchList elements(exprScratch_);
 
-  while (peekTok_.kind() != end) {
+  while (peekKind() != end) {
     advance();
 
     auto* expr = parseExpr(0);
@@ -271,9 +527,9 @@ auto Parser::parseExprList(Token::Kind end) -> std::optional<std::vector<Expr*>>
       return {};
     }
 
-    elements.push_back(expr);
+    elements.push(expr);
 
-    if (peekTok_.kind() != end && !matchPeek(Token::kComma)) {
+    if (peekKind() != end && !matchPeek(Token::kComma)) {
       // TODO: produce err
       return {};
     }
@@ -284,16 +540,7 @@ auto Parser::parseExprList(Token::Kind end) -> std::optional<std::vector<Expr*>>
     return {};
   }
 
-  return elements;
-}
-
-auto Parser::parseCallExpr(Expr* callable) -> CallExpr* {
-  auto elements = parseExprList(Token::kRParen);
-  if (!elements) {
-    return nullptr;
-  }
-
-  return createNode<CallExpr>(callable, *elements);
+  return elements.flush(arena_);
 }
 
 auto Parser::parseArrayExpr() -> ArrayExpr* {
@@ -305,43 +552,16 @@ auto Parser::parseArrayExpr() -> ArrayExpr* {
   return createNode<ArrayExpr>(*elements);
 }
 
-auto Parser::parseAssignExpr(Expr* lhs) -> AssignExpr* {
-  switch (lhs->kind()) {
-    case Expr::Kind::kIdentifierExpr:
-    case Expr::Kind::kIndexExpr:
-      break;
-    default:
-      errors_.push_back(
-          std::format("expected identifier or index expr on left but got {}", lhs->stringify()));
-      return nullptr;
-  }
-
-  advance();
-  auto* rhs = parseExpr(0);
-  if (!rhs) {
-    return nullptr;
-  }
-
-  return createNode<AssignExpr>(lhs, rhs);
-}
-
-auto Parser::parseIndexExpr(Expr* lhs) -> IndexExpr* {
-  advance();
-  auto* idxExpr = parseExpr(0);
-  if (!matchPeek(Token::kRBracket)) {
-    errors_.push_back(std::format("unmatched {}", tokenKindStringify(peekTok_.kind())));
-    return nullptr;
-  }
-  return createNode<IndexExpr>(lhs, idxExpr);
-}
-
 auto Parser::parseHashMapExpr() -> HashMapExpr* {
-  std::vector<std::pair<Expr*, Expr*>> pairs;
+  ScratchList pairs(pairScratch_);
 
-  while (peekTok_.kind() != Token::kRBrace) {
+  while (peekKind() != Token::kRBrace) {
     advance();
 
-    auto* keyExpr = parseExpr(0);
+    // String keys are interned so hash-map lookups can compare symbols.
+    auto* keyExpr = curKind() == Token::kString && peekKind() == Token::kColon
+                        ? createNode<StrExpr>(curText(), interner_.symbol(curText()))
+                        : parseExpr(0);
     if (!keyExpr) {
       // TODO: produce err
       return nullptr;
@@ -359,9 +579,9 @@ auto Parser::parseHashMapExpr() -> HashMapExpr* {
       return nullptr;
     }
 
-    pairs.push_back({keyExpr, valExpr});
+    pairs.push({keyExpr, valExpr});
 
-    if (peekTok_.kind() != Token::kRBrace && !matchPeek(Token::kComma)) {
+    if (peekKind() != Token::kRBrace && !matchPeek(Token::kComma)) {
       // TODO: produce err
       return nullptr;
     }
@@ -372,11 +592,11 @@ auto Parser::parseHashMapExpr() -> HashMapExpr* {
     return nullptr;
   }
 
-  return createNode<HashMapExpr>(pairs);
+  return createNode<HashMapExpr>(pairs.flush(arena_));
 }
 
 auto Parser::parseIdentifierExpr() -> IdentifierExpr* {
-  return createNode<IdentifierExpr>(curTok_.text());
+  return createNode<IdentifierExpr>(curText(), curSymbol());
 }
 
 auto Parser::parseNullExpr() -> NullExpr* {
@@ -385,14 +605,14 @@ auto Parser::parseNullExpr() -> NullExpr* {
 
 auto Parser::parseBoolExpr() -> BoolExpr* {
   bool value = false;
-  if (curTok_.kind() == Token::kTrue) {
+  if (curKind() == Token::kTrue) {
     value = true;
   }
   return createNode<BoolExpr>(value);
 }
 
 auto Parser::parseIntegerExpr() -> IntegerExpr* {
-  auto text = curTok_.text();
+  auto text = curText();
   int64_t val;
   auto res = std::from_chars(text.data(), text.data() + text.size(), val);
   if (res.ec != std::errc()) {
@@ -403,7 +623,7 @@ auto Parser::parseIntegerExpr() -> IntegerExpr* {
 }
 
 auto Parser::parseFloatExpr() -> FloatExpr* {
-  auto text = curTok_.text();
+  auto text = curText();
   char buf[64] = {0};
   memcpy(&buf[0], text.data(), text.size());
   char* end;
@@ -416,23 +636,11 @@ auto Parser::parseFloatExpr() -> FloatExpr* {
 }
 
 auto Parser::parseStrExpr() -> StrExpr* {
-  return createNode<StrExpr>(curTok_.text());
-}
-
-auto Parser::parseGroupExpr() -> Expr* {
-  advance();
-
-  auto* expr = parseExpr(0);
-
-  if (!matchPeek(Token::kRParen)) {
-    return nullptr;
-  }
-
-  return expr;
+  return createNode<StrExpr>(curText());
 }
 
 auto Parser::parseStmt() -> Stmt* {
-  switch (curTok_.kind()) {
+  switch (curKind()) {
     case Token::kReturn:
       return parseRetStmt();
     case Token::kLet:
@@ -444,7 +652,7 @@ auto Parser::parseStmt() -> Stmt* {
 
 auto Parser::parseLetStmt() -> LetStmt* {
   if (!matchPeek(Token::kIdentifier)) {
-    LOG_PARSE_ERR(std::format("unexpected token: {}", tokenKindStringify(curTok_.kind())));
+    LOG_PARSE_ERR(std::format("unexpected token: {}", tokenKindStringify(curKind())));
     return nullptr;
   }
 
@@ -454,7 +662,7 @@ auto Parser::parseLetStmt() -> LetStmt* {
   }
 
   if (!matchPeek(Token::kEq)) {
-    LOG_PARSE_ERR(std::format("unexpected token: {}", tokenKindStringify(curTok_.kind())));
+    LOG_PARSE_ERR(std::format("unexpected token: {}", tokenKindStringify(curKind())));
     return nullptr;
   }
 
@@ -465,7 +673,7 @@ auto Parser::parseLetStmt() -> LetStmt* {
     return nullptr;
   }
 
-  if (peekTok_.kind() == Token::kSemicolon) {
+  if (peekKind() == Token::kSemicolon) {
     advance();
   }
 
@@ -473,33 +681,33 @@ auto Parser::parseLetStmt() -> LetStmt* {
 }
 
 auto Parser::parseRetStmt() -> RetStmt* {
-  auto tok = curTok_;
   advance();
   auto* expr = parseExpr(0);
-  if (peekTok_.kind() == Token::kSemicolon) {
+  if (!expr) {
+    return nullptr;
+  }
+  if (peekKind() == Token::kSemicolon) {
     advance();
   }
   return createNode<RetStmt>(expr);
 }
 
 auto Parser::parseBlockStmt() -> BlockStmt* {
-  std::vector<Stmt*> body;
-  auto tok = curTok_;
+  ScratchList body(stmtScratch_);
   advance();
-  while (curTok_.kind() != Token::kRBrace && curTok_.kind() != Token::kEof) {
+  while (curKind() != Token::kRBrace && curKind() != Token::kEof) {
     auto* stmt = parseStmt();
     if (!stmt) {
       // TODO: produce err
       return nullptr;
     }
-    body.push_back(stmt);
+    body.push(stmt);
     advance();
   }
-  return createNode<BlockStmt>(body);
+  return createNode<BlockStmt>(body.flush(arena_));
 }
 
 auto Parser::parseExprStmt() -> ExprStmt* {
-  auto tok = curTok_;
 
   auto* expr = parseExpr(0);
   if (!expr) {
@@ -507,16 +715,12 @@ auto Parser::parseExprStmt() -> ExprStmt* {
     return nullptr;
   }
 
-  if (peekTok_.kind() == Token::kSemicolon) {
+  if (peekKind() == Token::kSemicolon) {
     advance();
   }
   return createNode<ExprStmt>(expr);
 }
 
-#define LOG_UNKNOWN_TOK_HANDLE_ERR(tok_kind) \
-  errors_.push_back(                         \
-      std::format("parser error: {} unknown token: {}", __func__, tokenKindStringify(tok_kind)))
-
 auto Parser::handlePrefixExpr(Token::Kind kind) -> Expr* {
   switch (kind) {
     case Token::kPuts:
@@ -528,16 +732,11 @@ auto Parser::handlePrefixExpr(Token::Kind kind) -> Expr* {
       return parseFloatExpr();
     case Token::kString:
       return parseStrExpr();
-    case Token::kMinus:
-    case Token::kBang:
-      return parsePrefixExpr();
     case Token::kTrue:
     case Token::kFalse:
       return parseBoolExpr();
     case Token::kNull:
       return parseNullExpr();
-    case Token::kLParen:
-      return parseGroupExpr();
     case Token::kIf:
       return parseIfExpr();
     case Token::kWhile:
@@ -556,34 +755,149 @@ auto Parser::handlePrefixExpr(Token::Kind kind) -> Expr* {
   }
 }
 
-auto Parser::handleInfixExpr(Token::Kind kind, Expr* expr) -> Expr* {
-  switch (kind) {
-    case Token::kPlus:
-    case Token::kMinus:
-    case Token::kSlash:
-    case Token::kStar:
-    case Token::kEqEq:
-    case Token::kNotEq:
-    case Token::kLt:
-    case Token::kLtEq:
-    case Token::kGt:
-    case Token::kGtEq:
-      return parseInfixExpr(expr);
-    case Token::kEq:
-      return parseAssignExpr(expr);
-    case Token::kLParen:
-      return parseCallExpr(expr);
-    case Token::kLBracket:
-      return parseIndexExpr(expr);
-    default:
-      LOG_UNKNOWN_TOK_HANDLE_ERR(kind);
-      return nullptr;
+auto parse(
+    std::string_view source,
+    Arena& arena,
+    std::vector<std::string>* errors,
+    InternerRef interner) -> std::vector<AstNode*> {
+  Parser parser(source, arena, interner);
+  auto tree = parser.parse();
+  if (errors) {
+    *errors = parser.errors();
+  }
+  return tree;
+}
+
+void parseEach(
+    std::string_view source,
+    Arena& arena,
+    const std::function<bool(Stmt*)>& fn,
+    std::vector<std::string>* errors,
+    InternerRef interner) {
+  Parser parser(source, arena, interner, true);
+  parser.parseEach(fn);
+  if (errors) {
+    *errors = parser.errors();
+  }
+}
+
+auto parseStatements(
+    std::string_view source,
+    Arena& arena,
+    std::vector<std::string>* errors,
+    InternerRef interner) -> std::vector<StmtRange> {
+  Parser parser(source, arena, interner);
+  std::vector<StmtRange> ranges;
+  parser.parse(&ranges);
+  if (errors) {
+    *errors = parser.errors();
+  }
+  return ranges;
+}
+
+namespace {
+
+// Below this a chunk isn't worth a task of its own.
+constexpr size_t kMinParallelChunk = 256 * 1024;
+
+// Returns the offsets just past the depth-0 ';'s that end each chunk. Only bracket, ';' and '"'
+// bytes are looked at, and a string literal is skipped as a whole; an unterminated one ends the
+// scan, leaving the rest of the source in the last chunk.
+auto splitStatements(std::string_view source, size_t minChunk) -> std::vector<size_t> {
+  std::vector<size_t> splits;
+  const char* begin = source.data();
+  const char* end = begin + source.size();
+  const char* chunk = begin;
+  int64_t depth = 0;
+
+  for (const char* p = scanToStructural(begin, end); p != end; p = scanToStructural(p + 1, end)) {
+    switch (*p) {
+      case '(':
+      case '[':
+      case '{':
+        depth++;
+        break;
+      case ')':
+      case ']':
+      case '}':
+        depth--;
+        break;
+      case '"':
+        p = scanStringBody(p + 1, end);
+        if (p == end) {
+          return splits;
+        }
+        break;
+      case ';':
+        if (depth == 0 && static_cast<size_t>(p + 1 - chunk) >= minChunk) {
+          chunk = p + 1;
+          splits.push_back(static_cast<size_t>(chunk - begin));
+        }
+        break;
+    }
   }
+
+  return splits;
 }
 
-auto parse(std::string_view source, Arena& arena) -> std::vector<AstNode*> {
-  Parser parser(source, arena);
-  return parser.parse();
+}  // namespace
+
+auto parseParallel(
+    std::string_view source,
+    ThreadPool& pool,
+    const std::vector<std::unique_ptr<Arena>>& arenas,
+    std::vector<std::string>* errors,
+    InternerRef interner) -> std::vector<AstNode*> {
+  std::vector<size_t> splits;
+  if (pool.size() > 1 && interner.threadSafe()) {
+    auto minChunk = std::max(kMinParallelChunk, source.size() / (pool.size() * 4));
+    splits = splitStatements(source, minChunk);
+  }
+  if (splits.empty()) {
+    return parse(source, *arenas[0], errors, interner);
+  }
+  if (splits.back() != source.size()) {
+    splits.push_back(source.size());
+  }
+
+  std::vector<Arena::Mark> marks;
+  for (auto& arena : arenas) {
+    marks.push_back(arena->mark());
+  }
+
+  std::vector<std::vector<AstNode*>> trees(splits.size());
+  std::vector<uint8_t> chunkFailed(splits.size());
+  std::vector<uint8_t> stoppedEarly(splits.size());
+  pool.run(splits.size(), [&](size_t worker, size_t i) {
+    auto begin = i == 0 ? 0 : splits[i - 1];
+    Parser parser(source.substr(begin, splits[i] - begin), *arenas[worker], interner);
+    trees[i] = parser.parse();
+    chunkFailed[i] = !parser.errors().empty();
+    stoppedEarly[i] = !parser.lexedAll();
+  });
+
+  // parse() stops at the first byte that starts no token, so the chunks after it don't count.
+  auto used = static_cast<size_t>(
+      std::find(stoppedEarly.begin(), stoppedEarly.end(), 1) - stoppedEarly.begin());
+  used = std::min(used + 1, splits.size());
+  trees.resize(used);
+
+  if (std::find(chunkFailed.begin(), chunkFailed.begin() + static_cast<ptrdiff_t>(used), 1) !=
+      chunkFailed.begin() + static_cast<ptrdiff_t>(used)) {
+    for (size_t i = 0; i < arenas.size(); i++) {
+      arenas[i]->rewind(marks[i]);
+    }
+    return parse(source, *arenas[0], errors, interner);
+  }
+
+  std::vector<AstNode*> tree;
+  for (auto& t : trees) {
+    tree.insert(tree.end(), t.begin(), t.end());
+  }
+  if (errors) {
+    errors->clear();
+  }
+  return tree;
 }
 
 }  // namespace tmonkey
\ No newline at end of file
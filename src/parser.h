@@ -2,9 +2,63 @@
 
 #include "ast.h"
 #include "common.h"
+#include "strintern.h"
+#include "thread_pool.h"
 
 namespace tmonkey {
 
-auto parse(std::string_view source, Arena& arena) -> std::vector<AstNode*>;
+// Operators, calls and groups nest without limit, but the parser recurses into array and hash-map
+// literals, functions, ifs and whiles. Nesting those deeper than this is a syntax error that ends
+// the parse, so the recursion stays within a thread's stack.
+constexpr size_t kMaxNestingDepth = 1000;
+
+// Syntax errors are reported as "line:column: message" through `errors` when it is given. With an
+// interner, identifiers and string hash-map keys carry their symbol.
+auto parse(
+    std::string_view source,
+    Arena& arena,
+    std::vector<std::string>* errors = nullptr,
+    InternerRef interner = {}) -> std::vector<AstNode*>;
+
+// Parses `source` one top-level statement at a time, lexing on demand, and hands each statement
+// to `fn`. Its nodes come from `arena` and are released when `fn` returns, unless `fn` returns true
+// to keep the statement, so memory is bounded by the largest statement plus what the consumer
+// keeps. Statements that fail to parse are skipped, as in parse().
+void parseEach(
+    std::string_view source,
+    Arena& arena,
+    const std::function<bool(Stmt*)>& fn,
+    std::vector<std::string>* errors = nullptr,
+    InternerRef interner = {});
+
+// A top-level statement with the byte range of its tokens. `stmt` is null when the statement
+// couldn't be parsed; `terminated` tells whether its last token is a ';'.
+struct StmtRange {
+  AstNode* stmt;
+  uint32_t begin;
+  uint32_t end;
+  bool terminated;
+};
+
+// Like parse(), but returns every top-level statement with its range.
+auto parseStatements(
+    std::string_view source,
+    Arena& arena,
+    std::vector<std::string>* errors = nullptr,
+    InternerRef interner = {}) -> std::vector<StmtRange>;
+
+// Parses one large source on every worker of `pool`. A SIMD pre-scan splits the source after
+// top-level ';'s, outside of brackets and string literals, and the chunks are parsed concurrently;
+// a chunk parsed by worker w allocates from arenas[w], so `arenas` needs pool.size() entries. The
+// tree equals what parse() returns: chunks after one whose lexing stopped at a byte that starts no
+// token are dropped, and if any kept chunk reports an error, the chunk trees are discarded and the
+// source is parsed sequentially into arenas[0], so recovery and locations match as well. The
+// interner must be thread-safe for the source to be split.
+auto parseParallel(
+    std::string_view source,
+    ThreadPool& pool,
+    const std::vector<std::unique_ptr<Arena>>& arenas,
+    std::vector<std::string>* errors = nullptr,
+    InternerRef interner = {}) -> std::vector<AstNode*>;
 
 }  // namespace tmonkey
\ No newline at end of file
@@ -1,5 +1,11 @@
 #include "parser.h"
 #include "common.h"
+#include <unistd.h>
+#include <fstream>
+#include <random>
+#include "compact_ast.h"
+#include "driver.h"
+#include "incremental.h"
 #include "gtest/gtest.h"
 #include "pretty.h"
 
@@ -371,6 +377,637 @@ TEST(ParserTests, HashMap) {
   TM_ASSERT_TREE(expected, prog);
 }
 
+TEST(ParserTests, NestedLists) {
+  tmonkey::Arena arena;
+  auto tree = tmonkey::parse("[[1, 2], f(3, [4, 5]), {6: [7]}, fn(a) { a; 8 }]", arena);
+  ASSERT_EQ(tree.size(), 1);
+
+  auto value = [](const Expr* e) { return static_cast<const IntegerExpr*>(e)->value; };
+  const auto* outer = static_cast<const ArrayExpr*>(static_cast<const ExprStmt*>(tree[0])->expr);
+  ASSERT_EQ(outer->elements.size(), 4);
+
+  const auto* first = static_cast<const ArrayExpr*>(outer->elements[0]);
+  ASSERT_EQ(first->elements.size(), 2);
+  ASSERT_EQ(value(first->elements[1]), 2);
+
+  const auto* call = static_cast<const CallExpr*>(outer->elements[1]);
+  ASSERT_EQ(call->args.size(), 2);
+  ASSERT_EQ(value(call->args[0]), 3);
+  const auto* inner = static_cast<const ArrayExpr*>(call->args[1]);
+  ASSERT_EQ(inner->elements.size(), 2);
+  ASSERT_EQ(value(inner->elements[0]), 4);
+
+  const auto* map = static_cast<const HashMapExpr*>(outer->elements[2]);
+  ASSERT_EQ(map->pairs.size(), 1);
+  ASSERT_EQ(value(map->pairs[0].first), 6);
+  ASSERT_EQ(static_cast<const ArrayExpr*>(map->pairs[0].second)->elements.size(), 1);
+
+  const auto* fn = static_cast<const FnExpr*>(outer->elements[3]);
+  ASSERT_EQ(fn->params.size(), 1);
+  ASSERT_EQ(fn->body->body.size(), 2);
+}
+
+TEST(ParserTests, DeepNesting) {
+  auto nest = [](size_t depth) {
+    std::string src;
+    for (size_t i = 0; i < depth; i++) {
+      src += "f(-(1 + a[";
+    }
+    src += "0";
+    for (size_t i = 0; i < depth; i++) {
+      src += "]))";
+    }
+    return src + ";";
+  };
+  constexpr size_t kDepth = 100'000;
+
+  Arena arena;
+  std::vector<std::string> errors;
+  auto src = nest(kDepth);
+  auto tree = parse(src, arena, &errors);
+  ASSERT_TRUE(errors.empty());
+  ASSERT_EQ(tree.size(), 1u);
+
+  const auto* expr = static_cast<const ExprStmt*>(tree[0])->expr;
+  for (size_t i = 0; i < kDepth; i++) {
+    ASSERT_EQ(expr->kind(), AstNode::Kind::kCallExpr);
+    const auto* call = static_cast<const CallExpr*>(expr);
+    ASSERT_EQ(call->args.size(), 1u);
+    ASSERT_EQ(call->args[0]->kind(), AstNode::Kind::kPrefixExpr);
+    const auto* neg = static_cast<const PrefixExpr*>(call->args[0]);
+    ASSERT_EQ(neg->rhs->kind(), AstNode::Kind::kInfixExpr);
+    const auto* add = static_cast<const InfixExpr*>(neg->rhs);
+    ASSERT_EQ(add->rhs->kind(), AstNode::Kind::kIndexExpr);
+    expr = static_cast<const IndexExpr*>(add->rhs)->idx;
+  }
+  ASSERT_EQ(expr->kind(), AstNode::Kind::kIntegerExpr);
+
+  // The compact form is built and expanded, and printed, without recursing either.
+  Arena expandArena;
+  auto expanded = CompactAst::build(tree, src).expand(expandArena);
+  for (auto format : {PrettyFormat::kJson, PrettyFormat::kSexpr}) {
+    ASSERT_EQ(AstPrettyfier::prettify(tree, format), AstPrettyfier::prettify(expanded, format));
+  }
+
+  // The outermost call is left unclosed.
+  src.resize(src.size() - 2);
+  parse(src, arena, &errors);
+  ASSERT_FALSE(errors.empty());
+
+  // Long left-assoc chains and groups parse whatever their depth.
+  std::string chain = "let x = 1";
+  for (size_t i = 0; i < kDepth; i++) {
+    chain += " + 1";
+  }
+  for (const auto& deep : {
+           chain + ";",
+           std::string(kDepth, '(') + "1" + std::string(kDepth, ')') + ";",
+       }) {
+    tree = parse(deep, arena, &errors);
+    ASSERT_TRUE(errors.empty());
+    ASSERT_EQ(tree.size(), 1u);
+  }
+
+  // Lists, blocks and functions recurse in the parser, so their nesting is capped. Deeper input
+  // stops the parse at the limit with a single error.
+  auto brackets = [](size_t depth) {
+    return std::string(depth, '[') + "0" + std::string(depth, ']') + ";";
+  };
+  tree = parse(brackets(kMaxNestingDepth - 1), arena, &errors);
+  ASSERT_TRUE(errors.empty());
+  ASSERT_EQ(tree.size(), 1u);
+  for (const auto& deep : {brackets(kMaxNestingDepth), brackets(kDepth)}) {
+    tree = parse(deep, arena, &errors);
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQ(errors.size(), 1u);
+    ASSERT_NE(errors[0].find("nesting deeper than"), std::string::npos);
+  }
+}
+
+TEST(ParserTests, ErrorLocation) {
+  tmonkey::Arena arena;
+  std::vector<std::string> errors;
+  tmonkey::parse("let a = 1;\nlet = 2;", arena, &errors);
+  ASSERT_FALSE(errors.empty());
+  ASSERT_TRUE(errors[0].starts_with("2:1: ")) << errors[0];
+}
+
+TEST(ParserTests, Symbols) {
+  tmonkey::Arena arena;
+  tmonkey::StringInterningMap symbols;
+  auto tree = tmonkey::parse("let abc = {\"abc\": abc}; puts(abc);", arena, nullptr, symbols);
+  ASSERT_EQ(2u, tree.size());
+
+  const auto* let = static_cast<const tmonkey::LetStmt*>(tree[0]);
+  const auto* map = static_cast<const tmonkey::HashMapExpr*>(let->rhs);
+  const auto* key = static_cast<const tmonkey::StrExpr*>(map->pairs[0].first);
+  const auto* val = static_cast<const tmonkey::IdentifierExpr*>(map->pairs[0].second);
+  ASSERT_TRUE(let->identifier->symbol);
+  ASSERT_EQ(let->identifier->symbol, val->symbol);
+  ASSERT_EQ(let->identifier->symbol, key->symbol);
+  ASSERT_EQ(tmonkey::hashBytes("abc"), key->symbol.hash);
+
+  const auto* call = static_cast<const tmonkey::CallExpr*>(
+      static_cast<const tmonkey::ExprStmt*>(tree[1])->expr);
+  const auto* callable = static_cast<const tmonkey::IdentifierExpr*>(call->callable);
+  ASSERT_EQ(tmonkey::kSymbolPuts, callable->symbol.id);
+  const auto* arg = static_cast<const tmonkey::IdentifierExpr*>(call->args[0]);
+  ASSERT_EQ(let->identifier->symbol, arg->symbol);
+
+  auto plain = tmonkey::parse("abc;", arena);
+  const auto* expr = static_cast<const tmonkey::ExprStmt*>(plain[0])->expr;
+  ASSERT_FALSE(static_cast<const tmonkey::IdentifierExpr*>(expr)->symbol);
+}
+
+TEST(ParserTests, ParseFiles) {
+  std::vector<std::string> paths;
+  std::vector<std::string> sources;
+  for (int i = 0; i < 64; i++) {
+    paths.push_back(std::format("{}tmonkey_parse_files_{}.mk", testing::TempDir(), i));
+    sources.push_back(std::format("let shared = {};\nlet file_{} = fn(x) {{ x * shared }};", i, i));
+    std::ofstream(paths.back()) << sources.back();
+  }
+  paths.push_back(testing::TempDir() + "tmonkey_parse_files_missing.mk");
+
+  auto parsed = tmonkey::parseFiles(paths, 4);
+  ASSERT_EQ(paths.size(), parsed.files().size());
+  ASSERT_FALSE(parsed.files().back().file);
+  ASSERT_FALSE(parsed.files().back().errors.empty());
+
+  for (size_t i = 0; i < sources.size(); i++) {
+    const auto& file = parsed.files()[i];
+    ASSERT_EQ(paths[i], file.path);
+    ASSERT_TRUE(file.errors.empty());
+
+    tmonkey::Arena arena;
+    ASSERT_EQ(
+        tmonkey::AstPrettyfier::prettify(tmonkey::parse(sources[i], arena)),
+        tmonkey::AstPrettyfier::prettify(file.tree));
+
+    // Every file sees the same id for `shared`.
+    const auto* let = static_cast<const tmonkey::LetStmt*>(file.tree[0]);
+    ASSERT_EQ("shared", *parsed.symbols().string(let->identifier->symbol.id));
+    const auto* first = static_cast<const tmonkey::LetStmt*>(parsed.files()[0].tree[0]);
+    ASSERT_EQ(first->identifier->symbol, let->identifier->symbol);
+    std::remove(paths[i].c_str());
+  }
+}
+
+TEST(ParserTests, ParseParallel) {
+  std::string src;
+  for (int i = 0; src.size() < 1024 * 1024; i++) {
+    src += std::format(
+        "let f{} = fn(x) {{ let s = \"; }} {{\"; return [x, {{\"k\": s}}]; }};\n"
+        "if (f{}(1) < {}) {{ puts(\"(\"); }} else {{ {}.5 }};\n",
+        i, i, i, i);
+  }
+
+  tmonkey::ThreadPool pool(4);
+  std::vector<std::unique_ptr<tmonkey::Arena>> arenas;
+  for (size_t i = 0; i < pool.size(); i++) {
+    arenas.push_back(std::make_unique<tmonkey::Arena>());
+  }
+
+  tmonkey::Arena arena;
+  std::vector<std::string> errors;
+  auto expected = tmonkey::AstPrettyfier::prettify(tmonkey::parse(src, arena, &errors));
+  ASSERT_TRUE(errors.empty());
+  auto tree = tmonkey::parseParallel(src, pool, arenas, &errors);
+  ASSERT_TRUE(errors.empty());
+  ASSERT_EQ(expected, tmonkey::AstPrettyfier::prettify(tree));
+  ASSERT_GT(arenas[1]->bytesReserved(), 0u);
+
+  // An error in one chunk falls back to the sequential parse and its error locations.
+  src.insert(src.find('\n', src.size() / 2) + 1, "let = 1;\n");
+  std::vector<std::string> expectedErrors;
+  expected = tmonkey::AstPrettyfier::prettify(tmonkey::parse(src, arena, &expectedErrors));
+  ASSERT_FALSE(expectedErrors.empty());
+  tree = tmonkey::parseParallel(src, pool, arenas, &errors);
+  ASSERT_EQ(expectedErrors, errors);
+  ASSERT_EQ(expected, tmonkey::AstPrettyfier::prettify(tree));
+
+  // A byte that starts no token ends parse() early without an error; later chunks are dropped.
+  std::string stopped;
+  for (int i = 0; stopped.size() < 2 * 1024 * 1024; i++) {
+    stopped += std::format("let a{} = {};\n", i, i);
+    if (i == 20000) {
+      stopped += "@\n";
+    }
+  }
+  auto sequential = tmonkey::parse(stopped, arena, &expectedErrors);
+  ASSERT_TRUE(expectedErrors.empty());
+  ASSERT_EQ(20001u, sequential.size());
+  tree = tmonkey::parseParallel(stopped, pool, arenas, &errors);
+  ASSERT_TRUE(errors.empty());
+  ASSERT_EQ(
+      tmonkey::AstPrettyfier::prettify(sequential), tmonkey::AstPrettyfier::prettify(tree));
+}
+
+TEST(ParserTests, ParseEach) {
+  std::string src;
+  for (int i = 0; i < 5000; i++) {
+    src += std::format("let f{} = fn(x) {{ return [x, {{\"k\": {}}}]; }};\n", i, i);
+  }
+
+  tmonkey::Arena arena;
+  std::vector<std::string> errors;
+  auto all = tmonkey::parse(src, arena, &errors);
+  ASSERT_TRUE(errors.empty());
+  std::vector<tmonkey::AstNode*> expected;
+  for (size_t i = 0; i < all.size(); i += 100) {
+    expected.push_back(all[i]);
+  }
+
+  // Only the kept statements stay in the arena.
+  tmonkey::Arena scratch;
+  std::vector<tmonkey::AstNode*> kept;
+  size_t seen = 0;
+  tmonkey::parseEach(
+      src, scratch,
+      [&](tmonkey::Stmt* stmt) {
+        if (seen++ % 100 != 0) {
+          return false;
+        }
+        kept.push_back(stmt);
+        return true;
+      },
+      &errors);
+  ASSERT_TRUE(errors.empty());
+  ASSERT_EQ(all.size(), seen);
+  ASSERT_EQ(
+      tmonkey::AstPrettyfier::prettify(expected), tmonkey::AstPrettyfier::prettify(kept));
+  ASSERT_LT(scratch.bytesReserved() * 10, arena.bytesReserved());
+
+  src.insert(src.find('\n', src.size() / 2) + 1, "let = 1;\n");
+  std::vector<std::string> expectedErrors;
+  tmonkey::parse(src, arena, &expectedErrors);
+  ASSERT_FALSE(expectedErrors.empty());
+  tmonkey::parseEach(src, scratch, [](tmonkey::Stmt*) { return false; }, &errors);
+  ASSERT_EQ(expectedErrors, errors);
+}
+
+TEST(ParserTests, Incremental) {
+  std::string src;
+  for (int i = 0; i < 200; i++) {
+    src += std::format("let f{} = fn(x) {{ return x + {}; }};\n", i, i);
+  }
+
+  tmonkey::IncrementalParser doc(src);
+  auto before = doc.tree();
+  ASSERT_EQ(200u, before.size());
+
+  auto check = [&] {
+    tmonkey::Arena arena;
+    std::vector<std::string> errors;
+    auto expected = tmonkey::parse(doc.source(), arena, &errors);
+    ASSERT_EQ(errors, doc.errors());
+    ASSERT_EQ(
+        tmonkey::AstPrettyfier::prettify(expected), tmonkey::AstPrettyfier::prettify(doc.tree()));
+  };
+
+  // Typing inside one statement only reparses around it and shares every other node.
+  auto at = doc.source().find("x + 100");
+  doc.edit(at + 4, 0, "2 * ");
+  check();
+  ASSERT_LE(doc.reparsed(), 3u);
+  ASSERT_EQ(before[0], doc.tree()[0]);
+  ASSERT_EQ(before[199], doc.tree()[199]);
+  ASSERT_NE(before[100], doc.tree()[100]);
+
+  // Removing a ';' joins statements, inserting one splits them again.
+  at = doc.source().find("};\nlet f50");
+  doc.edit(at + 1, 1, "");
+  check();
+  doc.edit(at + 1, 0, ";");
+  check();
+  ASSERT_EQ(200u, doc.tree().size());
+
+  // An unterminated string swallows the rest of the file.
+  doc.edit(doc.source().find("let f10 "), 0, "\"");
+  check();
+  doc.edit(doc.source().find("\"let f10 "), 1, "");
+  check();
+
+  // Errors are reported as parse() reports them.
+  doc.edit(doc.source().find("let f20 "), 0, "let = ;");
+  check();
+  ASSERT_FALSE(doc.errors().empty());
+  doc.edit(doc.source().find("let = ;"), 7, "");
+  check();
+  ASSERT_TRUE(doc.errors().empty());
+
+  doc.edit(0, 0, "let head = 1;");
+  doc.edit(doc.source().size(), 0, "let tail = 2;");
+  check();
+  ASSERT_EQ(202u, doc.tree().size());
+
+  // An editor opens an empty buffer, types into it and clears it again.
+  tmonkey::IncrementalParser blank("");
+  ASSERT_TRUE(blank.tree().empty());
+  ASSERT_TRUE(blank.errors().empty());
+  blank.edit(0, 0, "let a = 1;");
+  ASSERT_EQ(1u, blank.tree().size());
+  ASSERT_TRUE(blank.errors().empty());
+  blank.edit(0, blank.source().size(), "");
+  ASSERT_TRUE(blank.tree().empty());
+}
+
+TEST(ParserTests, GapBuffer) {
+  std::string expected = "let a = 1;";
+  tmonkey::GapBuffer text(expected);
+  std::mt19937 rng(7);
+  for (int i = 0; i < 2000; i++) {
+    auto offset = rng() % (expected.size() + 1);
+    auto removed = std::min<size_t>(rng() % 4, expected.size() - offset);
+    auto inserted = std::string(rng() % 40, static_cast<char>('a' + i % 26));
+    expected.replace(offset, removed, inserted);
+    text.replace(offset, removed, inserted);
+    ASSERT_EQ(expected.size(), text.size());
+
+    auto begin = rng() % (expected.size() + 1);
+    auto end = begin + rng() % (expected.size() - begin + 1);
+    std::string slice(end - begin, '\0');
+    text.copy(begin, end, slice.data());
+    ASSERT_EQ(expected.substr(begin, end - begin), slice);
+  }
+  ASSERT_EQ(expected, text.view());
+}
+
+TEST(AstVisitorTests, DefaultWalk) {
+  struct Identifiers : AstVisitor<Identifiers> {
+    void visitIdentifierExpr(const IdentifierExpr* e) {
+      names.push_back(e->identifier);
+    }
+
+    std::vector<std::string_view> names;
+  };
+
+  Arena arena;
+  auto tree = parse("let f = fn(a, b) { if (a) { g(b[c]) } else { {\"k\": d} } };", arena);
+  ASSERT_EQ(tree.size(), 1u);
+  Identifiers v;
+  v.visit(tree[0]);
+  ASSERT_EQ(v.names, (std::vector<std::string_view>{"f", "a", "b", "a", "g", "b", "c", "d"}));
+}
+
+TEST(AstVisitorTests, Passes) {
+  struct Counts {
+    void enterNode(const AstNode*) {
+      nodes++;
+    }
+
+    void enterCallExpr(const CallExpr*) {
+      calls++;
+    }
+
+    size_t nodes = 0;
+    size_t calls = 0;
+  };
+
+  struct Depth {
+    void enterNode(const AstNode*) {
+      max = std::max(max, ++depth);
+    }
+
+    void leaveNode(const AstNode*) {
+      depth--;
+    }
+
+    size_t depth = 0;
+    size_t max = 0;
+  };
+
+  Arena arena;
+  auto tree = parse("let x = f(1, g(2));\nputs(x + 1);", arena);
+  Counts counts;
+  Depth depth;
+  AstPasses(counts, depth).run(tree);
+  // LetStmt, x, f(...), f, 1, g(2), g, 2, ExprStmt, puts(...), puts, x + 1, x, 1.
+  ASSERT_EQ(counts.nodes, 14u);
+  ASSERT_EQ(counts.calls, 3u);
+  ASSERT_EQ(depth.max, 4u);
+  ASSERT_EQ(depth.depth, 0u);
+
+  // The walk doesn't recurse, even below the parser's nesting limit.
+  Expr* expr = new (arena.alloc(sizeof(BoolExpr))) BoolExpr(true);
+  for (size_t i = 0; i < 100'000; i++) {
+    expr = new (arena.alloc(sizeof(PrefixExpr))) PrefixExpr(Token("!", Token::kBang), expr);
+  }
+  tree = {new (arena.alloc(sizeof(ExprStmt))) ExprStmt(expr)};
+  depth = {};
+  AstPasses(depth).run(tree);
+  ASSERT_EQ(depth.max, 100'002u);
+}
+
+TEST(PrettyTests, Formats) {
+  Arena arena;
+  auto tree = parse("let a = f(-1, \"x\");\n{\"k\": [2.5, null]};", arena);
+
+  ASSERT_EQ(
+      AstPrettyfier::prettify(tree, PrettyFormat::kJson),
+      "[{\"kind\":\"LetStmt\",\"identifier\":{\"kind\":\"IdentifierExpr\",\"value\":\"a\"},"
+      "\"expr\":{\"kind\":\"CallExpr\",\"callable\":{\"kind\":\"IdentifierExpr\",\"value\":\"f\"},"
+      "\"args\":[{\"kind\":\"PrefixExpr\",\"op\":\"-\",\"rhs\":{\"kind\":\"IntegerExpr\","
+      "\"value\":1}},{\"kind\":\"StrExpr\",\"value\":\"x\"}]}},{\"kind\":\"ExprStmt\",\"expr\":"
+      "{\"kind\":\"HashMapExpr\",\"pairs\":[[{\"kind\":\"StrExpr\",\"value\":\"k\"},"
+      "{\"kind\":\"ArrayExpr\",\"elements\":[{\"kind\":\"FloatExpr\",\"value\":2.5},"
+      "{\"kind\":\"NullExpr\"}]}]]}}]\n");
+  ASSERT_EQ(
+      AstPrettyfier::prettify(tree, PrettyFormat::kSexpr),
+      "(LetStmt :identifier (IdentifierExpr :value \"a\") :expr (CallExpr :callable "
+      "(IdentifierExpr :value \"f\") :args ((PrefixExpr :op \"-\" :rhs (IntegerExpr :value 1)) "
+      "(StrExpr :value \"x\"))))\n"
+      "(ExprStmt :expr (HashMapExpr :pairs (((StrExpr :value \"k\") (ArrayExpr :elements "
+      "((FloatExpr :value 2.5) (NullExpr)))))))\n");
+
+  // JSON has no inf or nan, so those print as null there.
+  auto inf = std::numeric_limits<double>::infinity();
+  for (auto [value, sexpr] : {std::pair{inf, "inf"}, {-inf, "-inf"}, {std::nan(""), "nan"}}) {
+    auto* e = new (arena.alloc(sizeof(FloatExpr))) FloatExpr(value);
+    std::vector<AstNode*> floats = {new (arena.alloc(sizeof(ExprStmt))) ExprStmt(e)};
+    ASSERT_EQ(
+        AstPrettyfier::prettify(floats, PrettyFormat::kJson),
+        "[{\"kind\":\"ExprStmt\",\"expr\":{\"kind\":\"FloatExpr\",\"value\":null}}]\n");
+    ASSERT_EQ(
+        AstPrettyfier::prettify(floats, PrettyFormat::kSexpr),
+        std::format("(ExprStmt :expr (FloatExpr :value {}))\n", sexpr));
+  }
+
+  // Output larger than the sink buffer goes out in pieces, and every target gets the same bytes.
+  std::string src;
+  while (src.size() < 2 * PrettySink::kBufferSize) {
+    src += "let x = [1, \"a\", {\"b\": x}];\n";
+  }
+  tree = parse(src, arena);
+  auto expected = AstPrettyfier::prettify(tree);
+  auto* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  {
+    PrettySink sink(fileno(file));
+    AstPrettyfier::print(tree, sink);
+    ASSERT_TRUE(sink.flush());
+  }
+  {
+    PrettySink sink(file);
+    AstPrettyfier::print(tree, sink);
+  }
+  fflush(file);
+  std::string written(2 * expected.size(), '\0');
+  ASSERT_EQ(pread(fileno(file), written.data(), written.size(), 0), ssize_t(written.size()));
+  fclose(file);
+  ASSERT_EQ(written, expected + expected);
+}
+
+TEST(CompactAstTests, Build) {
+  std::string_view prog = "let f = fn(x, y) { if (x < y) { -x } else { x * 2.5 } };\n"
+                          "f(1, {\"k\": [true, null]});";
+  tmonkey::Arena arena;
+  auto tree = tmonkey::parse(prog, arena);
+  auto ast = CompactAst::build(tree, prog);
+  using Kind = AstNode::Kind;
+
+  ASSERT_EQ(ast.roots().size(), 2);
+  auto letRef = ast.roots()[0];
+  ASSERT_EQ(letRef.kind(), Kind::kLetStmt);
+  const auto& let = ast.getLetStmt(letRef);
+  ASSERT_EQ(ast.text(ast.getIdentifierExpr(let.identifier).identifier), "f");
+
+  const auto& fn = ast.getFnExpr(let.rhs);
+  ASSERT_EQ(ast.list(fn.params).size(), 2);
+  ASSERT_EQ(ast.text(ast.getIdentifierExpr(ast.list(fn.params)[1]).identifier), "y");
+
+  auto body = ast.list(ast.getBlockStmt(fn.body).body);
+  ASSERT_EQ(body.size(), 1);
+  const auto& ifExpr = ast.getIfExpr(ast.getExprStmt(body[0]).expr);
+  ASSERT_EQ(ast.getInfixExpr(ifExpr.cnd).op, Token::kLt);
+  ASSERT_FALSE(ifExpr.alt.isNull());
+  auto alt = ast.list(ast.getBlockStmt(ifExpr.alt).body);
+  const auto& mul = ast.getInfixExpr(ast.getExprStmt(alt[0]).expr);
+  ASSERT_EQ(mul.op, Token::kStar);
+  ASSERT_EQ(ast.getFloatExpr(mul.rhs).value, 2.5);
+
+  const auto& call = ast.getCallExpr(ast.getExprStmt(ast.roots()[1]).expr);
+  auto args = ast.list(call.args);
+  ASSERT_EQ(args.size(), 2);
+  ASSERT_EQ(ast.getIntegerExpr(args[0]).value, 1);
+  auto pairs = ast.list(ast.getHashMapExpr(args[1]).pairs);
+  ASSERT_EQ(pairs.size(), 2);
+  ASSERT_EQ(ast.text(ast.getStrExpr(pairs[0]).value), "k");
+  auto elems = ast.list(ast.getArrayExpr(pairs[1]).elements);
+  ASSERT_EQ(elems[0].kind(), Kind::kBoolExpr);
+  ASSERT_TRUE(ast.boolValue(elems[0]));
+  ASSERT_EQ(elems[1].kind(), Kind::kNullExpr);
+
+  static_assert(sizeof(compact::InfixExpr) == 12);
+  static_assert(sizeof(compact::IdentifierExpr) == 12);
+}
+
+TEST(CompactAstTests, Cache) {
+  std::string prog = "let f = fn(x, y) { if (x < y) { -x } else { x * 2.5 } };\n"
+                     "f(1, {\"k\": [true, null]});";
+  tmonkey::Arena arena;
+  tmonkey::StringInterningMap symbols;
+  auto built = CompactAst::build(tmonkey::parse(prog, arena, nullptr, symbols), prog);
+  auto path = testing::TempDir() + "tmonkey_cache_test.tmast";
+  ASSERT_TRUE(built.write(path.c_str()));
+
+  auto loaded = CompactAst::load(path.c_str(), prog);
+  ASSERT_TRUE(loaded.has_value());
+  ASSERT_EQ(built.nodeCount(), loaded->nodeCount());
+  ASSERT_EQ(built.bytes(), loaded->bytes());
+  ASSERT_TRUE(std::ranges::equal(built.roots(), loaded->roots()));
+
+  const auto& let = loaded->getLetStmt(loaded->roots()[0]);
+  const auto& id = loaded->getIdentifierExpr(let.identifier);
+  ASSERT_EQ("f", loaded->text(id.identifier));
+  ASSERT_EQ(tmonkey::Symbol::kNone, id.symbol);
+  const auto& call = loaded->getCallExpr(loaded->getExprStmt(loaded->roots()[1]).expr);
+  ASSERT_EQ(1, loaded->getIntegerExpr(loaded->list(call.args)[0]).value);
+
+  // The expanded tree matches the parse, symbols included.
+  tmonkey::Arena expandArena;
+  auto parsed = tmonkey::parse(prog, arena, nullptr, symbols);
+  auto expanded = loaded->expand(expandArena, symbols);
+  ASSERT_EQ(
+      tmonkey::AstPrettyfier::prettify(parsed), tmonkey::AstPrettyfier::prettify(expanded));
+  ASSERT_EQ(
+      static_cast<const tmonkey::LetStmt*>(parsed[0])->identifier->symbol,
+      static_cast<const tmonkey::LetStmt*>(expanded[0])->identifier->symbol);
+
+  // A different source, even of the same length, misses.
+  auto edited = prog;
+  edited[edited.find("2.5")] = '3';
+  ASSERT_FALSE(CompactAst::load(path.c_str(), edited).has_value());
+
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << "TMAST";
+  ASSERT_FALSE(CompactAst::load(path.c_str(), prog).has_value());
+  std::remove(path.c_str());
+}
+
+TEST(CompactAstTests, CorruptCache) {
+  using Kind = AstNode::Kind;
+  std::string prog = "let f = fn(x) { if (x) { [x] } else { {\"k\": 1} } };\nf(1);";
+  tmonkey::Arena arena;
+  auto built = CompactAst::build(tmonkey::parse(prog, arena), prog);
+  auto path = testing::TempDir() + "tmonkey_corrupt_cache_test.tmast";
+  ASSERT_TRUE(built.write(path.c_str()));
+  std::string good;
+  {
+    std::ifstream in(path, std::ios::binary);
+    good.assign(std::istreambuf_iterator<char>(in), {});
+  }
+
+  // The header is 32 bytes, then one {offset, count, element size} entry per table: the ref list
+  // first, then the node tables in COMPACT_AST_TABLE_LIST order.
+  auto tableOffset = [&](size_t table) {
+    uint64_t offset;
+    std::memcpy(&offset, good.data() + 32 + 16 * table, sizeof(offset));
+    return static_cast<size_t>(offset);
+  };
+  constexpr size_t kRefs = 0;
+  constexpr size_t kFnExprs = 6;
+  constexpr size_t kStrExprs = 15;
+  constexpr size_t kBlockStmts = 18;
+
+  // Each edit overwrites one 32-bit word of the file. Loading has to fail rather than hand a bad
+  // tree to expand().
+  auto rejects = [&](size_t offset, uint32_t word) {
+    auto bad = good;
+    std::memcpy(bad.data() + offset, &word, sizeof(word));
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bad;
+    return !CompactAst::load(path.c_str(), prog).has_value();
+  };
+  auto word = [&](size_t offset) {
+    uint32_t w;
+    std::memcpy(&w, good.data() + offset, sizeof(w));
+    return w;
+  };
+  auto refWord = [](Kind kind, uint32_t index) {
+    return (static_cast<uint32_t>(kind) << 27) | index;
+  };
+  auto refs = tableOffset(kRefs);
+  // A list is flushed when its node is done, so the first ref is the IdentifierExpr x in [x].
+  auto x = word(refs);
+
+  ASSERT_FALSE(rejects(refs, x));
+  // An index past its table.
+  ASSERT_TRUE(rejects(refs, refWord(Kind::kIdentifierExpr, 0x3fffff)));
+  // Kinds that have no table, or don't fit the slot.
+  ASSERT_TRUE(rejects(refs, refWord(Kind::kExpr, 0)));
+  ASSERT_TRUE(rejects(refs, refWord(Kind::kLetStmt, 0)));
+  // A string past the end of the source.
+  ASSERT_TRUE(rejects(tableOffset(kStrExprs), 0xfffffff0));
+  // A list past the end of the ref list.
+  ASSERT_TRUE(rejects(tableOffset(kBlockStmts), 0x7fffffff));
+  // A block whose body contains the block itself.
+  auto bodyStart = word(tableOffset(kBlockStmts));
+  ASSERT_TRUE(rejects(refs + 4 * bodyStart, refWord(Kind::kBlockStmt, 0)));
+  // The parameter x replaced by the x in [x].
+  auto params = word(tableOffset(kFnExprs));
+  ASSERT_TRUE(rejects(refs + 4 * params, x));
+  std::remove(path.c_str());
+}
+
 TEST(ParserTests, Prog) {
   std::string prog = R"""(
 let fibo = fn(x) {
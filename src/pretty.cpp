@@ -1,282 +1,813 @@
 #include "pretty.h"
+#include <unistd.h>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
 
 namespace tmonkey {
 
-void AstPrettyfier::visitExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+PrettySink::PrettySink(Drain drain, void* target)
+    : drain_{drain}, target_{target}, buf_{new char[kBufferSize]} {}
+
+PrettySink::PrettySink(int fd)
+    : PrettySink(
+          [](void* target, const char* data, size_t size) {
+            auto fd = static_cast<int>(reinterpret_cast<intptr_t>(target));
+            while (size > 0) {
+              auto n = ::write(fd, data, size);
+              if (n < 0 && errno == EINTR) {
+                continue;
+              }
+              if (n <= 0) {
+                return false;
+              }
+              data += n;
+              size -= static_cast<size_t>(n);
+            }
+            return true;
+          },
+          reinterpret_cast<void*>(static_cast<intptr_t>(fd))) {}
+
+PrettySink::PrettySink(FILE* file)
+    : PrettySink(
+          [](void* target, const char* data, size_t size) {
+            return fwrite(data, 1, size, static_cast<FILE*>(target)) == size;
+          },
+          file) {}
+
+PrettySink::PrettySink(std::string& out)
+    : PrettySink(
+          [](void* target, const char* data, size_t size) {
+            static_cast<std::string*>(target)->append(data, size);
+            return true;
+          },
+          &out) {}
+
+void PrettySink::pad(char c, size_t n) {
+  while (n > 0) {
+    if (used_ == kBufferSize) {
+      flush();
+    }
+    auto k = std::min(n, kBufferSize - used_);
+    memset(buf_.get() + used_, c, k);
+    used_ += k;
+    n -= k;
+  }
+}
 
-  visit(n);
+void PrettySink::writeInt(int64_t v) {
+  char tmp[24];
+  auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+  write({tmp, static_cast<size_t>(res.ptr - tmp)});
 }
 
-void AstPrettyfier::visitInfixExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
-
-  const auto* e = static_cast<const InfixExpr*>(n);
-  result_ += std::format("InfixExpr {{\n");
-  result_ += std::format("{:.>{}}Op: {}\n", "", indent_, tokenKindStringify(e->op.kind()));
-  result_ += std::format("{:.>{}}Lhs: ", "", indent_);
-  visit(e->lhs);
-  result_ += std::format("{:.>{}}Rhs: ", "", indent_);
-  visit(e->rhs);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void PrettySink::writeFloat(double v) {
+  char tmp[32];
+  auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+  write({tmp, static_cast<size_t>(res.ptr - tmp)});
 }
 
-void AstPrettyfier::visitPrefixExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+auto PrettySink::flush() -> bool {
+  if (used_ > 0 && !failed_) {
+    failed_ = !drain_(target_, buf_.get(), used_);
+  }
+  used_ = 0;
+  return !failed_;
+}
 
-  const auto* e = static_cast<const PrefixExpr*>(n);
-  result_ += std::format("InfixExpr {{\n");
-  result_ += std::format("{:.>{}}Op: {}\n", "", indent_, tokenKindStringify(e->op.kind()));
-  result_ += std::format("{:.>{}}Rhs: ", "", indent_);
-  visit(e->rhs);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void PrettySink::writeSlow(std::string_view s) {
+  flush();
+  if (s.size() < kBufferSize) {
+    memcpy(buf_.get(), s.data(), s.size());
+    used_ = s.size();
+  } else if (!failed_) {
+    failed_ = !drain_(target_, s.data(), s.size());
+  }
 }
 
-void AstPrettyfier::visitIfExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+namespace {
+
+// Prints JSON or S-expressions. Both are the same nesting of nodes, fields and lists, so only the
+// punctuation differs.
+class AstDataPrinter : public AstWalker<AstDataPrinter> {
+public:
+  AstDataPrinter(PrettySink& sink, PrettyFormat format)
+      : sink_{sink}, json_{format == PrettyFormat::kJson} {}
 
-  const auto* e = static_cast<const IfExpr*>(n);
-  result_ += std::format("IfExpr {{\n");
-  result_ += std::format("{:.>{}}Cnd: ", "", indent_);
-  visit(e->cnd);
-  result_ += std::format("{:.>{}}Coseq: ", "", indent_);
-  visit(e->coseq);
-  if (e->alt) {
-    result_ += std::format("{:.>{}}Alt: ", "", indent_);
-    visit(*e->alt);
+  void print(const AstNode* n) {
+    walk(Frame{n, 0});
   }
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
-}
 
-void AstPrettyfier::visitWhileExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+  void print(const std::vector<AstNode*>& tree) {
+    if (!json_) {
+      for (const auto* n : tree) {
+        print(n);
+        sink_.put('\n');
+      }
+      return;
+    }
+    sink_.put('[');
+    for (size_t i = 0; i < tree.size(); i++) {
+      item(i);
+      print(tree[i]);
+    }
+    sink_.write("]\n");
+  }
 
-  const auto* e = static_cast<const WhileExpr*>(n);
-  result_ += std::format("WhileExpr {{\n");
-  result_ += std::format("{:.>{}}Cnd: ", "", indent_);
-  visit(e->cnd);
-  result_ += std::format("{:.>{}}Coseq: ", "", indent_);
-  visit(e->coseq);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
-}
+private:
+  friend class AstWalker<AstDataPrinter>;
 
-void AstPrettyfier::visitImportExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+  struct Frame {
+    const AstNode* node;
+    size_t step;
+  };
 
-  const auto* e = static_cast<const ImportExpr*>(n);
-}
+  void visit(const AstNode* n) {
+    descend(Frame{n, 0});
+  }
 
-void AstPrettyfier::visitFnExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
-
-  const auto* e = static_cast<const FnExpr*>(n);
-  result_ += std::format("FnExpr {{\n");
-  if (e->params.size() > 0) {
-    result_ += std::format("{:.>{}}Params: [\n", "", indent_);
-    for (auto* expr : e->params) {
-      indent_++;
-      result_ += std::format("{:.>{}}", "", indent_);
-      visit(expr);
-      indent_--;
-    }
-    result_ += std::format("{:.>{}}]\n", "", indent_);
-  } else {
-    result_ += std::format("{:.>{}}Params: []\n", "", indent_);
-  }
-  result_ += std::format("{:.>{}}Body: ", "", indent_);
-  visit(e->body);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
-}
+  void resumeInfixExpr(const InfixExpr* e, Frame& f) {
+    switch (f.step++) {
+      case 0:
+        open("InfixExpr");
+        key("op");
+        string(e->op.text());
+        key("lhs");
+        return visit(e->lhs);
+      case 1:
+        key("rhs");
+        return visit(e->rhs);
+      default:
+        close();
+        return finish();
+    }
+  }
 
-void AstPrettyfier::visitCallExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
-
-  const auto* e = static_cast<const CallExpr*>(n);
-  result_ += std::format("CallExpr {{\n");
-  result_ += std::format("{:.>{}}Callable: ", "", indent_);
-  visit(e->callable);
-  result_ += std::format("{:.>{}}Arguments: [\n", "", indent_);
-  for (auto* expr : e->args) {
-    indent_++;
-    result_ += std::format("{:.>{}}", "", indent_);
-    visit(expr);
-    indent_--;
-  }
-  result_ += std::format("{:.>{}}]\n", "", indent_);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
-}
+  void resumePrefixExpr(const PrefixExpr* e, Frame& f) {
+    if (f.step++ == 0) {
+      open("PrefixExpr");
+      key("op");
+      string(e->op.text());
+      key("rhs");
+      return visit(e->rhs);
+    }
+    close();
+    finish();
+  }
 
-void AstPrettyfier::visitArrayExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+  void resumeIfExpr(const IfExpr* e, Frame& f) {
+    switch (f.step++) {
+      case 0:
+        open("IfExpr");
+        key("cnd");
+        return visit(e->cnd);
+      case 1:
+        key("coseq");
+        return visit(e->coseq);
+      case 2:
+        if (e->alt) {
+          key("alt");
+          return visit(*e->alt);
+        }
+        [[fallthrough]];
+      default:
+        close();
+        return finish();
+    }
+  }
 
-  const auto* e = static_cast<const ArrayExpr*>(n);
-  result_ += std::format("ArrayExpr {{\n");
-  result_ += std::format("{:.>{}}Elements: [\n", "", indent_);
-  for (auto* expr : e->elements) {
-    indent_++;
-    result_ += std::format("{:.>{}}", "", indent_);
-    visit(expr);
-    indent_--;
+  void resumeWhileExpr(const WhileExpr* e, Frame& f) {
+    switch (f.step++) {
+      case 0:
+        open("WhileExpr");
+        key("cnd");
+        return visit(e->cnd);
+      case 1:
+        key("coseq");
+        return visit(e->coseq);
+      default:
+        close();
+        return finish();
+    }
+  }
+
+  void resumeImportExpr(const ImportExpr* e, Frame& f) {
+    if (f.step++ == 0) {
+      open("ImportExpr");
+      key("name");
+      return visit(e->name);
+    }
+    close();
+    finish();
   }
-  result_ += std::format("{:.>{}}]\n", "", indent_);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
-}
 
-void AstPrettyfier::visitAssignExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+  void resumeFnExpr(const FnExpr* e, Frame& f) {
+    auto step = f.step++;
+    if (step == 0) {
+      open("FnExpr");
+      key("params");
+    }
+    // At step params.size() the list is closed and the body follows.
+    if (step <= e->params.size()) {
+      if (listItem(e->params, step)) {
+        return;
+      }
+      key("body");
+      return visit(e->body);
+    }
+    close();
+    finish();
+  }
 
-  const auto* e = static_cast<const AssignExpr*>(n);
-  result_ += std::format("AssignExpr {{\n");
-  result_ += std::format("{:.>{}}Lhs: ", "", indent_);
-  visit(e->lhs);
-  result_ += std::format("{:.>{}}Rhs: ", "", indent_);
-  visit(e->rhs);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
-}
+  void resumeCallExpr(const CallExpr* e, Frame& f) {
+    auto step = f.step++;
+    if (step == 0) {
+      open("CallExpr");
+      key("callable");
+      return visit(e->callable);
+    }
+    if (step == 1) {
+      key("args");
+    }
+    if (listItem(e->args, step - 1)) {
+      return;
+    }
+    close();
+    finish();
+  }
+
+  void resumeArrayExpr(const ArrayExpr* e, Frame& f) {
+    auto step = f.step++;
+    if (step == 0) {
+      open("ArrayExpr");
+      key("elements");
+    }
+    if (listItem(e->elements, step)) {
+      return;
+    }
+    close();
+    finish();
+  }
+
+  void resumeAssignExpr(const AssignExpr* e, Frame& f) {
+    switch (f.step++) {
+      case 0:
+        open("AssignExpr");
+        key("lhs");
+        return visit(e->lhs);
+      case 1:
+        key("rhs");
+        return visit(e->rhs);
+      default:
+        close();
+        return finish();
+    }
+  }
 
-void AstPrettyfier::visitIndexExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+  void resumeIndexExpr(const IndexExpr* e, Frame& f) {
+    switch (f.step++) {
+      case 0:
+        open("IndexExpr");
+        key("lhs");
+        return visit(e->lhs);
+      case 1:
+        key("idx");
+        return visit(e->idx);
+      default:
+        close();
+        return finish();
+    }
+  }
+
+  // Pairs are two-element lists, printed in two steps each.
+  void resumeHashMapExpr(const HashMapExpr* e, Frame& f) {
+    auto step = f.step++;
+    auto i = step / 2;
+    if (step == 0) {
+      open("HashMapExpr");
+      key("pairs");
+      sink_.put(json_ ? '[' : '(');
+    }
+    if (step % 2 == 1) {
+      item(1);
+      return visit(e->pairs[i].second);
+    }
+    if (i > 0) {
+      sink_.put(json_ ? ']' : ')');
+    }
+    if (i < e->pairs.size()) {
+      item(i);
+      sink_.put(json_ ? '[' : '(');
+      return visit(e->pairs[i].first);
+    }
+    sink_.put(json_ ? ']' : ')');
+    close();
+    finish();
+  }
+
+  void resumeIdentifierExpr(const IdentifierExpr* e, Frame&) {
+    open("IdentifierExpr");
+    key("value");
+    string(e->identifier);
+    close();
+    finish();
+  }
+
+  void resumeNullExpr(const NullExpr*, Frame&) {
+    open("NullExpr");
+    close();
+    finish();
+  }
+
+  void resumeBoolExpr(const BoolExpr* e, Frame&) {
+    open("BoolExpr");
+    key("value");
+    sink_.writeBool(e->value);
+    close();
+    finish();
+  }
+
+  void resumeIntegerExpr(const IntegerExpr* e, Frame&) {
+    open("IntegerExpr");
+    key("value");
+    sink_.writeInt(e->value);
+    close();
+    finish();
+  }
+
+  void resumeFloatExpr(const FloatExpr* e, Frame&) {
+    open("FloatExpr");
+    key("value");
+    // JSON has no inf or nan; they print as null, as JSON.stringify does.
+    if (json_ && !std::isfinite(e->value)) {
+      sink_.write("null");
+    } else {
+      sink_.writeFloat(e->value);
+    }
+    close();
+    finish();
+  }
+
+  void resumeStrExpr(const StrExpr* e, Frame&) {
+    open("StrExpr");
+    key("value");
+    string(e->value);
+    close();
+    finish();
+  }
+
+  void resumeLetStmt(const LetStmt* s, Frame& f) {
+    switch (f.step++) {
+      case 0:
+        open("LetStmt");
+        key("identifier");
+        return visit(s->identifier);
+      case 1:
+        key("expr");
+        return visit(s->rhs);
+      default:
+        close();
+        return finish();
+    }
+  }
 
-  const auto* e = static_cast<const IndexExpr*>(n);
-  result_ += std::format("IndexExpr {{\n");
-  result_ += std::format("{:.>{}}Lhs: ", "", indent_);
-  visit(e->lhs);
-  result_ += std::format("{:.>{}}Idx: ", "", indent_);
-  visit(e->idx);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+  void resumeRetStmt(const RetStmt* s, Frame& f) {
+    if (f.step++ == 0) {
+      open("RetStmt");
+      key("expr");
+      return visit(s->expr);
+    }
+    close();
+    finish();
+  }
+
+  void resumeExprStmt(const ExprStmt* s, Frame& f) {
+    if (f.step++ == 0) {
+      open("ExprStmt");
+      key("expr");
+      return visit(s->expr);
+    }
+    close();
+    finish();
+  }
+
+  void resumeBlockStmt(const BlockStmt* s, Frame& f) {
+    auto step = f.step++;
+    if (step == 0) {
+      open("BlockStmt");
+      key("body");
+    }
+    if (listItem(s->body, step)) {
+      return;
+    }
+    close();
+    finish();
+  }
+
+  void open(std::string_view kind) {
+    if (json_) {
+      sink_.write("{\"kind\":\"");
+      sink_.write(kind);
+      sink_.put('"');
+    } else {
+      sink_.put('(');
+      sink_.write(kind);
+    }
+  }
+
+  void key(std::string_view name) {
+    sink_.write(json_ ? ",\"" : " :");
+    sink_.write(name);
+    sink_.write(json_ ? "\":" : " ");
+  }
+
+  void close() {
+    sink_.put(json_ ? '}' : ')');
+  }
+
+  void item(size_t i) {
+    if (i > 0) {
+      sink_.put(json_ ? ',' : ' ');
+    }
+  }
+
+  // Prints element `i` of a list, opening it first, or closes the list and returns false past
+  // its end.
+  template <typename T>
+  auto listItem(std::span<T*> nodes, size_t i) -> bool {
+    if (i == 0) {
+      sink_.put(json_ ? '[' : '(');
+    }
+    if (i < nodes.size()) {
+      item(i);
+      visit(nodes[i]);
+      return true;
+    }
+    sink_.put(json_ ? ']' : ')');
+    return false;
+  }
+
+  // Quoted with JSON escapes, which S-expression readers accept as well.
+  void string(std::string_view s) {
+    sink_.put('"');
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+      auto c = static_cast<unsigned char>(s[i]);
+      if (c >= 0x20 && c != '"' && c != '\\') {
+        continue;
+      }
+      sink_.write(s.substr(run, i - run));
+      run = i + 1;
+      switch (c) {
+        case '"':
+          sink_.write("\\\"");
+          break;
+        case '\\':
+          sink_.write("\\\\");
+          break;
+        case '\n':
+          sink_.write("\\n");
+          break;
+        case '\t':
+          sink_.write("\\t");
+          break;
+        case '\r':
+          sink_.write("\\r");
+          break;
+        default: {
+          constexpr const char* kHex = "0123456789abcdef";
+          char esc[] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 15]};
+          sink_.write({esc, sizeof(esc)});
+        }
+      }
+    }
+    sink_.write(s.substr(run));
+    sink_.put('"');
+  }
+
+  PrettySink& sink_;
+  std::deque<Frame> frames_;
+  bool json_;
+};
+
+}  // namespace
+
+auto AstPrettyfier::prettify(const AstNode* n, PrettyFormat format) -> std::string {
+  std::string result;
+  {
+    PrettySink sink(result);
+    if (format == PrettyFormat::kText) {
+      AstPrettyfier(sink).walk(Frame{n, 0, 1});
+    } else {
+      AstDataPrinter(sink, format).print(n);
+    }
+  }
+  return result;
 }
 
-void AstPrettyfier::visitHashMapExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
-
-  const auto* e = static_cast<const HashMapExpr*>(n);
-  result_ += std::format("HashMapExpr {{\n");
-  result_ += std::format("{:.>{}}Pairs: [\n", "", indent_);
-  for (auto& p : e->pairs) {
-    indent_++;
-    result_ += std::format("{:.>{}}{{\n", "", indent_);
-    indent_++;
-    result_ += std::format("{:.>{}}Key: ", "", indent_);
-    visit(p.first);
-    result_ += std::format("{:.>{}}Val: ", "", indent_);
-    visit(p.second);
-    indent_--;
-    result_ += std::format("{:.>{}}}}\n", "", indent_);
-    indent_--;
-  }
-  result_ += std::format("{:.>{}}]\n", "", indent_);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+auto AstPrettyfier::prettify(const std::vector<AstNode*>& tree, PrettyFormat format)
+    -> std::string {
+  std::string result;
+  {
+    PrettySink sink(result);
+    print(tree, sink, format);
+  }
+  return result;
 }
 
-void AstPrettyfier::visitIdentifierExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::print(
+    const std::vector<AstNode*>& tree, PrettySink& sink, PrettyFormat format) {
+  if (format != PrettyFormat::kText) {
+    AstDataPrinter(sink, format).print(tree);
+    return;
+  }
 
-  const auto* e = static_cast<const IdentifierExpr*>(n);
-  result_ += std::format("IdentifierExpr {{\n");
-  result_ += std::format("{:.>{}}Value: {}\n", "", indent_, e->identifier);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+  AstPrettyfier p(sink);
+  p.write("Ast {\n");
+  for (const auto* node : tree) {
+    p.pad(1);
+    p.walk(Frame{node, 0, 2});
+  }
+  p.write("}\n");
 }
 
-void AstPrettyfier::visitNullExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeInfixExpr(const InfixExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      write("InfixExpr {\n");
+      field("Op");
+      write(tokenKindStringify(e->op.kind()));
+      write("\n");
+      field("Lhs");
+      return visit(e->lhs);
+    case 1:
+      field("Rhs");
+      return visit(e->rhs);
+    default:
+      close();
+      return finish();
+  }
+}
 
-  const auto* e = static_cast<const NullExpr*>(n);
-  result_ += std::format("NullExpr {{}}\n");
+void AstPrettyfier::resumePrefixExpr(const PrefixExpr* e, Frame& f) {
+  if (f.step++ == 0) {
+    write("InfixExpr {\n");
+    field("Op");
+    write(tokenKindStringify(e->op.kind()));
+    write("\n");
+    field("Rhs");
+    return visit(e->rhs);
+  }
+  close();
+  finish();
 }
 
-void AstPrettyfier::visitBoolExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeIfExpr(const IfExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      write("IfExpr {\n");
+      field("Cnd");
+      return visit(e->cnd);
+    case 1:
+      field("Coseq");
+      return visit(e->coseq);
+    case 2:
+      if (e->alt) {
+        field("Alt");
+        return visit(*e->alt);
+      }
+      [[fallthrough]];
+    default:
+      close();
+      return finish();
+  }
+}
 
-  const auto* e = static_cast<const BoolExpr*>(n);
-  result_ += std::format("BoolExpr {{\n");
-  result_ += std::format("{:.>{}}Value: {}\n", "", indent_, e->value);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void AstPrettyfier::resumeWhileExpr(const WhileExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      write("WhileExpr {\n");
+      field("Cnd");
+      return visit(e->cnd);
+    case 1:
+      field("Coseq");
+      return visit(e->coseq);
+    default:
+      close();
+      return finish();
+  }
 }
 
-void AstPrettyfier::visitIntegerExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeFnExpr(const FnExpr* e, Frame& f) {
+  auto step = f.step++;
+  auto n = e->params.size();
+  if (step == 0) {
+    write("FnExpr {\n");
+    field("Params");
+    write(n > 0 ? "[\n" : "[]\n");
+  }
+  // At step n the list is closed and the body follows.
+  if (n > 0 && step <= n && listItem(e->params, step)) {
+    return;
+  }
+  if (step == n) {
+    field("Body");
+    return visit(e->body);
+  }
+  close();
+  finish();
+}
 
-  const auto* e = static_cast<const IntegerExpr*>(n);
-  result_ += std::format("IntegerExpr {{\n");
-  result_ += std::format("{:.>{}}Value: {}\n", "", indent_, e->value);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void AstPrettyfier::resumeCallExpr(const CallExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step == 0) {
+    write("CallExpr {\n");
+    field("Callable");
+    return visit(e->callable);
+  }
+  if (step == 1) {
+    field("Arguments");
+    write("[\n");
+  }
+  if (listItem(e->args, step - 1)) {
+    return;
+  }
+  close();
+  finish();
 }
 
-void AstPrettyfier::visitFloatExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeArrayExpr(const ArrayExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step == 0) {
+    write("ArrayExpr {\n");
+    field("Elements");
+    write("[\n");
+  }
+  if (listItem(e->elements, step)) {
+    return;
+  }
+  close();
+  finish();
+}
 
-  const auto* e = static_cast<const FloatExpr*>(n);
-  result_ += std::format("FloatExpr {{\n");
-  result_ += std::format("{:.>{}}Value: {}\n", "", indent_, e->value);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void AstPrettyfier::resumeAssignExpr(const AssignExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      write("AssignExpr {\n");
+      field("Lhs");
+      return visit(e->lhs);
+    case 1:
+      field("Rhs");
+      return visit(e->rhs);
+    default:
+      close();
+      return finish();
+  }
 }
 
-void AstPrettyfier::visitStrExpr(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeIndexExpr(const IndexExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      write("IndexExpr {\n");
+      field("Lhs");
+      return visit(e->lhs);
+    case 1:
+      field("Idx");
+      return visit(e->idx);
+    default:
+      close();
+      return finish();
+  }
+}
 
-  const auto* e = static_cast<const StrExpr*>(n);
-  result_ += std::format("StrExpr {{\n");
-  result_ += std::format("{:.>{}}Value: '{}'\n", "", indent_, e->value);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+// Two steps per pair, the key and the value, each pair in braces one level deeper than the list.
+void AstPrettyfier::resumeHashMapExpr(const HashMapExpr* e, Frame& f) {
+  auto step = f.step++;
+  auto i = step / 2;
+  if (step == 0) {
+    write("HashMapExpr {\n");
+    field("Pairs");
+    write("[\n");
+  }
+  if (step % 2 == 1) {
+    field("Val", indent_ + 2);
+    return visit(e->pairs[i].second, indent_ + 3);
+  }
+  if (i > 0) {
+    pad(indent_ + 1);
+    write("}\n");
+  }
+  if (i < e->pairs.size()) {
+    pad(indent_ + 1);
+    write("{\n");
+    field("Key", indent_ + 2);
+    return visit(e->pairs[i].first, indent_ + 3);
+  }
+  pad(indent_);
+  write("]\n");
+  close();
+  finish();
 }
 
-void AstPrettyfier::visitStmt(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeIdentifierExpr(const IdentifierExpr* e, Frame&) {
+  write("IdentifierExpr {\n");
+  field("Value");
+  write(e->identifier);
+  write("\n");
+  close();
+  finish();
+}
 
-  const auto* e = static_cast<const Stmt*>(n);
-  // TODO: impl me
+void AstPrettyfier::resumeNullExpr(const NullExpr*, Frame&) {
+  write("NullExpr {}\n");
+  finish();
 }
 
-void AstPrettyfier::visitLetStmt(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeBoolExpr(const BoolExpr* e, Frame&) {
+  write("BoolExpr {\n");
+  field("Value");
+  sink_.writeBool(e->value);
+  write("\n");
+  close();
+  finish();
+}
 
-  const auto* s = static_cast<const LetStmt*>(n);
-  result_ += std::format("LetStmt {{\n");
-  result_ += std::format("{:.>{}}Identifier: ", "", indent_);
-  visit(s->identifier);
-  result_ += std::format("{:.>{}}Expr: ", "", indent_);
-  visit(s->rhs);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void AstPrettyfier::resumeIntegerExpr(const IntegerExpr* e, Frame&) {
+  write("IntegerExpr {\n");
+  field("Value");
+  sink_.writeInt(e->value);
+  write("\n");
+  close();
+  finish();
 }
 
-void AstPrettyfier::visitRetStmt(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeFloatExpr(const FloatExpr* e, Frame&) {
+  write("FloatExpr {\n");
+  field("Value");
+  sink_.writeFloat(e->value);
+  write("\n");
+  close();
+  finish();
+}
 
-  const auto* s = static_cast<const RetStmt*>(n);
-  result_ += std::format("RetStmt {{\n");
-  result_ += std::format("{:.>{}}Expr: ", "", indent_);
-  visit(s->expr);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void AstPrettyfier::resumeStrExpr(const StrExpr* e, Frame&) {
+  write("StrExpr {\n");
+  field("Value");
+  write("'");
+  write(e->value);
+  write("'\n");
+  close();
+  finish();
 }
 
-void AstPrettyfier::visitExprStmt(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeLetStmt(const LetStmt* s, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      write("LetStmt {\n");
+      field("Identifier");
+      return visit(s->identifier);
+    case 1:
+      field("Expr");
+      return visit(s->rhs);
+    default:
+      close();
+      return finish();
+  }
+}
 
-  const auto* s = static_cast<const ExprStmt*>(n);
-  result_ += std::format("ExprStmt {{\n");
-  result_ += std::format("{:.>{}}", "", indent_);
-  visit(s->expr);
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+void AstPrettyfier::resumeRetStmt(const RetStmt* s, Frame& f) {
+  if (f.step++ == 0) {
+    write("RetStmt {\n");
+    field("Expr");
+    return visit(s->expr);
+  }
+  close();
+  finish();
 }
 
-void AstPrettyfier::visitBlockStmt(const AstNode* n) {
-  ASSERT_NO_NULLPTR(n);
+void AstPrettyfier::resumeExprStmt(const ExprStmt* s, Frame& f) {
+  if (f.step++ == 0) {
+    write("ExprStmt {\n");
+    pad(indent_);
+    return visit(s->expr);
+  }
+  close();
+  finish();
+}
 
-  const auto* s = static_cast<const BlockStmt*>(n);
-  result_ += std::format("BlockStmt {{\n");
-  if (s->body.size() > 0) {
-    result_ += std::format("{:.>{}}Body: [\n", "", indent_);
-    for (auto* stmt : s->body) {
-      indent_++;
-      result_ += std::format("{:.>{}}", "", indent_);
-      visit(stmt);
-      indent_--;
-    }
-    result_ += std::format("{:.>{}}]\n", "", indent_);
-  } else {
-    result_ += std::format("{:.>{}}Body: []\n", "", indent_);
+void AstPrettyfier::resumeBlockStmt(const BlockStmt* s, Frame& f) {
+  auto step = f.step++;
+  auto n = s->body.size();
+  if (step == 0) {
+    write("BlockStmt {\n");
+    field("Body");
+    write(n > 0 ? "[\n" : "[]\n");
+  }
+  if (n > 0 && listItem(s->body, step)) {
+    return;
   }
-  result_ += std::format("{:.>{}}}}\n", "", indent_ - 1);
+  close();
+  finish();
 }
 
 }  // namespace tmonkey
\ No newline at end of file
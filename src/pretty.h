@@ -1,46 +1,180 @@
 #pragma once
 
+#include <cstdio>
 #include "ast.h"
 #include "common.h"
 
 namespace tmonkey {
 
-class AstPrettyfier {
+// Collects printer output in a fixed buffer and hands it to a file descriptor, a FILE* or a string
+// whenever the buffer fills up and on flush(). Numbers are formatted in place, so printing doesn't
+// allocate unless the target is a string.
+class PrettySink {
 public:
-  static auto prettify(const AstNode* n) -> std::string {
-    ASSERT_NO_NULLPTR(n);
+  static constexpr size_t kBufferSize = 64 * 1024;
 
-    AstPrettyfier p;
-    p.visit(n);
-    return p.result_;
+  explicit PrettySink(int fd);
+  explicit PrettySink(FILE* file);
+  explicit PrettySink(std::string& out);
+
+  NO_COPYABLE(PrettySink)
+  NO_MOVABLE(PrettySink)
+
+  ~PrettySink() {
+    flush();
+  }
+
+  void write(std::string_view s) {
+    if (s.size() > kBufferSize - used_) {
+      writeSlow(s);
+      return;
+    }
+    memcpy(buf_.get() + used_, s.data(), s.size());
+    used_ += s.size();
   }
 
-  static auto prettify(const std::vector<AstNode*> tree) -> std::string {
-    AstPrettyfier p;
-    p.result_ += std::format("Ast {{\n");
-    p.indent_++;
-    for (auto* node : tree) {
-      p.result_ += std::format("{:.>{}}", "", p.indent_);
-      p.visit(node);
+  void put(char c) {
+    if (used_ == kBufferSize) {
+      flush();
     }
-    p.indent_--;
-    p.result_ += std::format("}}\n");
-    return p.result_;
+    buf_[used_++] = c;
   }
 
+  // Writes `n` copies of `c`; the printers indent with dots.
+  void pad(char c, size_t n);
+
+  void writeInt(int64_t v);
+  void writeFloat(double v);
+  void writeBool(bool v) {
+    write(v ? "true" : "false");
+  }
+
+  // Hands the buffered bytes on. Returns false if writing to the target failed, with errno set;
+  // later writes are dropped.
+  auto flush() -> bool;
+
+private:
+  using Drain = bool (*)(void* target, const char* data, size_t size);
+
+  PrettySink(Drain drain, void* target);
+
+  void writeSlow(std::string_view s);
+
+  Drain drain_;
+  void* target_;
+  std::unique_ptr<char[]> buf_;
+  size_t used_ = 0;
+  bool failed_ = false;
+};
+
+enum class PrettyFormat {
+  // Indented, one field per line.
+  kText,
+  // One compact JSON value; every node is an object with a "kind" member.
+  kJson,
+  // One form per node, `(Kind :field value ...)`, and one line per top-level statement.
+  kSexpr,
+};
+
+class AstPrettyfier : public AstWalker<AstPrettyfier> {
+public:
+  static auto prettify(const AstNode* n, PrettyFormat format = PrettyFormat::kText)
+      -> std::string;
+  static auto prettify(
+      const std::vector<AstNode*>& tree, PrettyFormat format = PrettyFormat::kText)
+      -> std::string;
+
+  // Streams the tree to `sink` without building it in memory first.
+  static void print(
+      const std::vector<AstNode*>& tree, PrettySink& sink,
+      PrettyFormat format = PrettyFormat::kText);
+
 private:
+  friend class AstWalker<AstPrettyfier>;
+
+  struct Frame {
+    const AstNode* node;
+    size_t step;
+    // The indentation of the node's fields.
+    int indent;
+  };
+
+  explicit AstPrettyfier(PrettySink& sink) : sink_{sink} {}
+
+  // Prints `n` with its fields indented by `indent`, one deeper than the field it is in by default.
+  void visit(const AstNode* n, int indent) {
+    descend(Frame{n, 0, indent});
+  }
+
   void visit(const AstNode* n) {
-    ASSERT_NO_NULLPTR(n);
+    visit(n, indent_ + 1);
+  }
 
-    indent_++;
-    AST_NODE_SWITCH(AST_GEN_VISIT_NODE_SWITCH_CASE)
-    indent_--;
+  // Prints element `i` of a list, or closes the list and returns false past its end.
+  template <typename T>
+  auto listItem(std::span<T*> nodes, size_t i) -> bool {
+    if (i < nodes.size()) {
+      pad(indent_ + 1);
+      visit(nodes[i], indent_ + 2);
+      return true;
+    }
+    pad(indent_);
+    write("]\n");
+    return false;
   }
 
-  AST_NODE_LIST(GEN_AST_VISITORS)
+  void resume(Frame& f) {
+    indent_ = f.indent;
+    AstWalker::resume(f);
+  }
+
+  void resumeInfixExpr(const InfixExpr* e, Frame& f);
+  void resumePrefixExpr(const PrefixExpr* e, Frame& f);
+  void resumeIfExpr(const IfExpr* e, Frame& f);
+  void resumeWhileExpr(const WhileExpr* e, Frame& f);
+  void resumeFnExpr(const FnExpr* e, Frame& f);
+  void resumeCallExpr(const CallExpr* e, Frame& f);
+  void resumeArrayExpr(const ArrayExpr* e, Frame& f);
+  void resumeAssignExpr(const AssignExpr* e, Frame& f);
+  void resumeIndexExpr(const IndexExpr* e, Frame& f);
+  void resumeHashMapExpr(const HashMapExpr* e, Frame& f);
+  void resumeIdentifierExpr(const IdentifierExpr* e, Frame& f);
+  void resumeNullExpr(const NullExpr* e, Frame& f);
+  void resumeBoolExpr(const BoolExpr* e, Frame& f);
+  void resumeIntegerExpr(const IntegerExpr* e, Frame& f);
+  void resumeFloatExpr(const FloatExpr* e, Frame& f);
+  void resumeStrExpr(const StrExpr* e, Frame& f);
+  void resumeLetStmt(const LetStmt* s, Frame& f);
+  void resumeRetStmt(const RetStmt* s, Frame& f);
+  void resumeExprStmt(const ExprStmt* s, Frame& f);
+  void resumeBlockStmt(const BlockStmt* s, Frame& f);
+
+  void write(std::string_view s) {
+    sink_.write(s);
+  }
+
+  void pad(int n) {
+    sink_.pad('.', n > 0 ? static_cast<size_t>(n) : 0);
+  }
+
+  void field(std::string_view name, int indent) {
+    pad(indent);
+    write(name);
+    write(": ");
+  }
+
+  void field(std::string_view name) {
+    field(name, indent_);
+  }
+
+  void close() {
+    pad(indent_ - 1);
+    write("}\n");
+  }
 
+  PrettySink& sink_;
+  std::deque<Frame> frames_;
   int indent_ = 0;
-  std::string result_;
 };
 
 }  // namespace tmonkey
\ No newline at end of file
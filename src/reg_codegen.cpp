@@ -0,0 +1,699 @@
+#include "reg_codegen.h"
+
+namespace tmonkey {
+
+namespace {
+
+// Names used anywhere inside a function, parameters and lets included.
+struct CapturePass {
+  std::unordered_set<std::string_view>& names;
+  int depth = 0;
+
+  void enterFnExpr(const FnExpr*) {
+    depth++;
+  }
+
+  void leaveFnExpr(const FnExpr*) {
+    depth--;
+  }
+
+  void enterIdentifierExpr(const IdentifierExpr* e) {
+    if (depth > 0) {
+      names.insert(e->identifier);
+    }
+  }
+};
+
+// Let names outside nested functions, in source order.
+struct LetPass {
+  std::vector<std::string_view>& names;
+  int depth = 0;
+
+  void enterFnExpr(const FnExpr*) {
+    depth++;
+  }
+
+  void leaveFnExpr(const FnExpr*) {
+    depth--;
+  }
+
+  void enterLetStmt(const LetStmt* s) {
+    if (depth == 0) {
+      names.push_back(s->identifier->identifier);
+    }
+  }
+};
+
+// Whether running `n` may assign to a local of the function it is in.
+auto mayStore(const AstNode* n) -> bool {
+  struct StorePass {
+    bool found = false;
+    int depth = 0;
+
+    void enterFnExpr(const FnExpr*) {
+      depth++;
+    }
+
+    void leaveFnExpr(const FnExpr*) {
+      depth--;
+    }
+
+    void enterAssignExpr(const AssignExpr*) {
+      found |= depth == 0;
+    }
+
+    void enterLetStmt(const LetStmt*) {
+      found |= depth == 0;
+    }
+  };
+
+  switch (n->kind()) {
+    case AstNode::Kind::kIdentifierExpr:
+    case AstNode::Kind::kNullExpr:
+    case AstNode::Kind::kBoolExpr:
+    case AstNode::Kind::kIntegerExpr:
+    case AstNode::Kind::kFloatExpr:
+    case AstNode::Kind::kStrExpr:
+    case AstNode::Kind::kFnExpr:
+      return false;
+    default:
+      break;
+  }
+  StorePass pass;
+  AstPasses<StorePass>(pass).run(n);
+  return pass.found;
+}
+
+}  // namespace
+
+#define LOG_CODEGEN_ERR(msg) logError(std::format("codegen error: {}", (msg)))
+
+auto RegCodegen::compile(const std::vector<AstNode*>& tree, std::vector<std::string>* errors)
+    -> std::optional<Program> {
+  RegCodegen gen;
+  gen.program_.functions.push_back({.name = "<main>"});
+  gen.scopes_.push_back({.function = 0});
+
+  CapturePass captures{gen.captured_};
+  AstPasses<CapturePass>(captures).run(tree);
+  for (const auto* n : tree) {
+    gen.reserveLets(n);
+  }
+  // Top-level lets are visible from the start, like Codegen's globals.
+  for (const auto* n : tree) {
+    if (n->kind() == AstNode::Kind::kLetStmt) {
+      gen.define(static_cast<const LetStmt*>(n)->identifier->identifier);
+    }
+  }
+
+  for (const auto* n : tree) {
+    gen.walk(Frame{.node = n});
+  }
+  auto r = gen.alloc();
+  gen.emit(RegOpcode::kLoadNull, {r});
+  gen.emit(RegOpcode::kReturn, {r});
+  gen.program_.functions[0].locals = gen.scopes_[0].maxTop;
+
+  if (errors) {
+    *errors = gen.errors_;
+  }
+  if (!gen.errors_.empty()) {
+    return std::nullopt;
+  }
+  return std::move(gen.program_);
+}
+
+void RegCodegen::resumeInfixExpr(const InfixExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      f.saved = top();
+      f.b = operand(e->lhs, {e->rhs});
+      return;
+    case 1: {
+      // A literal right operand is read from the constants, so it needs no LoadK.
+      auto k = constant(e->rhs);
+      f.constant = k.has_value();
+      f.c = k ? *k : exprAny(e->rhs);
+      return;
+    }
+    default:
+      break;
+  }
+  release(f.saved);
+
+  auto binary = [&](RegOpcode op, RegOpcode opK) {
+    emit(f.constant ? opK : op, {f.dst, f.b, f.c});
+  };
+  switch (e->op.kind()) {
+    case Token::kPlus:
+      binary(RegOpcode::kAdd, RegOpcode::kAddK);
+      break;
+    case Token::kMinus:
+      binary(RegOpcode::kSub, RegOpcode::kSubK);
+      break;
+    case Token::kStar:
+      binary(RegOpcode::kMul, RegOpcode::kMulK);
+      break;
+    case Token::kSlash:
+      binary(RegOpcode::kDiv, RegOpcode::kDivK);
+      break;
+    case Token::kEqEq:
+      binary(RegOpcode::kEq, RegOpcode::kEqK);
+      break;
+    case Token::kNotEq:
+      binary(RegOpcode::kNotEq, RegOpcode::kNotEqK);
+      break;
+    case Token::kLt:
+      binary(RegOpcode::kLt, RegOpcode::kLtK);
+      break;
+    case Token::kLtEq:
+      binary(RegOpcode::kLtEq, RegOpcode::kLtEqK);
+      break;
+    case Token::kGt:
+      binary(RegOpcode::kGt, RegOpcode::kGtK);
+      break;
+    case Token::kGtEq:
+      binary(RegOpcode::kGtEq, RegOpcode::kGtEqK);
+      break;
+    default:
+      LOG_CODEGEN_ERR(std::format("unknown operator {}", tokenKindStringify(e->op.kind())));
+  }
+  finish();
+}
+
+void RegCodegen::resumePrefixExpr(const PrefixExpr* e, Frame& f) {
+  if (f.step++ == 0) {
+    f.saved = top();
+    f.b = exprAny(e->rhs);
+    return;
+  }
+  release(f.saved);
+
+  switch (e->op.kind()) {
+    case Token::kMinus:
+      emit(RegOpcode::kNeg, {f.dst, f.b});
+      break;
+    case Token::kBang:
+      emit(RegOpcode::kNot, {f.dst, f.b});
+      break;
+    default:
+      LOG_CODEGEN_ERR(std::format("unknown operator {}", tokenKindStringify(e->op.kind())));
+  }
+  finish();
+}
+
+void RegCodegen::resumeIfExpr(const IfExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      f.saved = top();
+      f.c = exprAny(e->cnd);
+      return;
+    case 1:
+      release(f.saved);
+      f.jump = emitJump(RegOpcode::kJumpIfFalse, {f.c});
+      // An if whose value is unused runs its blocks as statements, and skips the else without one.
+      if (f.dst == kNone) {
+        return visit(e->coseq);
+      }
+      return blockValue(e->coseq, f.dst);
+    case 2: {
+      if (f.dst == kNone && !e->alt) {
+        break;
+      }
+      auto toEnd = emitJump(RegOpcode::kJump);
+      patchJump(f.jump, code().size());
+      f.jump = toEnd;
+      if (f.dst == kNone) {
+        return visit(*e->alt);
+      }
+      if (e->alt) {
+        return blockValue(*e->alt, f.dst);
+      }
+      emit(RegOpcode::kLoadNull, {f.dst});
+      break;
+    }
+    default:
+      break;
+  }
+  patchJump(f.jump, code().size());
+  finish();
+}
+
+void RegCodegen::resumeWhileExpr(const WhileExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      f.start = code().size();
+      f.saved = top();
+      f.c = exprAny(e->cnd);
+      return;
+    case 1:
+      release(f.saved);
+      f.jump = emitJump(RegOpcode::kJumpIfFalse, {f.c});
+      return visit(e->coseq);
+    default:
+      break;
+  }
+  patchJump(emitJump(RegOpcode::kJump), f.start);
+  patchJump(f.jump, code().size());
+  if (f.dst != kNone) {
+    emit(RegOpcode::kLoadNull, {f.dst});
+  }
+  finish();
+}
+
+void RegCodegen::resumeImportExpr(const ImportExpr*, Frame&) {
+  LOG_CODEGEN_ERR("import is not supported");
+  finish();
+}
+
+void RegCodegen::resumeFnExpr(const FnExpr* e, Frame& f) {
+  auto params = static_cast<uint32_t>(e->params.size());
+  if (f.step++ == 0) {
+    auto index = static_cast<uint32_t>(program_.functions.size());
+    program_.functions.push_back({.name = std::string(f.name)});
+    scopes_.push_back({.function = index});
+    scopes_.back().self = f.name;
+
+    for (uint32_t i = 0; i < params; i++) {
+      const auto* param = e->params[i];
+      if (param->kind() != AstNode::Kind::kIdentifierExpr) {
+        LOG_CODEGEN_ERR(
+            std::format("expected identifier as parameter but got {}", param->stringify()));
+        continue;
+      }
+      auto paramName = static_cast<const IdentifierExpr*>(param)->identifier;
+      scopes_.back().slots.try_emplace(paramName, i);
+      scopes_.back().locals.try_emplace(paramName, i);
+    }
+    // Parameters sharing a name still take a register each.
+    scopes_.back().base = params;
+    reserveLets(e->body);
+
+    f.a = alloc();
+    return blockValue(e->body, f.a);
+  }
+  emit(RegOpcode::kReturn, {f.a});
+
+  auto state = std::move(scopes_.back());
+  scopes_.pop_back();
+  auto& fn = program_.functions[state.function];
+  fn.params = params;
+  fn.locals = state.maxTop;
+
+  auto saved = top();
+  auto first = top();
+  for (auto b : state.frees) {
+    load(b, alloc());
+  }
+  emit(
+      RegOpcode::kClosure,
+      {f.dst, state.function, first, static_cast<uint32_t>(state.frees.size())});
+  release(saved);
+  finish();
+}
+
+void RegCodegen::resumeCallExpr(const CallExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step == 0) {
+    f.saved = top();
+    // A call into the newest temporary puts its callee there, so the result needs no Move.
+    auto& state = scopes_.back();
+    f.a = f.dst >= state.base && f.dst + 1 == state.top ? f.dst : alloc();
+    return exprTo(e->callable, f.a);
+  }
+  if (step <= e->args.size()) {
+    return exprTo(e->args[step - 1], alloc());
+  }
+  emit(RegOpcode::kCall, {f.a, static_cast<uint32_t>(e->args.size())});
+  if (f.a != f.dst) {
+    emit(RegOpcode::kMove, {f.dst, f.a});
+  }
+  release(f.saved);
+  finish();
+}
+
+// The elements go to consecutive temporaries from f.saved up.
+void RegCodegen::resumeArrayExpr(const ArrayExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step == 0) {
+    f.saved = top();
+  }
+  if (step < e->elements.size()) {
+    return exprTo(e->elements[step], alloc());
+  }
+  emit(RegOpcode::kArray, {f.dst, f.saved, static_cast<uint32_t>(e->elements.size())});
+  release(f.saved);
+  finish();
+}
+
+void RegCodegen::resumeAssignExpr(const AssignExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (e->lhs->kind() == AstNode::Kind::kIndexExpr) {
+    const auto* target = static_cast<const IndexExpr*>(e->lhs);
+    switch (step) {
+      case 0:
+        f.saved = top();
+        f.a = operand(target->lhs, {target->idx, e->rhs});
+        return;
+      case 1:
+        f.b = operand(target->idx, {e->rhs});
+        return;
+      case 2:
+        f.c = exprAny(e->rhs);
+        return;
+      default:
+        break;
+    }
+    emit(RegOpcode::kSetIndex, {f.a, f.b, f.c});
+    if (f.dst != kNone && f.dst != f.c) {
+      emit(RegOpcode::kMove, {f.dst, f.c});
+    }
+    release(f.saved);
+    return finish();
+  }
+
+  auto name = static_cast<const IdentifierExpr*>(e->lhs)->identifier;
+  if (step == 0) {
+    f.saved = top();
+    auto b = resolve(name);
+    if (!b) {
+      LOG_CODEGEN_ERR(std::format("undefined variable {}", name));
+      return finish();
+    }
+    f.binding = *b;
+    switch (b->scope) {
+      case Scope::kRegister:
+        return exprTo(e->rhs, b->index);
+      case Scope::kGlobal:
+      case Scope::kFree:
+        f.a = f.dst != kNone ? f.dst : alloc();
+        return exprTo(e->rhs, f.a);
+      case Scope::kBuiltin:
+      case Scope::kCurrentClosure:
+        LOG_CODEGEN_ERR(std::format("can't assign to {}", name));
+        release(f.saved);
+        return finish();
+    }
+  }
+
+  auto b = f.binding;
+  if (b.scope == Scope::kRegister) {
+    if (f.dst != kNone && f.dst != b.index) {
+      emit(RegOpcode::kMove, {f.dst, b.index});
+    }
+  } else {
+    emit(b.scope == Scope::kGlobal ? RegOpcode::kSetGlobal : RegOpcode::kSetFree, {b.index, f.a});
+  }
+  release(f.saved);
+  finish();
+}
+
+void RegCodegen::resumeIndexExpr(const IndexExpr* e, Frame& f) {
+  switch (f.step++) {
+    case 0:
+      f.saved = top();
+      f.b = operand(e->lhs, {e->idx});
+      return;
+    case 1:
+      f.c = exprAny(e->idx);
+      return;
+    default:
+      break;
+  }
+  release(f.saved);
+  emit(RegOpcode::kIndex, {f.dst, f.b, f.c});
+  finish();
+}
+
+// Keys and values go to consecutive temporaries from f.saved up.
+void RegCodegen::resumeHashMapExpr(const HashMapExpr* e, Frame& f) {
+  auto step = f.step++;
+  if (step == 0) {
+    f.saved = top();
+  }
+  if (step < 2 * e->pairs.size()) {
+    const auto& [key, val] = e->pairs[step / 2];
+    return exprTo(step % 2 == 0 ? key : val, alloc());
+  }
+  emit(RegOpcode::kHashMap, {f.dst, f.saved, static_cast<uint32_t>(e->pairs.size())});
+  release(f.saved);
+  finish();
+}
+
+void RegCodegen::resumeIdentifierExpr(const IdentifierExpr* e, Frame& f) {
+  auto b = resolve(e->identifier);
+  if (!b) {
+    LOG_CODEGEN_ERR(std::format("undefined variable {}", e->identifier));
+    return finish();
+  }
+  load(*b, f.dst);
+  finish();
+}
+
+void RegCodegen::resumeNullExpr(const NullExpr*, Frame& f) {
+  emit(RegOpcode::kLoadNull, {f.dst});
+  finish();
+}
+
+void RegCodegen::resumeBoolExpr(const BoolExpr* e, Frame& f) {
+  emit(e->value ? RegOpcode::kLoadTrue : RegOpcode::kLoadFalse, {f.dst});
+  finish();
+}
+
+void RegCodegen::resumeIntegerExpr(const IntegerExpr* e, Frame& f) {
+  emit(RegOpcode::kLoadK, {f.dst, constants_.integer(e->value)});
+  finish();
+}
+
+void RegCodegen::resumeFloatExpr(const FloatExpr* e, Frame& f) {
+  emit(RegOpcode::kLoadK, {f.dst, constants_.number(e->value)});
+  finish();
+}
+
+void RegCodegen::resumeStrExpr(const StrExpr* e, Frame& f) {
+  emit(RegOpcode::kLoadK, {f.dst, constants_.string(e->value)});
+  finish();
+}
+
+void RegCodegen::resumeLetStmt(const LetStmt* s, Frame& f) {
+  auto name = s->identifier->identifier;
+  if (f.step++ == 0) {
+    f.saved = top();
+    const auto& slots = scopes_.back().slots;
+    auto slot = slots.find(name);
+    f.a = slot != slots.end() ? slot->second : alloc();
+
+    if (s->rhs->kind() == AstNode::Kind::kFnExpr) {
+      return compileFunction(static_cast<const FnExpr*>(s->rhs), name, f.a);
+    }
+    return exprTo(s->rhs, f.a);
+  }
+
+  auto b = define(name);
+  if (b.scope == Scope::kGlobal) {
+    emit(RegOpcode::kSetGlobal, {b.index, f.a});
+  }
+  release(f.saved);
+  finish();
+}
+
+void RegCodegen::resumeRetStmt(const RetStmt* s, Frame& f) {
+  if (f.step++ == 0) {
+    f.saved = top();
+    f.a = exprAny(s->expr);
+    return;
+  }
+  emit(RegOpcode::kReturn, {f.a});
+  release(f.saved);
+  finish();
+}
+
+void RegCodegen::resumeExprStmt(const ExprStmt* s, Frame& f) {
+  if (f.step++ == 0) {
+    f.saved = top();
+    // Assignments, ifs and whiles need no register for a value nothing reads.
+    switch (s->expr->kind()) {
+      case AstNode::Kind::kAssignExpr:
+      case AstNode::Kind::kIfExpr:
+      case AstNode::Kind::kWhileExpr:
+        return exprTo(s->expr, kNone);
+      default:
+        return exprTo(s->expr, alloc());
+    }
+  }
+  release(f.saved);
+  finish();
+}
+
+void RegCodegen::resumeBlockStmt(const BlockStmt* s, Frame& f) {
+  auto step = f.step++;
+  const auto& body = s->body;
+  if (!f.value) {
+    if (step < body.size()) {
+      return visit(body[step]);
+    }
+    return finish();
+  }
+
+  if (step < body.size()) {
+    const auto* stmt = body[step];
+    if (step + 1 == body.size() && stmt->kind() == AstNode::Kind::kExprStmt) {
+      f.saved = top();
+      return exprTo(static_cast<const ExprStmt*>(stmt)->expr, f.dst);
+    }
+    return visit(stmt);
+  }
+  if (body.empty() || body.back()->kind() != AstNode::Kind::kExprStmt) {
+    emit(RegOpcode::kLoadNull, {f.dst});
+  } else {
+    release(f.saved);
+  }
+  finish();
+}
+
+auto RegCodegen::constant(const AstNode* n) -> std::optional<uint32_t> {
+  switch (n->kind()) {
+    case AstNode::Kind::kIntegerExpr:
+      return constants_.integer(static_cast<const IntegerExpr*>(n)->value);
+    case AstNode::Kind::kFloatExpr:
+      return constants_.number(static_cast<const FloatExpr*>(n)->value);
+    case AstNode::Kind::kStrExpr:
+      return constants_.string(static_cast<const StrExpr*>(n)->value);
+    default:
+      return std::nullopt;
+  }
+}
+
+auto RegCodegen::exprAny(const AstNode* n) -> uint32_t {
+  if (n->kind() == AstNode::Kind::kIdentifierExpr) {
+    auto b = resolve(static_cast<const IdentifierExpr*>(n)->identifier);
+    if (b && b->scope == Scope::kRegister) {
+      return b->index;
+    }
+  }
+  auto r = alloc();
+  exprTo(n, r);
+  return r;
+}
+
+auto RegCodegen::operand(const AstNode* n, std::initializer_list<const AstNode*> later)
+    -> uint32_t {
+  if (std::any_of(later.begin(), later.end(), mayStore)) {
+    auto r = alloc();
+    exprTo(n, r);
+    return r;
+  }
+  return exprAny(n);
+}
+
+void RegCodegen::reserveLets(const AstNode* body) {
+  std::vector<std::string_view> names;
+  LetPass pass{names};
+  AstPasses<LetPass>(pass).run(body);
+
+  auto& state = scopes_.back();
+  for (auto name : names) {
+    if (scopes_.size() == 1 && captured_.contains(name)) {
+      continue;
+    }
+    if (state.slots.try_emplace(name, state.base).second) {
+      state.base++;
+    }
+  }
+  state.top = state.base;
+  state.maxTop = std::max(state.maxTop, state.base);
+}
+
+auto RegCodegen::resolve(std::string_view name) -> std::optional<Binding> {
+  return resolveIn(scopes_.size() - 1, name);
+}
+
+auto RegCodegen::resolveIn(size_t depth, std::string_view name) -> std::optional<Binding> {
+  auto& state = scopes_[depth];
+  if (auto it = state.locals.find(name); it != state.locals.end()) {
+    return Binding{Scope::kRegister, it->second};
+  }
+
+  if (depth == 0) {
+    if (auto it = globals_.find(name); it != globals_.end()) {
+      return Binding{Scope::kGlobal, it->second};
+    }
+    if (auto builtin = builtinLookup(name)) {
+      return Binding{Scope::kBuiltin, *builtin};
+    }
+    return std::nullopt;
+  }
+
+  if (auto it = state.freeIndex.find(name); it != state.freeIndex.end()) {
+    return Binding{Scope::kFree, it->second};
+  }
+  if (!state.self.empty() && state.self == name) {
+    return Binding{Scope::kCurrentClosure, 0};
+  }
+
+  auto outer = resolveIn(depth - 1, name);
+  if (!outer || outer->scope == Scope::kGlobal || outer->scope == Scope::kBuiltin) {
+    return outer;
+  }
+  auto index = static_cast<uint32_t>(state.frees.size());
+  state.frees.push_back(*outer);
+  state.freeIndex.emplace(name, index);
+  return Binding{Scope::kFree, index};
+}
+
+auto RegCodegen::define(std::string_view name) -> Binding {
+  auto& state = scopes_.back();
+  if (auto it = state.slots.find(name); it != state.slots.end()) {
+    state.locals.insert_or_assign(name, it->second);
+    return {Scope::kRegister, it->second};
+  }
+  auto [it, fresh] = globals_.try_emplace(name, static_cast<uint32_t>(globals_.size()));
+  if (fresh) {
+    program_.globals.emplace_back(name);
+  }
+  return {Scope::kGlobal, it->second};
+}
+
+void RegCodegen::load(Binding b, uint32_t dst) {
+  switch (b.scope) {
+    case Scope::kGlobal:
+      emit(RegOpcode::kGetGlobal, {dst, b.index});
+      break;
+    case Scope::kRegister:
+      if (b.index != dst) {
+        emit(RegOpcode::kMove, {dst, b.index});
+      }
+      break;
+    case Scope::kFree:
+      emit(RegOpcode::kGetFree, {dst, b.index});
+      break;
+    case Scope::kBuiltin:
+      emit(RegOpcode::kGetBuiltin, {dst, b.index});
+      break;
+    case Scope::kCurrentClosure:
+      emit(RegOpcode::kCurrentClosure, {dst});
+      break;
+  }
+}
+
+void RegCodegen::emit(RegOpcode op, std::initializer_list<uint32_t> operands) {
+  auto& c = code();
+  c.push_back(static_cast<uint8_t>(op));
+  for (auto v : operands) {
+    writeOperand(c, v);
+  }
+}
+
+auto RegCodegen::emitJump(RegOpcode op, std::initializer_list<uint32_t> operands) -> size_t {
+  emit(op, operands);
+  auto at = code().size();
+  code().resize(at + kJumpTargetBytes);
+  return at;
+}
+
+void RegCodegen::patchJump(size_t at, size_t target) {
+  auto v = static_cast<uint32_t>(target);
+  memcpy(code().data() + at, &v, sizeof(v));
+}
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <unordered_set>
+#include "ast.h"
+#include "bytecode.h"
+#include "common.h"
+
+namespace tmonkey {
+
+// Lowers a tree to register bytecode, with the same scoping as Codegen. Every let of a function
+// gets its own register, as do top-level lets whose name appears in no function; the others stay
+// globals. Temporaries are taken above the lets in stack order and released after each statement.
+// An expression is compiled straight into the register that wants its value, a local used as an
+// operand is read in place and a literal right operand is read from the constants, so `i = i + 1`
+// is one AddK.
+class RegCodegen : public AstWalker<RegCodegen> {
+public:
+  // Nullopt if the tree can't be compiled; `errors` then says why.
+  static auto compile(
+      const std::vector<AstNode*>& tree, std::vector<std::string>* errors = nullptr)
+      -> std::optional<Program>;
+
+private:
+  friend class AstWalker<RegCodegen>;
+
+  enum class Scope : uint8_t {
+    kGlobal,
+    kRegister,
+    kFree,
+    kBuiltin,
+    kCurrentClosure,
+  };
+
+  struct Binding {
+    Scope scope;
+    uint32_t index;
+  };
+
+  struct FunctionState {
+    uint32_t function = 0;
+    // Registers of the function's lets, and the ones visible so far.
+    std::unordered_map<std::string_view, uint32_t> slots{};
+    std::unordered_map<std::string_view, uint32_t> locals{};
+    std::vector<Binding> frees{};
+    std::unordered_map<std::string_view, uint32_t> freeIndex{};
+    std::string_view self{};
+    // First register above the lets, the first free temporary and the most registers used.
+    uint32_t base = 0;
+    uint32_t top = 0;
+    uint32_t maxTop = 0;
+  };
+
+  struct Frame {
+    const AstNode* node;
+    size_t step = 0;
+    // Register the node's value goes to, or kNone.
+    uint32_t dst = 0;
+    // A block frame puts the value of its last statement in dst.
+    bool value = false;
+    // The let name a function is bound to.
+    std::string_view name{};
+    // The temporaries to release when the node is done, and its operand registers.
+    uint32_t saved = 0;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+    // Whether c is a constant rather than a register.
+    bool constant = false;
+    // Where an if or while patches its jump, and where a while loops back to.
+    size_t jump = 0;
+    size_t start = 0;
+    // The variable an assignment stores to.
+    Binding binding{};
+  };
+
+  RegCodegen() {
+    program_.format = Program::Format::kRegister;
+  }
+
+  // Compiles the statement `n`.
+  void visit(const AstNode* n) {
+    descend(Frame{.node = n});
+  }
+
+  // Compiles `n` so that its value ends up in register `dst`.
+  void exprTo(const AstNode* n, uint32_t dst) {
+    descend(Frame{.node = n, .dst = dst});
+  }
+
+  // Compiles `n` and returns the register holding its value: a local in place, else a new
+  // temporary.
+  auto exprAny(const AstNode* n) -> uint32_t;
+  // The constant of `n` if it is an integer, float or string literal.
+  auto constant(const AstNode* n) -> std::optional<uint32_t>;
+  // Like exprAny, but copies a local if one of the operands evaluated after `n` may assign to it.
+  auto operand(const AstNode* n, std::initializer_list<const AstNode*> later) -> uint32_t;
+
+  // Compiles the statements of a block and puts the value of the last one in `dst`.
+  void blockValue(const BlockStmt* s, uint32_t dst) {
+    descend(Frame{.node = s, .dst = dst, .value = true});
+  }
+
+  void compileFunction(const FnExpr* e, std::string_view name, uint32_t dst) {
+    descend(Frame{.node = e, .dst = dst, .name = name});
+  }
+
+  void resumeInfixExpr(const InfixExpr* e, Frame& f);
+  void resumePrefixExpr(const PrefixExpr* e, Frame& f);
+  void resumeIfExpr(const IfExpr* e, Frame& f);
+  void resumeWhileExpr(const WhileExpr* e, Frame& f);
+  void resumeImportExpr(const ImportExpr* e, Frame& f);
+  void resumeFnExpr(const FnExpr* e, Frame& f);
+  void resumeCallExpr(const CallExpr* e, Frame& f);
+  void resumeArrayExpr(const ArrayExpr* e, Frame& f);
+  // Assigns and, unless dst is kNone, copies the value to dst.
+  void resumeAssignExpr(const AssignExpr* e, Frame& f);
+  void resumeIndexExpr(const IndexExpr* e, Frame& f);
+  void resumeHashMapExpr(const HashMapExpr* e, Frame& f);
+  void resumeIdentifierExpr(const IdentifierExpr* e, Frame& f);
+  void resumeNullExpr(const NullExpr* e, Frame& f);
+  void resumeBoolExpr(const BoolExpr* e, Frame& f);
+  void resumeIntegerExpr(const IntegerExpr* e, Frame& f);
+  void resumeFloatExpr(const FloatExpr* e, Frame& f);
+  void resumeStrExpr(const StrExpr* e, Frame& f);
+  void resumeLetStmt(const LetStmt* s, Frame& f);
+  void resumeRetStmt(const RetStmt* s, Frame& f);
+  void resumeExprStmt(const ExprStmt* s, Frame& f);
+  void resumeBlockStmt(const BlockStmt* s, Frame& f);
+
+  // Gives each let of `body` a register after the ones already taken.
+  void reserveLets(const AstNode* body);
+
+  auto resolve(std::string_view name) -> std::optional<Binding>;
+  auto resolveIn(size_t depth, std::string_view name) -> std::optional<Binding>;
+  auto define(std::string_view name) -> Binding;
+  void load(Binding b, uint32_t dst);
+
+  auto code() -> std::vector<uint8_t>& {
+    return program_.functions[scopes_.back().function].code;
+  }
+
+  auto alloc() -> uint32_t {
+    auto& state = scopes_.back();
+    state.maxTop = std::max(state.maxTop, state.top + 1);
+    return state.top++;
+  }
+
+  // Releases the temporaries from `top` up.
+  void release(uint32_t top) {
+    scopes_.back().top = top;
+  }
+
+  auto top() const -> uint32_t {
+    return scopes_.back().top;
+  }
+
+  void emit(RegOpcode op, std::initializer_list<uint32_t> operands = {});
+  // Emits a jump with a target to be patched, and returns where the target goes.
+  auto emitJump(RegOpcode op, std::initializer_list<uint32_t> operands = {}) -> size_t;
+  void patchJump(size_t at, size_t target);
+
+  void logError(std::string msg) {
+    errors_.push_back(std::move(msg));
+  }
+
+  Program program_;
+  ConstantPool constants_{program_};
+  std::vector<FunctionState> scopes_;
+  std::unordered_map<std::string_view, uint32_t> globals_;
+  // Names that appear inside a function; top-level lets of these stay globals.
+  std::unordered_set<std::string_view> captured_;
+  std::deque<Frame> frames_;
+  std::vector<std::string> errors_;
+
+  static constexpr uint32_t kNone = ~0u;
+};
+
+}  // namespace tmonkey
\ No newline at end of file
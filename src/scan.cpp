@@ -0,0 +1,372 @@
+#include "scan.h"
+#include <atomic>
+#include <cstring>
+#include "charclass.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TMONKEY_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace tmonkey {
+
+namespace {
+
+template <typename Pred>
+auto scanScalar(const char* p, const char* end, Pred pred) -> const char* {
+  while (p != end && pred(*p)) {
+    p++;
+  }
+  return p;
+}
+
+auto scanWhitespaceScalar(const char* p, const char* end) -> const char* {
+  return scanScalar(p, end, isSpace);
+}
+
+auto scanIdentifierScalar(const char* p, const char* end) -> const char* {
+  return scanScalar(p, end, isIdentChar);
+}
+
+auto scanDigitsScalar(const char* p, const char* end) -> const char* {
+  return scanScalar(p, end, isDigit);
+}
+
+auto scanStringBodyScalar(const char* p, const char* end) -> const char* {
+  return scanScalar(p, end, [](char c) { return c != '"'; });
+}
+
+auto scanToStructuralScalar(const char* p, const char* end) -> const char* {
+  return scanScalar(p, end, [](char c) { return !isStructural(c); });
+}
+
+void collectLineStartsScalar(const char* begin, const char* end, std::vector<size_t>& out) {
+  for (const char* p = begin; p != end; p++) {
+    p = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (!p) {
+      break;
+    }
+    out.push_back(static_cast<size_t>(p - begin) + 1);
+  }
+}
+
+// Newline collection walks the set bits of a per-block compare mask.
+inline void pushMaskBits(uint32_t mask, size_t base, std::vector<size_t>& out) {
+  while (mask != 0) {
+    out.push_back(base + static_cast<size_t>(__builtin_ctz(mask)) + 1);
+    mask &= mask - 1;
+  }
+}
+
+#ifdef TMONKEY_SCAN_X86
+
+// SSE4.2: PCMPESTRI classifies 16 bytes against a small set or range list per instruction.
+constexpr int kSseAnyOf = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT;
+constexpr int kSseNoneOf = kSseAnyOf | _SIDD_NEGATIVE_POLARITY;
+constexpr int kSseOutOfRanges =
+    _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT | _SIDD_NEGATIVE_POLARITY;
+
+template <int kMode>
+__attribute__((target("sse4.2"))) auto scanSse42(
+    const char* p, const char* end, const char* set, int setLen) -> const char* {
+  auto needle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(set));
+  while (end - p >= 16) {
+    auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    auto idx = _mm_cmpestri(needle, setLen, block, 16, kMode);
+    if (idx != 16) {
+      return p + idx;
+    }
+    p += 16;
+  }
+  return p;
+}
+
+// The set literals are padded to 16 bytes so the needle load stays in bounds.
+__attribute__((target("sse4.2"))) auto scanWhitespaceSse42(const char* p, const char* end)
+    -> const char* {
+  return scanWhitespaceScalar(scanSse42<kSseNoneOf>(p, end, " \t\n\r            ", 4), end);
+}
+
+__attribute__((target("sse4.2"))) auto scanIdentifierSse42(const char* p, const char* end)
+    -> const char* {
+  return scanIdentifierScalar(scanSse42<kSseOutOfRanges>(p, end, "09AZaz__        ", 8), end);
+}
+
+__attribute__((target("sse4.2"))) auto scanDigitsSse42(const char* p, const char* end)
+    -> const char* {
+  return scanDigitsScalar(scanSse42<kSseOutOfRanges>(p, end, "09              ", 2), end);
+}
+
+__attribute__((target("sse4.2"))) auto scanStringBodySse42(const char* p, const char* end)
+    -> const char* {
+  return scanStringBodyScalar(scanSse42<kSseAnyOf>(p, end, "\"               ", 1), end);
+}
+
+__attribute__((target("sse4.2"))) auto scanToStructuralSse42(const char* p, const char* end)
+    -> const char* {
+  return scanToStructuralScalar(scanSse42<kSseAnyOf>(p, end, "()[]{};\"        ", 8), end);
+}
+
+__attribute__((target("sse4.2"))) void collectLineStartsSse42(
+    const char* begin, const char* end, std::vector<size_t>& out) {
+  const char* p = begin;
+  auto nl = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, nl)));
+    pushMaskBits(mask, static_cast<size_t>(p - begin), out);
+  }
+  auto base = static_cast<size_t>(p - begin);
+  auto tail = out.size();
+  collectLineStartsScalar(p, end, out);
+  for (auto i = tail; i < out.size(); i++) {
+    out[i] += base;
+  }
+}
+
+// AVX2: classify 32 bytes with compares and take the first byte outside the class from the mask.
+#define TMONKEY_AVX2 __attribute__((target("avx2"), always_inline)) inline
+
+template <__m256i (*Classify)(__m256i)>
+TMONKEY_AVX2 auto scanAvx2(const char* p, const char* end) -> const char* {
+  while (end - p >= 32) {
+    auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(Classify(block)));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+  return p;
+}
+
+// Signed compares are enough for ASCII ranges: bytes >= 0x80 are negative and fall below lo.
+TMONKEY_AVX2 auto inRangeAvx2(__m256i v, char lo, char hi) -> __m256i {
+  return _mm256_and_si256(
+      _mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+      _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v));
+}
+
+TMONKEY_AVX2 auto classifyWhitespaceAvx2(__m256i v) -> __m256i {
+  auto sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  auto tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+  auto nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+  auto cr = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+  return _mm256_or_si256(_mm256_or_si256(sp, tab), _mm256_or_si256(nl, cr));
+}
+
+TMONKEY_AVX2 auto classifyIdentifierAvx2(__m256i v) -> __m256i {
+  // Folding case with | 0x20 maps no non-letter byte into 'a'..'z'.
+  auto alpha = inRangeAvx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+  auto digit = inRangeAvx2(v, '0', '9');
+  auto under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+  return _mm256_or_si256(_mm256_or_si256(alpha, digit), under);
+}
+
+TMONKEY_AVX2 auto classifyDigitsAvx2(__m256i v) -> __m256i {
+  return inRangeAvx2(v, '0', '9');
+}
+
+TMONKEY_AVX2 auto classifyStringBodyAvx2(__m256i v) -> __m256i {
+  auto quote = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+  return _mm256_xor_si256(quote, _mm256_set1_epi8(-1));
+}
+
+// Structural bytes are dense in source, so one compare per byte value costs more than the scan
+// saves. Instead each nibble indexes a table of bit sets, and a byte is structural when the sets
+// of its nibbles intersect. The high nibble picks a bit: 2 -> 1, 3 -> 2, 5 -> 4, 7 -> 8; the low
+// nibble lists which of those rows it is structural in: '"' 0x22, '(' 0x28, ')' 0x29, ';' 0x3b,
+// '[' 0x5b, ']' 0x5d, '{' 0x7b, '}' 0x7d.
+TMONKEY_AVX2 auto classifyNonStructuralAvx2(__m256i v) -> __m256i {
+  const auto lo = _mm256_setr_epi8(
+      0, 0, 1, 0, 0, 0, 0, 0, 1, 1, 0, 14, 0, 12, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 1, 0, 14, 0, 12,
+      0, 0);
+  const auto hi = _mm256_setr_epi8(
+      0, 0, 1, 2, 0, 4, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 0, 4, 0, 8, 0, 0, 0, 0, 0, 0, 0,
+      0);
+  auto nibble = _mm256_set1_epi8(0x0f);
+  auto loSet = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+  auto hiSet = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  return _mm256_cmpeq_epi8(_mm256_and_si256(loSet, hiSet), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2"))) auto scanWhitespaceAvx2(const char* p, const char* end)
+    -> const char* {
+  return scanWhitespaceScalar(scanAvx2<classifyWhitespaceAvx2>(p, end), end);
+}
+
+__attribute__((target("avx2"))) auto scanIdentifierAvx2(const char* p, const char* end)
+    -> const char* {
+  return scanIdentifierScalar(scanAvx2<classifyIdentifierAvx2>(p, end), end);
+}
+
+__attribute__((target("avx2"))) auto scanDigitsAvx2(const char* p, const char* end)
+    -> const char* {
+  return scanDigitsScalar(scanAvx2<classifyDigitsAvx2>(p, end), end);
+}
+
+__attribute__((target("avx2"))) auto scanStringBodyAvx2(const char* p, const char* end)
+    -> const char* {
+  return scanStringBodyScalar(scanAvx2<classifyStringBodyAvx2>(p, end), end);
+}
+
+__attribute__((target("avx2"))) auto scanToStructuralAvx2(const char* p, const char* end)
+    -> const char* {
+  return scanToStructuralScalar(scanAvx2<classifyNonStructuralAvx2>(p, end), end);
+}
+
+__attribute__((target("avx2"))) void collectLineStartsAvx2(
+    const char* begin, const char* end, std::vector<size_t>& out) {
+  const char* p = begin;
+  auto nl = _mm256_set1_epi8('\n');
+  for (; end - p >= 32; p += 32) {
+    auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, nl)));
+    pushMaskBits(mask, static_cast<size_t>(p - begin), out);
+  }
+  auto base = static_cast<size_t>(p - begin);
+  auto tail = out.size();
+  collectLineStartsScalar(p, end, out);
+  for (auto i = tail; i < out.size(); i++) {
+    out[i] += base;
+  }
+}
+
+#undef TMONKEY_AVX2
+
+#endif  // TMONKEY_SCAN_X86
+
+using ScanFn = const char* (*)(const char*, const char*);
+using CollectFn = void (*)(const char*, const char*, std::vector<size_t>&);
+
+struct ScanKernels {
+  ScanIsa isa;
+  ScanFn whitespace;
+  ScanFn identifier;
+  ScanFn digits;
+  ScanFn stringBody;
+  ScanFn structural;
+  CollectFn lineStarts;
+};
+
+constexpr ScanKernels kScalarKernels = {
+  ScanIsa::kScalar,     scanWhitespaceScalar,   scanIdentifierScalar,    scanDigitsScalar,
+  scanStringBodyScalar, scanToStructuralScalar, collectLineStartsScalar,
+};
+
+#ifdef TMONKEY_SCAN_X86
+constexpr ScanKernels kSse42Kernels = {
+  ScanIsa::kSse42,     scanWhitespaceSse42,   scanIdentifierSse42,    scanDigitsSse42,
+  scanStringBodySse42, scanToStructuralSse42, collectLineStartsSse42,
+};
+
+constexpr ScanKernels kAvx2Kernels = {
+  ScanIsa::kAvx2,     scanWhitespaceAvx2,   scanIdentifierAvx2,    scanDigitsAvx2,
+  scanStringBodyAvx2, scanToStructuralAvx2, collectLineStartsAvx2,
+};
+#endif
+
+auto bestIsa() -> ScanIsa {
+#ifdef TMONKEY_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return ScanIsa::kAvx2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return ScanIsa::kSse42;
+  }
+#endif
+  return ScanIsa::kScalar;
+}
+
+auto kernelsFor(ScanIsa isa) -> const ScanKernels* {
+#ifdef TMONKEY_SCAN_X86
+  switch (isa) {
+    case ScanIsa::kAvx2:
+      return &kAvx2Kernels;
+    case ScanIsa::kSse42:
+      return &kSse42Kernels;
+    case ScanIsa::kScalar:
+      break;
+  }
+#endif
+  return &kScalarKernels;
+}
+
+// Constant-initialized so scans from other static initializers are safe; the kernels are picked
+// on first use. Relaxed is enough since every value stored points to an immutable table.
+std::atomic<const ScanKernels*> gKernels{nullptr};
+
+auto kernels() -> const ScanKernels* {
+  auto* k = gKernels.load(std::memory_order_relaxed);
+  if (!k) {
+    k = kernelsFor(bestIsa());
+    gKernels.store(k, std::memory_order_relaxed);
+  }
+  return k;
+}
+
+// Most runs in source are a few bytes long: those end here byte by byte, and only longer ones pay
+// for the kernel call and its vector setup.
+template <typename Pred>
+auto scanShortRun(const char* p, const char* end, Pred pred, ScanFn kernel) -> const char* {
+  constexpr ptrdiff_t kShortRun = 16;
+  const auto* stop = end - p > kShortRun ? p + kShortRun : end;
+  for (; p != stop; p++) {
+    if (!pred(*p)) {
+      return p;
+    }
+  }
+  return p == end ? p : kernel(p, end);
+}
+
+}  // namespace
+
+auto scanWhitespace(const char* p, const char* end) -> const char* {
+  return scanShortRun(p, end, isSpace, kernels()->whitespace);
+}
+
+auto scanIdentifier(const char* p, const char* end) -> const char* {
+  return scanShortRun(p, end, isIdentChar, kernels()->identifier);
+}
+
+auto scanDigits(const char* p, const char* end) -> const char* {
+  return scanShortRun(p, end, isDigit, kernels()->digits);
+}
+
+auto scanStringBody(const char* p, const char* end) -> const char* {
+  return scanShortRun(p, end, [](char c) { return c != '"'; }, kernels()->stringBody);
+}
+
+auto scanToStructural(const char* p, const char* end) -> const char* {
+  return scanShortRun(p, end, [](char c) { return !isStructural(c); }, kernels()->structural);
+}
+
+void collectLineStarts(const char* begin, const char* end, std::vector<size_t>& out) {
+  kernels()->lineStarts(begin, end, out);
+}
+
+auto scanIsa() -> ScanIsa {
+  return kernels()->isa;
+}
+
+void setScanIsa(ScanIsa isa) {
+  auto best = bestIsa();
+  gKernels.store(
+      kernelsFor(static_cast<uint8_t>(isa) > static_cast<uint8_t>(best) ? best : isa),
+      std::memory_order_relaxed);
+}
+
+auto scanIsaStringify(ScanIsa isa) -> const char* {
+  switch (isa) {
+    case ScanIsa::kScalar:
+      return "scalar";
+    case ScanIsa::kSse42:
+      return "sse4.2";
+    case ScanIsa::kAvx2:
+      return "avx2";
+  }
+  return "";
+}
+
+}  // namespace tmonkey
\ No newline at end of file
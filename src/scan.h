@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+
+namespace tmonkey {
+
+// Byte-run scanners used by the lexer hot loops. Each returns a pointer to the first byte in
+// [p, end) that does not belong to the run, or end.
+enum class ScanIsa : uint8_t {
+  kScalar,
+  kSse42,
+  kAvx2,
+};
+
+auto scanWhitespace(const char* p, const char* end) -> const char*;
+auto scanIdentifier(const char* p, const char* end) -> const char*;
+auto scanDigits(const char* p, const char* end) -> const char*;
+// Stops at the closing '"' of a string literal body.
+auto scanStringBody(const char* p, const char* end) -> const char*;
+// Skips to the next bracket, ';' or '"', the only bytes that matter when splitting statements.
+auto scanToStructural(const char* p, const char* end) -> const char*;
+
+// Appends the offset just past every '\n' in [begin, end), relative to begin.
+void collectLineStarts(const char* begin, const char* end, std::vector<size_t>& out);
+
+// The kernel set is picked from the CPU features on first use. setScanIsa() lets tests and
+// benchmarks pin a lower tier; an unsupported tier is clamped to the best available one. Scans
+// running on other threads switch kernels between calls.
+auto scanIsa() -> ScanIsa;
+void setScanIsa(ScanIsa isa);
+auto scanIsaStringify(ScanIsa isa) -> const char*;
+
+}  // namespace tmonkey
\ No newline at end of file
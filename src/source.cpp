@@ -0,0 +1,67 @@
+#include "source.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include "scan.h"
+
+namespace tmonkey {
+
+auto MappedFile::open(const char* path) -> std::optional<MappedFile> {
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return {};
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    auto err = errno;
+    close(fd);
+    errno = err;
+    return {};
+  }
+
+  auto size = static_cast<size_t>(st.st_size);
+  if (size == 0) {
+    close(fd);
+    return MappedFile(nullptr, 0);
+  }
+
+  int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  // The lexer touches every page front to back, so fault them in with one syscall.
+  flags |= MAP_POPULATE;
+#endif
+  void* addr = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+  auto err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    errno = err;
+    return {};
+  }
+
+  madvise(addr, size, MADV_SEQUENTIAL);
+  return MappedFile(static_cast<const char*>(addr), size);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+auto SourceMap::locate(size_t offset) -> SourceLocation {
+  if (lineStarts_.empty()) {
+    lineStarts_.push_back(0);
+    collectLineStarts(text_.data(), text_.data() + text_.size(), lineStarts_);
+  }
+
+  offset = std::min(offset, text_.size());
+  auto it = std::upper_bound(lineStarts_.begin(), lineStarts_.end(), offset);
+  auto line = static_cast<size_t>(it - lineStarts_.begin());
+  return {line, offset - *(it - 1) + 1};
+}
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+
+namespace tmonkey {
+
+// Read-only mapping of a source file. text() points straight into the mapping, so every token and
+// AST string view produced from it stays valid for as long as the MappedFile lives.
+class MappedFile {
+public:
+  // Returns nullopt and leaves errno set when the file can't be opened or mapped.
+  static auto open(const char* path) -> std::optional<MappedFile>;
+
+  NO_COPYABLE(MappedFile)
+
+  MappedFile(MappedFile&& other) noexcept : data_{other.data_}, size_{other.size_} {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+
+  ~MappedFile();
+
+  auto text() const -> std::string_view {
+    return {data_, size_};
+  }
+
+private:
+  MappedFile(const char* data, size_t size) : data_{data}, size_{size} {}
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+struct SourceLocation {
+  size_t line;
+  size_t column;
+};
+
+// Maps byte offsets back to 1-based line and column. The line index is only built, with the SIMD
+// newline scanner, the first time a location is asked for, so the happy path never pays for it.
+class SourceMap {
+public:
+  explicit SourceMap(std::string_view text) : text_{text} {}
+
+  NO_COPYABLE(SourceMap)
+
+  auto locate(size_t offset) -> SourceLocation;
+
+private:
+  std::string_view text_;
+  std::vector<size_t> lineStarts_;
+};
+
+}  // namespace tmonkey
\ No newline at end of file
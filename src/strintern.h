@@ -0,0 +1,434 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include "common.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace tmonkey {
+
+// An interned string: its id plus the hash the interner computed for it, so later passes can key
+// their own tables without rehashing the text.
+struct Symbol {
+  static constexpr uint32_t kNone = ~0u;
+
+  uint32_t id = kNone;
+  uint64_t hash = 0;
+
+  explicit operator bool() const {
+    return id != kNone;
+  }
+
+  auto operator==(const Symbol& other) const -> bool {
+    return id == other.id;
+  }
+};
+
+// Keywords and builtins take the first ids of every interner, in this order, so they can be
+// recognised by id without a table lookup.
+#define RESERVED_SYMBOL_LIST(V) \
+  V(Fn, "fn")                   \
+  V(If, "if")                   \
+  V(Let, "let")                 \
+  V(Else, "else")               \
+  V(Null, "null")               \
+  V(Puts, "puts")               \
+  V(True, "true")               \
+  V(While, "while")             \
+  V(False, "false")             \
+  V(Return, "return")           \
+  V(Import, "import")
+
+enum ReservedSymbol : uint32_t {
+#define GEN_RESERVED_SYMBOL(Name, Text) kSymbol##Name,
+  RESERVED_SYMBOL_LIST(GEN_RESERVED_SYMBOL)
+#undef GEN_RESERVED_SYMBOL
+  kReservedSymbolCount
+};
+
+// Interns strings into dense 32-bit ids. The table is open addressing in the Swiss-table style: a
+// control byte per slot holds 7 bits of the hash, so a probe checks a 16-slot group with one
+// compare and only touches the strings whose tag matches. String bytes live contiguously in an
+// arena and full hashes are stored per id, so growing the table never rehashes a string.
+class StringInterningMap {
+  static constexpr size_t kGroupSize = 16;
+  static constexpr int8_t kEmpty = -128;
+
+public:
+  StringInterningMap() : arena_{std::make_unique<Arena>()} {
+#define GEN_RESERVE(Name, Text) intern(Text);
+    RESERVED_SYMBOL_LIST(GEN_RESERVE)
+#undef GEN_RESERVE
+  }
+
+  NO_COPYABLE(StringInterningMap)
+
+  StringInterningMap(StringInterningMap&& other) noexcept = default;
+  auto operator=(StringInterningMap&& other) noexcept -> StringInterningMap& = default;
+
+  auto intern(std::string_view s) -> uint32_t {
+    return intern(s, hashBytes(s));
+  }
+
+  auto symbol(std::string_view s) -> Symbol {
+    auto h = hashBytes(s);
+    return {intern(s, h), h};
+  }
+
+  auto string(uint32_t idx) const -> std::optional<std::string_view> {
+    if (idx >= strings_.size()) {
+      return {};
+    }
+    return strings_[idx];
+  }
+
+  auto hash(uint32_t idx) const -> uint64_t {
+    return hashes_[idx];
+  }
+
+  auto size() const -> size_t {
+    return strings_.size();
+  }
+
+private:
+  auto intern(std::string_view s, uint64_t h) -> uint32_t {
+    if (auto id = find(s, h)) {
+      return *id;
+    }
+
+    if ((strings_.size() + 1) * 8 > ctrl_.size() * 7) {
+      grow();
+    }
+
+    auto* data = arena_->alloc(s.size());
+    std::memcpy(data, s.data(), s.size());
+    auto id = static_cast<uint32_t>(strings_.size());
+    strings_.push_back({data, s.size()});
+    hashes_.push_back(h);
+    insert(id, h);
+    return id;
+  }
+
+  static auto tag(uint64_t h) -> int8_t {
+    return static_cast<int8_t>(h & 0x7f);
+  }
+
+  // Bit i is set when control byte i of the group equals `b`.
+  static auto matchGroup(const int8_t* group, int8_t b) -> uint32_t {
+#ifdef __SSE2__
+    auto ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < kGroupSize; i++) {
+      mask |= static_cast<uint32_t>(group[i] == b) << i;
+    }
+    return mask;
+#endif
+  }
+
+  auto groupMask() const -> size_t {
+    return ctrl_.size() / kGroupSize - 1;
+  }
+
+  auto find(std::string_view s, uint64_t h) const -> std::optional<uint32_t> {
+    if (ctrl_.empty()) {
+      return {};
+    }
+    for (auto g = (h >> 7) & groupMask();; g = (g + 1) & groupMask()) {
+      const auto* group = &ctrl_[g * kGroupSize];
+      for (auto m = matchGroup(group, tag(h)); m != 0; m &= m - 1) {
+        auto id = slots_[g * kGroupSize + static_cast<size_t>(__builtin_ctz(m))];
+        if (hashes_[id] == h && strings_[id] == s) {
+          return id;
+        }
+      }
+      if (matchGroup(group, kEmpty) != 0) {
+        return {};
+      }
+    }
+  }
+
+  void insert(uint32_t id, uint64_t h) {
+    for (auto g = (h >> 7) & groupMask();; g = (g + 1) & groupMask()) {
+      if (auto m = matchGroup(&ctrl_[g * kGroupSize], kEmpty); m != 0) {
+        auto slot = g * kGroupSize + static_cast<size_t>(__builtin_ctz(m));
+        ctrl_[slot] = tag(h);
+        slots_[slot] = id;
+        return;
+      }
+    }
+  }
+
+  void grow() {
+    auto capacity = std::max(ctrl_.size() * 2, kGroupSize * 4);
+    ctrl_.assign(capacity, kEmpty);
+    slots_.assign(capacity, 0);
+    for (uint32_t id = 0; id < strings_.size(); id++) {
+      insert(id, hashes_[id]);
+    }
+  }
+
+  std::unique_ptr<Arena> arena_;
+  std::vector<int8_t> ctrl_;
+  std::vector<uint32_t> slots_;
+  std::vector<std::string_view> strings_;
+  std::vector<uint64_t> hashes_;
+};
+
+// Thread-safe interner shared by front-ends running on several threads. Strings are sharded by
+// the top bits of their hash; a hit is a lock-free probe of the shard's current table, a miss takes
+// the shard's mutex. Ids come from one global counter, so they are stable across shards and every
+// thread sees the same id for the same string without a merge pass.
+//
+// Readers may still be probing a table after a grow has published its successor, so retired
+// tables are kept until the map is destroyed. That bounds the overhead at 2x of the live tables.
+class ConcurrentStringInterningMap {
+  static constexpr size_t kShardBits = 6;
+  static constexpr size_t kShards = size_t{1} << kShardBits;
+  // Control bytes are read as 8-byte words so a probe is a single atomic load per group.
+  static constexpr size_t kGroupSize = 8;
+  static constexpr uint64_t kEmptyWord = 0x8080808080808080ull;
+  static constexpr uint64_t kLowBits = 0x0101010101010101ull;
+  // Ids index a segmented array; segment k holds kFirstSegment << k entries, so entries never
+  // move once published.
+  static constexpr size_t kFirstSegmentBits = 10;
+  static constexpr size_t kSegments = 32 - kFirstSegmentBits + 1;
+
+public:
+  ConcurrentStringInterningMap() {
+#define GEN_RESERVE(Name, Text) intern(Text);
+    RESERVED_SYMBOL_LIST(GEN_RESERVE)
+#undef GEN_RESERVE
+  }
+
+  NO_COPYABLE(ConcurrentStringInterningMap)
+  NO_MOVABLE(ConcurrentStringInterningMap)
+
+  ~ConcurrentStringInterningMap() {
+    for (auto& s : segments_) {
+      delete[] s.load(std::memory_order_relaxed);
+    }
+  }
+
+  auto intern(std::string_view s) -> uint32_t {
+    return intern(s, hashBytes(s));
+  }
+
+  auto symbol(std::string_view s) -> Symbol {
+    auto h = hashBytes(s);
+    return {intern(s, h), h};
+  }
+
+  // `idx` must have been returned by intern(), possibly on another thread.
+  auto string(uint32_t idx) const -> std::optional<std::string_view> {
+    if (idx >= size()) {
+      return {};
+    }
+    return entry(idx).str;
+  }
+
+  auto hash(uint32_t idx) const -> uint64_t {
+    return entry(idx).hash;
+  }
+
+  auto size() const -> size_t {
+    return next_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Entry {
+    std::string_view str;
+    uint64_t hash;
+  };
+
+  auto intern(std::string_view s, uint64_t h) -> uint32_t {
+    auto& shard = shards_[h >> (64 - kShardBits)];
+
+    if (auto id = find(shard.table.load(std::memory_order_acquire), s, h)) {
+      return *id;
+    }
+
+    std::lock_guard lock(shard.mu);
+    // Another thread may have inserted the string, or grown the table, since the probe above.
+    auto* table = shard.table.load(std::memory_order_relaxed);
+    if (auto id = find(table, s, h)) {
+      return *id;
+    }
+    if (!table || (shard.count + 1) * 8 > table->groups * kGroupSize * 7) {
+      table = grow(shard);
+    }
+
+    // The empty string needs no storage.
+    std::string_view str;
+    if (!s.empty()) {
+      auto* data = shard.arena.alloc(s.size());
+      std::memcpy(data, s.data(), s.size());
+      str = {data, s.size()};
+    }
+    auto id = next_.fetch_add(1, std::memory_order_relaxed);
+    entry(id) = {str, h};
+    insert(*table, id, h);
+    shard.count++;
+    return id;
+  }
+
+  struct Table {
+    explicit Table(size_t groups)
+        : groups{groups},
+          ctrl{std::make_unique<std::atomic<uint64_t>[]>(groups)},
+          slots{std::make_unique<std::atomic<uint32_t>[]>(groups * kGroupSize)} {
+      for (size_t i = 0; i < groups; i++) {
+        ctrl[i].store(kEmptyWord, std::memory_order_relaxed);
+      }
+    }
+
+    size_t groups;
+    std::unique_ptr<std::atomic<uint64_t>[]> ctrl;
+    std::unique_ptr<std::atomic<uint32_t>[]> slots;
+  };
+
+  struct alignas(64) Shard {
+    std::atomic<Table*> table = nullptr;
+    std::mutex mu;
+    size_t count = 0;
+    Arena arena;
+    std::vector<std::unique_ptr<Table>> tables;
+  };
+
+  static auto tag(uint64_t h) -> uint64_t {
+    return h & 0x7f;
+  }
+
+  // High bit of byte i is set when byte i of `word` equals `b`.
+  static auto matchWord(uint64_t word, uint64_t b) -> uint64_t {
+    auto x = word ^ (b * kLowBits);
+    auto y = ((x & ~kEmptyWord) + ~kEmptyWord) | x;
+    return ~y & kEmptyWord;
+  }
+
+  auto find(const Table* table, std::string_view s, uint64_t h) const -> std::optional<uint32_t> {
+    if (!table) {
+      return {};
+    }
+    auto mask = table->groups - 1;
+    for (auto g = (h >> 7) & mask;; g = (g + 1) & mask) {
+      auto word = table->ctrl[g].load(std::memory_order_acquire);
+      for (auto m = matchWord(word, tag(h)); m != 0; m &= m - 1) {
+        auto slot = g * kGroupSize + static_cast<size_t>(std::countr_zero(m)) / 8;
+        auto id = table->slots[slot].load(std::memory_order_relaxed);
+        const auto& e = entry(id);
+        if (e.hash == h && e.str == s) {
+          return id;
+        }
+      }
+      if ((word & kEmptyWord) != 0) {
+        return {};
+      }
+    }
+  }
+
+  // Called with the shard locked. The slot id is written before the control word is released, so
+  // a reader that sees the tag also sees the id and its entry.
+  static void insert(Table& table, uint32_t id, uint64_t h) {
+    auto mask = table.groups - 1;
+    for (auto g = (h >> 7) & mask;; g = (g + 1) & mask) {
+      auto word = table.ctrl[g].load(std::memory_order_relaxed);
+      if (auto empty = word & kEmptyWord; empty != 0) {
+        auto byte = static_cast<size_t>(std::countr_zero(empty)) / 8;
+        table.slots[g * kGroupSize + byte].store(id, std::memory_order_relaxed);
+        word = (word & ~(uint64_t{0xff} << (byte * 8))) | (tag(h) << (byte * 8));
+        table.ctrl[g].store(word, std::memory_order_release);
+        return;
+      }
+    }
+  }
+
+  auto grow(Shard& shard) -> Table* {
+    auto* old = shard.table.load(std::memory_order_relaxed);
+    auto groups = old ? old->groups * 2 : size_t{8};
+    auto& table = *shard.tables.emplace_back(std::make_unique<Table>(groups));
+    if (old) {
+      for (size_t slot = 0; slot < old->groups * kGroupSize; slot++) {
+        auto word = old->ctrl[slot / kGroupSize].load(std::memory_order_relaxed);
+        if ((word >> (slot % kGroupSize * 8) & 0x80) == 0) {
+          auto id = old->slots[slot].load(std::memory_order_relaxed);
+          insert(table, id, entry(id).hash);
+        }
+      }
+    }
+    shard.table.store(&table, std::memory_order_release);
+    return &table;
+  }
+
+  static auto locate(uint32_t id) -> std::pair<size_t, size_t> {
+    auto i = uint64_t{id} + (uint64_t{1} << kFirstSegmentBits);
+    auto segment = static_cast<size_t>(std::bit_width(i)) - 1 - kFirstSegmentBits;
+    return {segment, static_cast<size_t>(i - (uint64_t{1} << (segment + kFirstSegmentBits)))};
+  }
+
+  auto entry(uint32_t id) const -> const Entry& {
+    auto [segment, offset] = locate(id);
+    return segments_[segment].load(std::memory_order_acquire)[offset];
+  }
+
+  // Segments are created on demand by whichever writer first needs them.
+  auto entry(uint32_t id) -> Entry& {
+    auto [segment, offset] = locate(id);
+    auto* entries = segments_[segment].load(std::memory_order_acquire);
+    if (!entries) {
+      auto* fresh = new Entry[size_t{1} << (segment + kFirstSegmentBits)];
+      if (segments_[segment].compare_exchange_strong(
+              entries, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        entries = fresh;
+      } else {
+        delete[] fresh;
+      }
+    }
+    return entries[offset];
+  }
+
+  std::array<Shard, kShards> shards_;
+  std::array<std::atomic<Entry*>, kSegments> segments_ = {};
+  std::atomic<uint32_t> next_ = 0;
+};
+
+// Non-owning handle that lets the front-end intern through either map. A default-constructed
+// ref interns nothing and hands out empty symbols.
+class InternerRef {
+public:
+  InternerRef() = default;
+  InternerRef(StringInterningMap& map) : map_{&map}, symbol_{&symbolOf<StringInterningMap>} {}
+  InternerRef(ConcurrentStringInterningMap& map)
+      : map_{&map}, symbol_{&symbolOf<ConcurrentStringInterningMap>}, threadSafe_{true} {}
+
+  explicit operator bool() const {
+    return map_ != nullptr;
+  }
+
+  // True when symbol() may be called from several threads at once.
+  auto threadSafe() const -> bool {
+    return !map_ || threadSafe_;
+  }
+
+  auto symbol(std::string_view s) const -> Symbol {
+    return map_ ? symbol_(map_, s) : Symbol{};
+  }
+
+private:
+  template <typename Map>
+  static auto symbolOf(void* map, std::string_view s) -> Symbol {
+    return static_cast<Map*>(map)->symbol(s);
+  }
+
+  void* map_ = nullptr;
+  Symbol (*symbol_)(void*, std::string_view) = nullptr;
+  bool threadSafe_ = false;
+};
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -1,7 +1,6 @@
-#include "common.h"
+#include <thread>
 #include "gtest/gtest.h"
-#include "parser.h"
-#include "pretty.h"
+#include "strintern.h"
 
 namespace tmonkey {
 namespace {
@@ -21,6 +20,73 @@ TEST(LexerTests, Basics) {
     ASSERT_TRUE(res.has_value());
     ASSERT_EQ("qqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqqq", *res);
   }
+
+  ASSERT_EQ(kReservedSymbolCount, str_map.intern("q"));
+  ASSERT_FALSE(str_map.string(kReservedSymbolCount + 2).has_value());
+}
+
+TEST(StringInterningMapTests, ReservedSymbols) {
+  StringInterningMap str_map;
+  ASSERT_EQ(kSymbolFn, str_map.intern("fn"));
+  ASSERT_EQ(kSymbolPuts, str_map.intern("puts"));
+  ASSERT_EQ(kSymbolImport, str_map.intern("import"));
+  ASSERT_EQ(size_t{kReservedSymbolCount}, str_map.size());
+}
+
+TEST(StringInterningMapTests, Growth) {
+  StringInterningMap str_map;
+  std::vector<std::string> strs;
+  for (int i = 0; i < 10000; i++) {
+    strs.push_back(std::format("identifier_{}", i));
+    ASSERT_EQ(kReservedSymbolCount + static_cast<uint32_t>(i), str_map.intern(strs.back()));
+  }
+  ASSERT_EQ(kReservedSymbolCount + strs.size(), str_map.size());
+
+  auto moved = std::move(str_map);
+  for (uint32_t i = 0; i < strs.size(); i++) {
+    auto sym = moved.symbol(strs[i]);
+    ASSERT_EQ(kReservedSymbolCount + i, sym.id);
+    ASSERT_EQ(strs[i], *moved.string(sym.id));
+    ASSERT_EQ(hashBytes(strs[i]), sym.hash);
+  }
+  ASSERT_EQ(kReservedSymbolCount + strs.size(), moved.size());
+}
+
+TEST(StringInterningMapTests, Concurrent) {
+  ConcurrentStringInterningMap str_map;
+  constexpr size_t kThreads = 8;
+  constexpr size_t kStrings = 20000;
+
+  std::vector<std::vector<uint32_t>> ids(kThreads, std::vector<uint32_t>(kStrings));
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t] {
+      // Every thread interns the same strings in a different order.
+      for (size_t i = 0; i < kStrings; i++) {
+        auto n = (i * 7919 + t * 104729) % kStrings;
+        ids[t][n] = str_map.intern(std::format("symbol_{}", n));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  ASSERT_EQ(kReservedSymbolCount + kStrings, str_map.size());
+  ASSERT_EQ(kSymbolPuts, str_map.intern("puts"));
+  for (size_t i = 0; i < kStrings; i++) {
+    for (size_t t = 1; t < kThreads; t++) {
+      ASSERT_EQ(ids[0][i], ids[t][i]);
+    }
+    ASSERT_EQ(std::format("symbol_{}", i), *str_map.string(ids[0][i]));
+  }
+
+  // Most shards have nothing in their arena yet.
+  ConcurrentStringInterningMap fresh;
+  auto empty = fresh.intern("");
+  ASSERT_EQ(empty, fresh.intern(""));
+  ASSERT_EQ("", *fresh.string(empty));
+  ASSERT_EQ(size_t{kReservedSymbolCount} + 1, fresh.size());
 }
 
 }  // namespace
@@ -0,0 +1,103 @@
+#include "thread_pool.h"
+
+namespace tmonkey {
+
+ThreadPool::ThreadPool(size_t threads) {
+  auto n = std::max<size_t>(threads, 1);
+  queues_ = std::make_unique<Queue[]>(n);
+  for (size_t i = 0; i < n; i++) {
+    workers_.emplace_back([this, i] { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mu_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& w : workers_) {
+    w.join();
+  }
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t, size_t)>& fn) {
+  if (count == 0) {
+    return;
+  }
+
+  std::unique_lock lock(mu_);
+  // A worker that woke late for the previous batch may still hold its function.
+  done_.wait(lock, [this] { return active_ == 0; });
+
+  auto per = (count + size() - 1) / size();
+  for (size_t w = 0; w < size(); w++) {
+    std::lock_guard queueLock(queues_[w].mu);
+    for (auto task = w * per; task < std::min(count, (w + 1) * per); task++) {
+      queues_[w].tasks.push_back(task);
+    }
+  }
+  fn_ = &fn;
+  pending_ = count;
+  generation_++;
+  wake_.notify_all();
+
+  done_.wait(lock, [this] { return pending_ == 0 && active_ == 0; });
+  fn_ = nullptr;
+}
+
+void ThreadPool::work(size_t worker) {
+  uint64_t seen = 0;
+  for (;;) {
+    const std::function<void(size_t, size_t)>* fn = nullptr;
+    {
+      std::unique_lock lock(mu_);
+      wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+      fn = fn_;
+      active_++;
+    }
+
+    size_t finished = 0;
+    while (auto task = take(worker)) {
+      (*fn)(worker, *task);
+      finished++;
+    }
+
+    std::lock_guard lock(mu_);
+    pending_ -= finished;
+    active_--;
+    if (active_ == 0) {
+      done_.notify_all();
+    }
+  }
+}
+
+auto ThreadPool::take(size_t worker) -> std::optional<size_t> {
+  {
+    auto& own = queues_[worker];
+    std::lock_guard lock(own.mu);
+    if (!own.tasks.empty()) {
+      auto task = own.tasks.back();
+      own.tasks.pop_back();
+      return task;
+    }
+  }
+
+  for (size_t i = 1; i < size(); i++) {
+    auto& victim = queues_[(worker + i) % size()];
+    std::lock_guard lock(victim.mu);
+    if (!victim.tasks.empty()) {
+      auto task = victim.tasks.front();
+      victim.tasks.pop_front();
+      return task;
+    }
+  }
+
+  return {};
+}
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "common.h"
+
+namespace tmonkey {
+
+// Fixed set of worker threads that run batches of indexed tasks. Each batch is dealt out to the
+// workers in contiguous runs; a worker takes tasks from the back of its own queue and, once that is
+// empty, steals from the front of the others, so a few slow tasks don't leave cores idle.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t threads);
+
+  NO_COPYABLE(ThreadPool)
+  NO_MOVABLE(ThreadPool)
+
+  ~ThreadPool();
+
+  auto size() const -> size_t {
+    return workers_.size();
+  }
+
+  // Calls fn(worker, task) for every task in [0, count) and returns once all of them finished.
+  // `worker` is in [0, size()) and no two calls with the same worker run at the same time.
+  void run(size_t count, const std::function<void(size_t, size_t)>& fn);
+
+private:
+  struct alignas(64) Queue {
+    std::mutex mu;
+    std::deque<size_t> tasks;
+  };
+
+  void work(size_t worker);
+  auto take(size_t worker) -> std::optional<size_t>;
+
+  std::vector<std::thread> workers_;
+  std::unique_ptr<Queue[]> queues_;
+
+  std::mutex mu_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(size_t, size_t)>* fn_ = nullptr;
+  uint64_t generation_ = 0;
+  size_t pending_ = 0;
+  // Workers between waking up for a batch and running out of tasks.
+  size_t active_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace tmonkey
\ No newline at end of file
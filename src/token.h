@@ -62,6 +62,73 @@ private:
   Kind kind_ = kEof;
 };
 
+// Struct-of-arrays token storage filled by Lexer::tokenizeAll(). Offsets and lengths are 32-bit,
+// so a single buffer covers sources up to 4 GB; a larger source aborts.
+class TokenBuffer {
+public:
+  static constexpr size_t kMaxSourceSize = UINT32_MAX;
+
+  explicit TokenBuffer(std::string_view source) : source_{source} {
+    if (source.size() > kMaxSourceSize) {
+      std::cerr << std::format("token buffer: source of {} bytes is too large\n", source.size());
+      std::abort();
+    }
+  }
+
+  void reserve(size_t n) {
+    kinds_.reserve(n);
+    starts_.reserve(n);
+    lengths_.reserve(n);
+  }
+
+  void push(Token::Kind kind, uint32_t start, uint32_t length) {
+    kinds_.push_back(kind);
+    starts_.push_back(start);
+    lengths_.push_back(length);
+  }
+
+  auto size() const -> size_t {
+    return kinds_.size();
+  }
+
+  // Discards the first n tokens; the remaining ones keep their source offsets.
+  void drop(size_t n) {
+    kinds_.erase(kinds_.begin(), kinds_.begin() + static_cast<ptrdiff_t>(n));
+    starts_.erase(starts_.begin(), starts_.begin() + static_cast<ptrdiff_t>(n));
+    lengths_.erase(lengths_.begin(), lengths_.begin() + static_cast<ptrdiff_t>(n));
+  }
+
+  auto source() const -> std::string_view {
+    return source_;
+  }
+
+  auto kind(size_t i) const -> Token::Kind {
+    return static_cast<Token::Kind>(kinds_[i]);
+  }
+
+  auto start(size_t i) const -> uint32_t {
+    return starts_[i];
+  }
+
+  auto length(size_t i) const -> uint32_t {
+    return lengths_[i];
+  }
+
+  auto text(size_t i) const -> std::string_view {
+    return source_.substr(starts_[i], lengths_[i]);
+  }
+
+  auto token(size_t i) const -> Token {
+    return Token(text(i), kind(i));
+  }
+
+private:
+  std::string_view source_;
+  std::vector<uint8_t> kinds_;
+  std::vector<uint32_t> starts_;
+  std::vector<uint32_t> lengths_;
+};
+
 auto tokenKindStringify(Token::Kind kind) -> const char*;
 
 }  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "value.h"
+
+namespace tmonkey {
+
+auto valueKindStringify(Value::Kind kind) -> const char* {
+  switch (kind) {
+    case Value::Kind::kNull:
+      return "null";
+    case Value::Kind::kBool:
+      return "bool";
+    case Value::Kind::kInteger:
+      return "integer";
+    case Value::Kind::kFloat:
+      return "float";
+    case Value::Kind::kBuiltin:
+      return "builtin";
+    case Value::Kind::kString:
+      return "string";
+    case Value::Kind::kArray:
+      return "array";
+    case Value::Kind::kHashMap:
+      return "hash map";
+    case Value::Kind::kClosure:
+      return "function";
+  }
+  return "";
+}
+
+namespace {
+
+// Exact, unlike converting `i` to double: a float only equals the integer it holds, the same test
+// valueHash uses to hash them alike.
+auto integerEqualsFloat(int64_t i, double d) -> bool {
+  return d >= -0x1p63 && d < 0x1p63 && d == static_cast<double>(static_cast<int64_t>(d)) &&
+         static_cast<int64_t>(d) == i;
+}
+
+}  // namespace
+
+auto valuesEqual(Value a, Value b) -> bool {
+  if (a.isNumber() && b.isNumber()) {
+    if (a.isInteger() && b.isInteger()) {
+      return a.asInteger() == b.asInteger();
+    }
+    if (a.isInteger()) {
+      return integerEqualsFloat(a.asInteger(), b.asFloat());
+    }
+    if (b.isInteger()) {
+      return integerEqualsFloat(b.asInteger(), a.asFloat());
+    }
+    return a.asFloat() == b.asFloat();
+  }
+  if (a.kind() != b.kind()) {
+    return false;
+  }
+  switch (a.kind()) {
+    case Value::Kind::kNull:
+      return true;
+    case Value::Kind::kBool:
+      return a.asBool() == b.asBool();
+    case Value::Kind::kBuiltin:
+      return a.asBuiltin() == b.asBuiltin();
+    case Value::Kind::kString:
+      return a.asString() == b.asString() || a.asString()->value == b.asString()->value;
+    case Value::Kind::kArray:
+      return a.asArray() == b.asArray();
+    case Value::Kind::kHashMap:
+      return a.asHashMap() == b.asHashMap();
+    case Value::Kind::kClosure:
+      return a.asClosure() == b.asClosure();
+    default:
+      return false;
+  }
+}
+
+auto valueHash(Value v) -> uint64_t {
+  auto mix = [](uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    return x ^ (x >> 33);
+  };
+
+  switch (v.kind()) {
+    case Value::Kind::kNull:
+      return 0;
+    case Value::Kind::kBool:
+      return mix(static_cast<uint64_t>(v.asBool()) + 1);
+    case Value::Kind::kBuiltin:
+      return mix(static_cast<uint64_t>(v.asBuiltin()) + 1);
+    case Value::Kind::kInteger:
+      return mix(static_cast<uint64_t>(v.asInteger()));
+    case Value::Kind::kFloat: {
+      // A float equal to an integer has to hash like it.
+      auto d = v.asFloat();
+      if (d >= -0x1p63 && d < 0x1p63 && d == static_cast<double>(static_cast<int64_t>(d))) {
+        return mix(static_cast<uint64_t>(static_cast<int64_t>(d)));
+      }
+      uint64_t bits;
+      memcpy(&bits, &d, sizeof(bits));
+      return mix(bits);
+    }
+    case Value::Kind::kString:
+      return v.asString()->hash;
+    case Value::Kind::kArray:
+      return mix(reinterpret_cast<uintptr_t>(v.asArray()));
+    case Value::Kind::kHashMap:
+      return mix(reinterpret_cast<uintptr_t>(v.asHashMap()));
+    case Value::Kind::kClosure:
+      return mix(reinterpret_cast<uintptr_t>(v.asClosure()));
+  }
+  return 0;
+}
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,276 @@
+#pragma once
+
+#include "common.h"
+
+namespace tmonkey {
+
+class Object;
+class IntegerObject;
+class StringObject;
+class ArrayObject;
+class HashMapObject;
+class ClosureObject;
+
+// A VM value: null, a bool, an integer, a float, a builtin function or a reference to a heap
+// object, NaN-boxed into 64 bits. A float is stored as is, with every NaN made the one positive
+// quiet NaN, so the bit patterns from 0xfff8 << 48 up are never floats and carry the other kinds:
+// the top 16 bits are the tag and the low 48 the payload. Integers in 48 bits are immediate;
+// wider ones are an IntegerObject, so an integer has exactly one encoding. Pointers fit in the
+// payload since user space addresses are 48 bits on x86-64 and AArch64.
+class Value {
+public:
+  enum class Kind : uint8_t {
+    kNull,
+    kBool,
+    kInteger,
+    kFloat,
+    kBuiltin,
+    kString,
+    kArray,
+    kHashMap,
+    kClosure,
+  };
+
+  static constexpr int64_t kMinInline = -(int64_t{1} << 47);
+  static constexpr int64_t kMaxInline = (int64_t{1} << 47) - 1;
+
+  Value() = default;
+
+  static auto boolean(bool v) -> Value {
+    return Value(v ? kTrue : kFalse);
+  }
+
+  static auto fitsInline(int64_t v) -> bool {
+    return v >= kMinInline && v <= kMaxInline;
+  }
+
+  // `v` must fit inline; wider integers are boxed by whoever owns the objects.
+  static auto inlineInteger(int64_t v) -> Value {
+    return Value(kTagInteger << 48 | (static_cast<uint64_t>(v) & kPayloadMask));
+  }
+
+  static auto number(double v) -> Value {
+    if (v != v) {
+      return Value(kCanonicalNaN);
+    }
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return Value(bits);
+  }
+
+  static auto builtin(uint32_t index) -> Value {
+    return Value(kTagBuiltin << 48 | index);
+  }
+
+  static auto object(IntegerObject* o) -> Value {
+    return pointer(kTagBoxedInteger, o);
+  }
+
+  static auto object(StringObject* o) -> Value {
+    return pointer(kTagString, o);
+  }
+
+  static auto object(ArrayObject* o) -> Value {
+    return pointer(kTagArray, o);
+  }
+
+  static auto object(HashMapObject* o) -> Value {
+    return pointer(kTagHashMap, o);
+  }
+
+  static auto object(ClosureObject* o) -> Value {
+    return pointer(kTagClosure, o);
+  }
+
+  ALWAYS_INLINE auto kind() const -> Kind {
+    static constexpr Kind kTagKinds[] = {
+        Kind::kInteger, Kind::kInteger, Kind::kNull,    Kind::kBuiltin,
+        Kind::kString,  Kind::kArray,   Kind::kHashMap, Kind::kClosure,
+    };
+    if (isFloat()) {
+      return Kind::kFloat;
+    }
+    auto k = kTagKinds[(bits_ >> 48) - kTagBoxedInteger];
+    return k == Kind::kNull && bits_ != kNull ? Kind::kBool : k;
+  }
+
+  auto isNull() const -> bool {
+    return bits_ == kNull;
+  }
+
+  auto isInlineInteger() const -> bool {
+    return bits_ >> 48 == kTagInteger;
+  }
+
+  auto isInteger() const -> bool {
+    return isInlineInteger() || bits_ >> 48 == kTagBoxedInteger;
+  }
+
+  auto isFloat() const -> bool {
+    return bits_ < kTagBoxedInteger << 48;
+  }
+
+  auto isNumber() const -> bool {
+    return isFloat() || isInteger();
+  }
+
+  auto asBool() const -> bool {
+    return bits_ == kTrue;
+  }
+
+  // Sign-extends the 48-bit payload.
+  auto asInlineInteger() const -> int64_t {
+    return static_cast<int64_t>(bits_ << 16) >> 16;
+  }
+
+  auto asInteger() const -> int64_t;
+
+  auto asFloat() const -> double {
+    double v;
+    memcpy(&v, &bits_, sizeof(v));
+    return v;
+  }
+
+  // Integers convert to float.
+  ALWAYS_INLINE auto asNumber() const -> double {
+    return isFloat() ? asFloat() : static_cast<double>(asInteger());
+  }
+
+  auto asBuiltin() const -> uint32_t {
+    return static_cast<uint32_t>(bits_);
+  }
+
+  // Null for an inline integer.
+  auto asBoxedInteger() const -> IntegerObject* {
+    return bits_ >> 48 == kTagBoxedInteger
+               ? reinterpret_cast<IntegerObject*>(bits_ & kPayloadMask)
+               : nullptr;
+  }
+
+  auto asString() const -> StringObject* {
+    return reinterpret_cast<StringObject*>(bits_ & kPayloadMask);
+  }
+
+  auto asArray() const -> ArrayObject* {
+    return reinterpret_cast<ArrayObject*>(bits_ & kPayloadMask);
+  }
+
+  auto asHashMap() const -> HashMapObject* {
+    return reinterpret_cast<HashMapObject*>(bits_ & kPayloadMask);
+  }
+
+  auto asClosure() const -> ClosureObject* {
+    return reinterpret_cast<ClosureObject*>(bits_ & kPayloadMask);
+  }
+
+  // Only false and null are false.
+  auto truthy() const -> bool {
+    return bits_ != kNull && bits_ != kFalse;
+  }
+
+private:
+  static constexpr uint64_t kTagBoxedInteger = 0xfff8;
+  static constexpr uint64_t kTagInteger = 0xfff9;
+  static constexpr uint64_t kTagSpecial = 0xfffa;
+  static constexpr uint64_t kTagBuiltin = 0xfffb;
+  static constexpr uint64_t kTagString = 0xfffc;
+  static constexpr uint64_t kTagArray = 0xfffd;
+  static constexpr uint64_t kTagHashMap = 0xfffe;
+  static constexpr uint64_t kTagClosure = 0xffff;
+
+  static constexpr uint64_t kPayloadMask = (uint64_t{1} << 48) - 1;
+  static constexpr uint64_t kCanonicalNaN = 0x7ff8'0000'0000'0000;
+  static constexpr uint64_t kNull = kTagSpecial << 48;
+  static constexpr uint64_t kFalse = kNull | 1;
+  static constexpr uint64_t kTrue = kNull | 2;
+
+  explicit Value(uint64_t bits) : bits_{bits} {}
+
+  static auto pointer(uint64_t tag, void* o) -> Value {
+    return Value(tag << 48 | reinterpret_cast<uintptr_t>(o));
+  }
+
+  uint64_t bits_ = kNull;
+};
+
+static_assert(sizeof(Value) == 8);
+
+auto valueKindStringify(Value::Kind kind) -> const char*;
+
+// Heap objects are owned by the VM that allocated them, which frees them once they are
+// unreachable.
+class Object {
+public:
+  Object() = default;
+  virtual ~Object() = default;
+
+  NO_COPYABLE(Object)
+  NO_MOVABLE(Object)
+
+  // Set while the VM's collector marks the reachable objects.
+  bool marked = false;
+};
+
+// An integer that doesn't fit a Value inline.
+class IntegerObject final : public Object {
+public:
+  explicit IntegerObject(int64_t value) : value{value} {}
+
+  const int64_t value;
+};
+
+ALWAYS_INLINE auto Value::asInteger() const -> int64_t {
+  if (isInlineInteger()) {
+    return asInlineInteger();
+  }
+  return reinterpret_cast<IntegerObject*>(bits_ & kPayloadMask)->value;
+}
+
+class StringObject final : public Object {
+public:
+  explicit StringObject(std::string value)
+      : value{std::move(value)}, hash{hashBytes(this->value)} {}
+
+  const std::string value;
+  const uint64_t hash;
+};
+
+class ArrayObject final : public Object {
+public:
+  explicit ArrayObject(std::vector<Value> elements) : elements{std::move(elements)} {}
+
+  std::vector<Value> elements;
+};
+
+// Numbers are equal by value across integer and float, strings by content and objects by
+// identity.
+auto valuesEqual(Value a, Value b) -> bool;
+auto valueHash(Value v) -> uint64_t;
+
+class HashMapObject final : public Object {
+public:
+  struct Hash {
+    auto operator()(Value v) const -> size_t {
+      return valueHash(v);
+    }
+  };
+
+  struct Eq {
+    auto operator()(Value a, Value b) const -> bool {
+      return valuesEqual(a, b);
+    }
+  };
+
+  std::unordered_map<Value, Value, Hash, Eq> entries;
+};
+
+class ClosureObject final : public Object {
+public:
+  ClosureObject(uint32_t function, std::vector<Value> frees)
+      : function{function}, frees{std::move(frees)} {}
+
+  const uint32_t function;
+  std::vector<Value> frees;
+};
+
+}  // namespace tmonkey
\ No newline at end of file
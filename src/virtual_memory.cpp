@@ -0,0 +1,41 @@
+#include "virtual_memory.h"
+#include <sys/mman.h>
+#include <cstdint>
+
+namespace tmonkey {
+
+auto reserveVirtual(size_t bytes, size_t alignment) -> char* {
+  // Over-reserve by one alignment step so the region can start on the boundary.
+  auto total = bytes + alignment;
+  auto flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  void* addr = mmap(nullptr, total, PROT_NONE, flags, -1, 0);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+  auto start = (reinterpret_cast<uintptr_t>(addr) + alignment - 1) / alignment * alignment;
+  auto head = start - reinterpret_cast<uintptr_t>(addr);
+  if (head > 0) {
+    munmap(addr, head);
+  }
+  if (alignment - head > 0) {
+    munmap(reinterpret_cast<char*>(start + bytes), alignment - head);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(reinterpret_cast<char*>(start), bytes, MADV_HUGEPAGE);
+#endif
+  return reinterpret_cast<char*>(start);
+}
+
+auto commitVirtual(char* addr, size_t bytes) -> bool {
+  return mprotect(addr, bytes, PROT_READ | PROT_WRITE) == 0;
+}
+
+void decommitVirtual(char* addr, size_t bytes) {
+  madvise(addr, bytes, MADV_DONTNEED);
+}
+
+void releaseVirtual(char* addr, size_t bytes) {
+  munmap(addr, bytes);
+}
+
+}  // namespace tmonkey
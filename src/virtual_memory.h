@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+namespace tmonkey {
+
+// Thin wrappers over the OS virtual memory calls, so headers that use them stay free of platform
+// includes. Sizes are multiples of the page size.
+
+// Reserves `bytes` of address space starting on an `alignment` boundary, with no access and no
+// memory committed, and asks for transparent huge pages where available. Returns nullptr if the
+// address space can't be reserved.
+auto reserveVirtual(std::size_t bytes, std::size_t alignment) -> char*;
+
+// Makes [addr, addr + bytes) of a reservation readable and writable. Returns false if the memory
+// can't be committed.
+auto commitVirtual(char* addr, std::size_t bytes) -> bool;
+
+// Hands the pages back to the OS. They stay accessible and read back as zeros.
+void decommitVirtual(char* addr, std::size_t bytes);
+
+// Releases a reservation made by reserveVirtual().
+void releaseVirtual(char* addr, std::size_t bytes);
+
+}  // namespace tmonkey
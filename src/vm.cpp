@@ -0,0 +1,946 @@
+#include "vm.h"
+#include <unordered_set>
+
+// Computed goto is a GCC/Clang extension.
+#if defined(__GNUC__)
+#define TMONKEY_THREADED_DISPATCH
+#endif
+
+namespace tmonkey {
+
+auto vmDispatchStringify(VmDispatch dispatch) -> const char* {
+  switch (dispatch) {
+    case VmDispatch::kSwitch:
+      return "switch";
+    case VmDispatch::kThreaded:
+      return "threaded";
+  }
+  return "";
+}
+
+namespace {
+
+// Two's complement wraparound instead of signed overflow.
+auto wrap(uint64_t v) -> int64_t {
+  return static_cast<int64_t>(v);
+}
+
+// The operators leave `out` alone and return false if they don't apply to the operands.
+
+// Numbers compare by value, strings by content.
+template <typename Op>
+ALWAYS_INLINE auto compare(Value l, Value r, Value* out) -> bool {
+  if (l.isInteger() && r.isInteger()) {
+    *out = Value::boolean(Op{}(l.asInteger(), r.asInteger()));
+    return true;
+  }
+  if (l.isNumber() && r.isNumber()) {
+    *out = Value::boolean(Op{}(l.asNumber(), r.asNumber()));
+    return true;
+  }
+  if (l.kind() == Value::Kind::kString && r.kind() == Value::Kind::kString) {
+    *out = Value::boolean(Op{}(l.asString()->value, r.asString()->value));
+    return true;
+  }
+  return false;
+}
+
+ALWAYS_INLINE auto equal(Value l, Value r, Value* out) -> bool {
+  *out = Value::boolean(valuesEqual(l, r));
+  return true;
+}
+
+ALWAYS_INLINE auto notEqual(Value l, Value r, Value* out) -> bool {
+  *out = Value::boolean(!valuesEqual(l, r));
+  return true;
+}
+
+}  // namespace
+
+void printValue(PrettySink& out, Value v) {
+  // Arrays and hash maps being printed sit on `frames` rather than on the call stack, so deeply
+  // nested values can't overflow it. One that contains itself prints as [...] or {...} inside.
+  struct Frame {
+    Value v;
+    // Elements printed, or keys and values printed.
+    size_t step = 0;
+    decltype(HashMapObject::entries)::const_iterator entry{};
+  };
+  std::vector<Frame> frames;
+  std::unordered_set<const Object*> open;
+  auto enter = [&](Value v, bool quote) {
+    switch (v.kind()) {
+      case Value::Kind::kNull:
+        out.write("null");
+        break;
+      case Value::Kind::kBool:
+        out.writeBool(v.asBool());
+        break;
+      case Value::Kind::kInteger:
+        out.writeInt(v.asInteger());
+        break;
+      case Value::Kind::kFloat:
+        out.writeFloat(v.asFloat());
+        break;
+      case Value::Kind::kBuiltin:
+        out.write("<builtin>");
+        break;
+      case Value::Kind::kString:
+        if (quote) {
+          out.put('"');
+        }
+        out.write(v.asString()->value);
+        if (quote) {
+          out.put('"');
+        }
+        break;
+      case Value::Kind::kArray:
+        if (!open.insert(v.asArray()).second) {
+          out.write("[...]");
+          return;
+        }
+        out.put('[');
+        frames.push_back({v});
+        break;
+      case Value::Kind::kHashMap:
+        if (!open.insert(v.asHashMap()).second) {
+          out.write("{...}");
+          return;
+        }
+        out.put('{');
+        frames.push_back({v, 0, v.asHashMap()->entries.begin()});
+        break;
+      case Value::Kind::kClosure:
+        out.write("<fn>");
+        break;
+    }
+  };
+
+  enter(v, false);
+  while (!frames.empty()) {
+    // `f` dangles once enter() pushes, so it's done with by then.
+    auto& f = frames.back();
+    auto step = f.step++;
+    if (f.v.kind() == Value::Kind::kArray) {
+      const auto& elements = f.v.asArray()->elements;
+      if (step == elements.size()) {
+        out.put(']');
+        open.erase(f.v.asArray());
+        frames.pop_back();
+        continue;
+      }
+      if (step > 0) {
+        out.write(", ");
+      }
+      enter(elements[step], true);
+    } else {
+      const auto* map = f.v.asHashMap();
+      if (f.entry == map->entries.end()) {
+        out.put('}');
+        open.erase(map);
+        frames.pop_back();
+        continue;
+      }
+      const auto& [key, val] = *f.entry;
+      if (step % 2 == 0) {
+        if (step > 0) {
+          out.write(", ");
+        }
+        enter(key, true);
+      } else {
+        out.write(": ");
+        ++f.entry;
+        enter(val, true);
+      }
+    }
+  }
+}
+
+Vm::Vm(const Program& program, PrettySink& out)
+    : program_{program},
+      out_{out},
+      globals_(program.globals.size()),
+      stack_{new Value[kStackSize]} {
+  constants_.reserve(program.constants.size());
+  for (const auto& c : program.constants) {
+    switch (c.kind) {
+      case Constant::kInteger:
+        constants_.push_back(integer(c.integer));
+        break;
+      case Constant::kFloat:
+        constants_.push_back(Value::number(c.number));
+        break;
+      case Constant::kString:
+        constants_.push_back(Value::object(
+            make<StringObject>(std::string(program.strings.string(c.string).value_or("")))));
+        break;
+    }
+  }
+}
+
+auto Vm::run() -> bool {
+  frames_.clear();
+  result_ = Value();
+  error_.clear();
+  auto registers = program_.format == Program::Format::kRegister;
+#ifdef TMONKEY_THREADED_DISPATCH
+  if (dispatch_ == VmDispatch::kThreaded) {
+    return registers ? executeRegisters<VmDispatch::kThreaded>()
+                     : execute<VmDispatch::kThreaded>();
+  }
+#endif
+  return registers ? executeRegisters<VmDispatch::kSwitch>() : execute<VmDispatch::kSwitch>();
+}
+
+auto Vm::boxInteger(int64_t v) -> Value {
+  return Value::object(make<IntegerObject>(v));
+}
+
+void Vm::mark(Value v) {
+  Object* o = nullptr;
+  switch (v.kind()) {
+    case Value::Kind::kInteger:
+      o = v.asBoxedInteger();
+      break;
+    case Value::Kind::kString:
+      o = v.asString();
+      break;
+    case Value::Kind::kArray:
+      o = v.asArray();
+      break;
+    case Value::Kind::kHashMap:
+      o = v.asHashMap();
+      break;
+    case Value::Kind::kClosure:
+      o = v.asClosure();
+      break;
+    default:
+      break;
+  }
+  if (o && !o->marked) {
+    o->marked = true;
+    gray_.push_back(v);
+  }
+}
+
+void Vm::collect(const Value* top, ClosureObject* closure) {
+  for (auto v : constants_) {
+    mark(v);
+  }
+  for (auto v : globals_) {
+    mark(v);
+  }
+  for (const auto* v = stack_.get(); v < top; v++) {
+    mark(*v);
+  }
+  mark(result_);
+  for (const auto& f : frames_) {
+    if (f.closure) {
+      mark(Value::object(f.closure));
+    }
+  }
+  if (closure) {
+    mark(Value::object(closure));
+  }
+
+  // Marking goes through gray_ rather than recursing, so deeply nested values can't overflow.
+  while (!gray_.empty()) {
+    auto v = gray_.back();
+    gray_.pop_back();
+    switch (v.kind()) {
+      case Value::Kind::kArray:
+        for (auto e : v.asArray()->elements) {
+          mark(e);
+        }
+        break;
+      case Value::Kind::kHashMap:
+        for (const auto& [key, val] : v.asHashMap()->entries) {
+          mark(key);
+          mark(val);
+        }
+        break;
+      case Value::Kind::kClosure:
+        for (auto e : v.asClosure()->frees) {
+          mark(e);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  size_t live = 0;
+  std::erase_if(objects_, [&](Allocation& a) {
+    if (!a.object->marked) {
+      return true;
+    }
+    a.object->marked = false;
+    live += a.bytes;
+    return false;
+  });
+  heapBytes_ = live;
+  gcThreshold_ = std::max(minGcBytes_, 2 * live);
+}
+
+// A callee's window may end below registers its caller still uses, so every frame counts.
+auto Vm::registersTop(Value* base, const ClosureObject* closure) const -> Value* {
+  auto locals = [&](const ClosureObject* c) {
+    return program_.functions[c ? c->function : 0].locals;
+  };
+  auto* top = base + locals(closure);
+  for (const auto& f : frames_) {
+    top = std::max(top, f.base + locals(f.closure));
+  }
+  return top;
+}
+
+auto Vm::callBuiltin(uint32_t builtin, Value* args, uint32_t argc) -> Value {
+  switch (builtin) {
+    case kBuiltinPuts:
+      for (uint32_t i = 0; i < argc; i++) {
+        printValue(out_, args[i]);
+        out_.put('\n');
+      }
+      break;
+  }
+  return Value();
+}
+
+// Integers wrap around; an integer and a float make a float. Two inline integers, the common
+// case, skip the boxed check.
+template <typename Op>
+ALWAYS_INLINE auto Vm::arith(Value l, Value r, Value* out) -> bool {
+  if (l.isInlineInteger() && r.isInlineInteger()) {
+    auto v = Op{}(
+        static_cast<uint64_t>(l.asInlineInteger()), static_cast<uint64_t>(r.asInlineInteger()));
+    *out = integer(wrap(v));
+    return true;
+  }
+  if (l.isInteger() && r.isInteger()) {
+    auto v = Op{}(static_cast<uint64_t>(l.asInteger()), static_cast<uint64_t>(r.asInteger()));
+    *out = integer(wrap(v));
+    return true;
+  }
+  if (l.isNumber() && r.isNumber()) {
+    *out = Value::number(Op{}(l.asNumber(), r.asNumber()));
+    return true;
+  }
+  return false;
+}
+
+ALWAYS_INLINE auto Vm::add(Value l, Value r, Value* out) -> bool {
+  if (arith<std::plus<>>(l, r, out)) {
+    return true;
+  }
+  if (l.kind() == Value::Kind::kString && r.kind() == Value::Kind::kString) {
+    *out = Value::object(make<StringObject>(l.asString()->value + r.asString()->value));
+    return true;
+  }
+  return false;
+}
+
+// Fails on an integer division by zero. INT64_MIN / -1 wraps to INT64_MIN like the other
+// operators.
+ALWAYS_INLINE auto Vm::divide(Value l, Value r, Value* out) -> bool {
+  if (l.isInteger() && r.isInteger()) {
+    if (r.asInteger() == 0) {
+      return false;
+    }
+    if (r.asInteger() == -1) {
+      *out = integer(wrap(0 - static_cast<uint64_t>(l.asInteger())));
+      return true;
+    }
+    *out = integer(l.asInteger() / r.asInteger());
+    return true;
+  }
+  if (l.isNumber() && r.isNumber()) {
+    *out = Value::number(l.asNumber() / r.asNumber());
+    return true;
+  }
+  return false;
+}
+
+ALWAYS_INLINE auto Vm::negate(Value v, Value* out) -> bool {
+  if (v.isInteger()) {
+    *out = integer(wrap(0 - static_cast<uint64_t>(v.asInteger())));
+    return true;
+  }
+  if (v.isFloat()) {
+    *out = Value::number(-v.asFloat());
+    return true;
+  }
+  return false;
+}
+
+auto Vm::index(Value container, Value idx, Value* out) -> bool {
+  if (container.kind() == Value::Kind::kArray) {
+    if (!idx.isInteger()) {
+      return fail(std::format(
+          "array index must be an integer, got {}", valueKindStringify(idx.kind())));
+    }
+    const auto& elements = container.asArray()->elements;
+    auto i = idx.asInteger();
+    auto inRange = i >= 0 && static_cast<uint64_t>(i) < elements.size();
+    *out = inRange ? elements[static_cast<size_t>(i)] : Value();
+    return true;
+  }
+  if (container.kind() == Value::Kind::kHashMap) {
+    const auto& entries = container.asHashMap()->entries;
+    auto it = entries.find(idx);
+    *out = it != entries.end() ? it->second : Value();
+    return true;
+  }
+  return fail(std::format("can't index {}", valueKindStringify(container.kind())));
+}
+
+auto Vm::setIndex(Value container, Value idx, Value v) -> bool {
+  if (container.kind() == Value::Kind::kArray) {
+    auto& elements = container.asArray()->elements;
+    if (!idx.isInteger() || idx.asInteger() < 0 ||
+        static_cast<uint64_t>(idx.asInteger()) >= elements.size()) {
+      return fail("array index out of range");
+    }
+    elements[static_cast<size_t>(idx.asInteger())] = v;
+    return true;
+  }
+  if (container.kind() == Value::Kind::kHashMap) {
+    container.asHashMap()->entries.insert_or_assign(idx, v);
+    return true;
+  }
+  return fail(std::format("can't index {}", valueKindStringify(container.kind())));
+}
+
+auto Vm::operandError(const char* op, Value l, Value r) -> bool {
+  if (op[0] == '/' && l.isInteger() && r.isInteger()) {
+    return fail("division by zero");
+  }
+  return fail(std::format(
+      "unsupported operand types for {}: {} and {}", op, valueKindStringify(l.kind()),
+      valueKindStringify(r.kind())));
+}
+
+// Every handler ends in DISPATCH(). Threaded dispatch jumps from there through kLabels, so each
+// handler has its own indirect branch for the predictor to learn; switch dispatch goes back to
+// the one shared switch. The switch also starts the loop in both modes.
+#ifdef TMONKEY_THREADED_DISPATCH
+#define DISPATCH()                              \
+  do {                                          \
+    if constexpr (D == VmDispatch::kThreaded) { \
+      goto* kLabels[*ip++];                     \
+    } else {                                    \
+      goto dispatch;                            \
+    }                                           \
+  } while (0)
+#else
+#define DISPATCH() goto dispatch
+#endif
+
+// Pops the rhs and replaces the lhs with `lhs OP rhs`, computed by FN.
+#define STACK_BINARY(Name, OP, FN)                 \
+  op##Name : {                                     \
+    sp--;                                          \
+    if (!FN(sp[-1], sp[0], &sp[-1])) {             \
+      return operandError(OP, sp[-1], sp[0]);      \
+    }                                              \
+    DISPATCH();                                    \
+  }
+
+// a = b OP c, computed by FN, with c a register or, for the K form, a constant.
+#define REG_BINARY(Name, OP, FN)              \
+  op##Name : {                                \
+    auto* a = base + readOperand(ip);         \
+    auto b = base[readOperand(ip)];           \
+    auto c = base[readOperand(ip)];           \
+    if (!FN(b, c, a)) {                       \
+      return operandError(OP, b, c);          \
+    }                                         \
+    DISPATCH();                               \
+  }                                           \
+  op##Name##K : {                             \
+    auto* a = base + readOperand(ip);         \
+    auto b = base[readOperand(ip)];           \
+    auto c = constants[readOperand(ip)];      \
+    if (!FN(b, c, a)) {                       \
+      return operandError(OP, b, c);          \
+    }                                         \
+    DISPATCH();                               \
+  }
+
+// Labels as values are only pedantic warnings in the two interpreter loops below.
+#ifdef TMONKEY_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+template <VmDispatch D>
+auto Vm::execute() -> bool {
+#ifdef TMONKEY_THREADED_DISPATCH
+  static const void* const kLabels[] = {
+#define GEN_OPCODE_LABEL(Name, Operands) &&op##Name,
+      OPCODE_LIST(GEN_OPCODE_LABEL)
+#undef GEN_OPCODE_LABEL
+  };
+#endif
+
+  const auto& functions = program_.functions;
+  const auto& main = functions[0];
+  const auto* constants = constants_.data();
+  auto* globals = globals_.data();
+  auto* const stackEnd = stack_.get() + kStackSize;
+
+  const uint8_t* code = main.code.data();
+  const uint8_t* ip = code;
+  Value* base = stack_.get();
+  Value* sp = base + main.locals;
+  ClosureObject* closure = nullptr;
+  if (sp + main.maxStack > stackEnd) {
+    return fail("stack overflow");
+  }
+  std::fill(base, sp, Value());
+  goto dispatch;
+
+dispatch:
+  switch (static_cast<Opcode>(*ip++)) {
+#define GEN_OPCODE_CASE(Name, Operands) \
+  case Opcode::k##Name:                 \
+    goto op##Name;
+
+    OPCODE_LIST(GEN_OPCODE_CASE)
+
+#undef GEN_OPCODE_CASE
+  }
+  return fail(std::format("unknown opcode {}", ip[-1]));
+
+opConst:
+  *sp++ = constants[readOperand(ip)];
+  DISPATCH();
+
+opNull:
+  *sp++ = Value();
+  DISPATCH();
+
+opTrue:
+  *sp++ = Value::boolean(true);
+  DISPATCH();
+
+opFalse:
+  *sp++ = Value::boolean(false);
+  DISPATCH();
+
+opPop:
+  sp--;
+  DISPATCH();
+
+opDup:
+  *sp = sp[-1];
+  sp++;
+  DISPATCH();
+
+  STACK_BINARY(Add, "+", add)
+  STACK_BINARY(Sub, "-", arith<std::minus<>>)
+  STACK_BINARY(Mul, "*", arith<std::multiplies<>>)
+  STACK_BINARY(Div, "/", divide)
+  STACK_BINARY(Eq, "==", equal)
+  STACK_BINARY(NotEq, "!=", notEqual)
+  STACK_BINARY(Lt, "<", compare<std::less<>>)
+  STACK_BINARY(LtEq, "<=", compare<std::less_equal<>>)
+  STACK_BINARY(Gt, ">", compare<std::greater<>>)
+  STACK_BINARY(GtEq, ">=", compare<std::greater_equal<>>)
+
+opNeg:
+  if (!negate(sp[-1], &sp[-1])) {
+    return fail(
+        std::format("unsupported operand type for -: {}", valueKindStringify(sp[-1].kind())));
+  }
+  DISPATCH();
+
+opNot:
+  sp[-1] = Value::boolean(!sp[-1].truthy());
+  DISPATCH();
+
+opJump:
+  if (gcDue()) [[unlikely]] {
+    collect(sp, closure);
+  }
+  ip = code + readJumpTarget(ip);
+  DISPATCH();
+
+opJumpIfFalse : {
+  auto target = readJumpTarget(ip);
+  if (!(*--sp).truthy()) {
+    ip = code + target;
+  }
+  DISPATCH();
+}
+
+opGetGlobal:
+  *sp++ = globals[readOperand(ip)];
+  DISPATCH();
+
+opSetGlobal:
+  globals[readOperand(ip)] = *--sp;
+  DISPATCH();
+
+opGetLocal:
+  *sp++ = base[readOperand(ip)];
+  DISPATCH();
+
+opSetLocal:
+  base[readOperand(ip)] = *--sp;
+  DISPATCH();
+
+opGetFree:
+  *sp++ = closure->frees[readOperand(ip)];
+  DISPATCH();
+
+opSetFree:
+  closure->frees[readOperand(ip)] = *--sp;
+  DISPATCH();
+
+opGetBuiltin:
+  *sp++ = Value::builtin(readOperand(ip));
+  DISPATCH();
+
+opCurrentClosure:
+  *sp++ = Value::object(closure);
+  DISPATCH();
+
+opClosure : {
+  auto function = readOperand(ip);
+  auto count = readOperand(ip);
+  std::vector<Value> frees(sp - count, sp);
+  sp -= count;
+  *sp++ = Value::object(make<ClosureObject>(function, std::move(frees)));
+  DISPATCH();
+}
+
+opCall : {
+  if (gcDue()) [[unlikely]] {
+    collect(sp, closure);
+  }
+  auto argc = readOperand(ip);
+  auto callee = sp[-static_cast<ptrdiff_t>(argc) - 1];
+  if (callee.kind() == Value::Kind::kClosure) {
+    auto* c = callee.asClosure();
+    const auto& fn = functions[c->function];
+    if (argc != fn.params) {
+      return fail(std::format("wrong number of arguments: want {}, got {}", fn.params, argc));
+    }
+    auto* calleeBase = sp - argc;
+    if (calleeBase + fn.locals + fn.maxStack > stackEnd) {
+      return fail("stack overflow");
+    }
+    frames_.push_back({ip, code, base, closure});
+    std::fill(sp, calleeBase + fn.locals, Value());
+    base = calleeBase;
+    sp = base + fn.locals;
+    closure = c;
+    code = ip = fn.code.data();
+  } else if (callee.kind() == Value::Kind::kBuiltin) {
+    auto r = callBuiltin(callee.asBuiltin(), sp - argc, argc);
+    sp -= argc;
+    sp[-1] = r;
+  } else {
+    return fail(std::format("can't call {}", valueKindStringify(callee.kind())));
+  }
+  DISPATCH();
+}
+
+opReturn : {
+  auto r = sp[-1];
+  if (frames_.empty()) {
+    result_ = r;
+    return true;
+  }
+  // The result takes the callee's slot.
+  sp = base;
+  sp[-1] = r;
+  const auto& f = frames_.back();
+  ip = f.ip;
+  code = f.code;
+  base = f.base;
+  closure = f.closure;
+  frames_.pop_back();
+  DISPATCH();
+}
+
+opArray : {
+  auto count = readOperand(ip);
+  std::vector<Value> elements(sp - count, sp);
+  sp -= count;
+  *sp++ = Value::object(make<ArrayObject>(std::move(elements)));
+  DISPATCH();
+}
+
+opHashMap : {
+  auto count = readOperand(ip);
+  auto* m = make<HashMapObject>();
+  for (auto* p = sp - 2 * static_cast<ptrdiff_t>(count); p < sp; p += 2) {
+    m->entries.insert_or_assign(p[0], p[1]);
+  }
+  sp -= 2 * count;
+  *sp++ = Value::object(m);
+  DISPATCH();
+}
+
+opIndex:
+  sp--;
+  if (!index(sp[-1], sp[0], &sp[-1])) {
+    return false;
+  }
+  DISPATCH();
+
+opSetIndex:
+  sp -= 2;
+  if (!setIndex(sp[-1], sp[0], sp[1])) {
+    return false;
+  }
+  sp[-1] = sp[1];
+  DISPATCH();
+}
+
+// Registers of the running function start at `base`; a callee's window starts right after the
+// register holding it, so its arguments are already in place as its first registers.
+template <VmDispatch D>
+auto Vm::executeRegisters() -> bool {
+#ifdef TMONKEY_THREADED_DISPATCH
+  static const void* const kLabels[] = {
+#define GEN_OPCODE_LABEL(Name, Operands) &&op##Name,
+      REG_OPCODE_LIST(GEN_OPCODE_LABEL)
+#undef GEN_OPCODE_LABEL
+  };
+#endif
+
+  const auto& functions = program_.functions;
+  const auto& main = functions[0];
+  const auto* constants = constants_.data();
+  auto* globals = globals_.data();
+  auto* const stackEnd = stack_.get() + kStackSize;
+
+  const uint8_t* code = main.code.data();
+  const uint8_t* ip = code;
+  Value* base = stack_.get();
+  ClosureObject* closure = nullptr;
+  if (base + main.locals > stackEnd) {
+    return fail("stack overflow");
+  }
+  std::fill(base, base + main.locals, Value());
+  goto dispatch;
+
+dispatch:
+  switch (static_cast<RegOpcode>(*ip++)) {
+#define GEN_OPCODE_CASE(Name, Operands) \
+  case RegOpcode::k##Name:              \
+    goto op##Name;
+
+    REG_OPCODE_LIST(GEN_OPCODE_CASE)
+
+#undef GEN_OPCODE_CASE
+  }
+  return fail(std::format("unknown opcode {}", ip[-1]));
+
+opLoadK : {
+  auto* a = base + readOperand(ip);
+  *a = constants[readOperand(ip)];
+  DISPATCH();
+}
+
+opLoadNull:
+  base[readOperand(ip)] = Value();
+  DISPATCH();
+
+opLoadTrue:
+  base[readOperand(ip)] = Value::boolean(true);
+  DISPATCH();
+
+opLoadFalse:
+  base[readOperand(ip)] = Value::boolean(false);
+  DISPATCH();
+
+opMove : {
+  auto* a = base + readOperand(ip);
+  *a = base[readOperand(ip)];
+  DISPATCH();
+}
+
+  REG_BINARY(Add, "+", add)
+  REG_BINARY(Sub, "-", arith<std::minus<>>)
+  REG_BINARY(Mul, "*", arith<std::multiplies<>>)
+  REG_BINARY(Div, "/", divide)
+  REG_BINARY(Eq, "==", equal)
+  REG_BINARY(NotEq, "!=", notEqual)
+  REG_BINARY(Lt, "<", compare<std::less<>>)
+  REG_BINARY(LtEq, "<=", compare<std::less_equal<>>)
+  REG_BINARY(Gt, ">", compare<std::greater<>>)
+  REG_BINARY(GtEq, ">=", compare<std::greater_equal<>>)
+
+opNeg : {
+  auto* a = base + readOperand(ip);
+  auto b = base[readOperand(ip)];
+  if (!negate(b, a)) {
+    return fail(std::format("unsupported operand type for -: {}", valueKindStringify(b.kind())));
+  }
+  DISPATCH();
+}
+
+opNot : {
+  auto* a = base + readOperand(ip);
+  *a = Value::boolean(!base[readOperand(ip)].truthy());
+  DISPATCH();
+}
+
+opJump:
+  if (gcDue()) [[unlikely]] {
+    collect(registersTop(base, closure), closure);
+  }
+  ip = code + readJumpTarget(ip);
+  DISPATCH();
+
+opJumpIfFalse : {
+  auto truthy = base[readOperand(ip)].truthy();
+  auto target = readJumpTarget(ip);
+  if (!truthy) {
+    ip = code + target;
+  }
+  DISPATCH();
+}
+
+opGetGlobal : {
+  auto* a = base + readOperand(ip);
+  *a = globals[readOperand(ip)];
+  DISPATCH();
+}
+
+opSetGlobal : {
+  auto* g = globals + readOperand(ip);
+  *g = base[readOperand(ip)];
+  DISPATCH();
+}
+
+opGetFree : {
+  auto* a = base + readOperand(ip);
+  *a = closure->frees[readOperand(ip)];
+  DISPATCH();
+}
+
+opSetFree : {
+  auto* f = closure->frees.data() + readOperand(ip);
+  *f = base[readOperand(ip)];
+  DISPATCH();
+}
+
+opGetBuiltin : {
+  auto* a = base + readOperand(ip);
+  *a = Value::builtin(readOperand(ip));
+  DISPATCH();
+}
+
+opCurrentClosure:
+  base[readOperand(ip)] = Value::object(closure);
+  DISPATCH();
+
+opClosure : {
+  auto* a = base + readOperand(ip);
+  auto function = readOperand(ip);
+  auto* first = base + readOperand(ip);
+  auto count = readOperand(ip);
+  *a = Value::object(make<ClosureObject>(function, std::vector<Value>(first, first + count)));
+  DISPATCH();
+}
+
+opCall : {
+  if (gcDue()) [[unlikely]] {
+    collect(registersTop(base, closure), closure);
+  }
+  auto* callee = base + readOperand(ip);
+  auto argc = readOperand(ip);
+  if (callee->kind() == Value::Kind::kClosure) {
+    auto* c = callee->asClosure();
+    const auto& fn = functions[c->function];
+    if (argc != fn.params) {
+      return fail(std::format("wrong number of arguments: want {}, got {}", fn.params, argc));
+    }
+    auto* calleeBase = callee + 1;
+    if (calleeBase + fn.locals > stackEnd) {
+      return fail("stack overflow");
+    }
+    frames_.push_back({ip, code, base, closure});
+    std::fill(calleeBase + argc, calleeBase + fn.locals, Value());
+    base = calleeBase;
+    closure = c;
+    code = ip = fn.code.data();
+  } else if (callee->kind() == Value::Kind::kBuiltin) {
+    *callee = callBuiltin(callee->asBuiltin(), callee + 1, argc);
+  } else {
+    return fail(std::format("can't call {}", valueKindStringify(callee->kind())));
+  }
+  DISPATCH();
+}
+
+opReturn : {
+  auto r = base[readOperand(ip)];
+  if (frames_.empty()) {
+    result_ = r;
+    return true;
+  }
+  // The result takes the callee's register.
+  base[-1] = r;
+  const auto& f = frames_.back();
+  ip = f.ip;
+  code = f.code;
+  base = f.base;
+  closure = f.closure;
+  frames_.pop_back();
+  DISPATCH();
+}
+
+opArray : {
+  auto* a = base + readOperand(ip);
+  auto* first = base + readOperand(ip);
+  auto count = readOperand(ip);
+  *a = Value::object(make<ArrayObject>(std::vector<Value>(first, first + count)));
+  DISPATCH();
+}
+
+opHashMap : {
+  auto* a = base + readOperand(ip);
+  auto* first = base + readOperand(ip);
+  auto count = readOperand(ip);
+  auto* m = make<HashMapObject>();
+  for (auto* p = first; p < first + 2 * count; p += 2) {
+    m->entries.insert_or_assign(p[0], p[1]);
+  }
+  *a = Value::object(m);
+  DISPATCH();
+}
+
+opIndex : {
+  auto* a = base + readOperand(ip);
+  auto b = base[readOperand(ip)];
+  auto c = base[readOperand(ip)];
+  if (!index(b, c, a)) {
+    return false;
+  }
+  DISPATCH();
+}
+
+opSetIndex : {
+  auto a = base[readOperand(ip)];
+  auto b = base[readOperand(ip)];
+  auto c = base[readOperand(ip)];
+  if (!setIndex(a, b, c)) {
+    return false;
+  }
+  DISPATCH();
+}
+}
+
+#ifdef TMONKEY_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+#undef REG_BINARY
+#undef STACK_BINARY
+#undef DISPATCH
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "bytecode.h"
+#include "common.h"
+#include "pretty.h"
+#include "value.h"
+
+namespace tmonkey {
+
+// How the VM goes from one instruction to the next.
+enum class VmDispatch {
+  // One switch over the opcode; every handler jumps back to it.
+  kSwitch,
+  // Every handler jumps straight to the next one through a table of label addresses. Needs the
+  // GCC/Clang labels-as-values extension; kSwitch is used without it.
+  kThreaded,
+};
+
+auto vmDispatchStringify(VmDispatch dispatch) -> const char*;
+
+// Runs a Program in either bytecode format. Values live on one fixed stack: a call frame is the
+// callee's locals, parameters first, followed by its operands or temporary registers. Objects are
+// owned by the VM. A mark-sweep collector frees the unreachable ones at calls and jumps, where
+// every live value is on the stack, in a global, a constant or a closure.
+//
+// Integer +, -, *, / and negation wrap around in two's complement on overflow, so
+// -9223372036854775808 / -1 is -9223372036854775808. Only division by zero is a runtime error.
+class Vm {
+public:
+  static constexpr size_t kStackSize = 1 << 16;
+  static constexpr size_t kMinGcBytes = 1 << 20;
+
+  // `puts` writes to `out`.
+  Vm(const Program& program, PrettySink& out);
+
+  NO_COPYABLE(Vm)
+  NO_MOVABLE(Vm)
+
+  // Runs the top-level statements. Returns false on a runtime error, see error().
+  auto run() -> bool;
+
+  // What the top-level statements returned, null if they ran to the end.
+  auto result() const -> Value {
+    return result_;
+  }
+
+  auto error() const -> const std::string& {
+    return error_;
+  }
+
+  void setDispatch(VmDispatch dispatch) {
+    dispatch_ = dispatch;
+  }
+
+  // The collector runs once the heap has doubled since the last collection and holds at least
+  // `bytes`. Tests set it low to collect often and catch missed roots.
+  void setMinGcBytes(size_t bytes) {
+    minGcBytes_ = bytes;
+    gcThreshold_ = bytes;
+  }
+
+  // Bytes held by objects, counting what each was created with.
+  auto heapBytes() const -> size_t {
+    return heapBytes_;
+  }
+
+private:
+  struct Frame {
+    const uint8_t* ip;
+    const uint8_t* code;
+    Value* base;
+    ClosureObject* closure;
+  };
+
+  template <VmDispatch D>
+  auto execute() -> bool;
+  template <VmDispatch D>
+  auto executeRegisters() -> bool;
+
+  struct Allocation {
+    std::unique_ptr<Object> object;
+    size_t bytes;
+  };
+
+  // Never collects, so the operands of an instruction stay valid while it allocates.
+  template <typename T, typename... Args>
+  auto make(Args&&... args) -> T* {
+    auto* o = new T(std::forward<Args>(args)...);
+    auto bytes = sizeof(T) + payloadBytes(*o);
+    objects_.push_back({std::unique_ptr<Object>(o), bytes});
+    heapBytes_ += bytes;
+    return o;
+  }
+
+  static auto payloadBytes(const Object&) -> size_t {
+    return 0;
+  }
+  static auto payloadBytes(const StringObject& o) -> size_t {
+    return o.value.capacity();
+  }
+  static auto payloadBytes(const ArrayObject& o) -> size_t {
+    return o.elements.capacity() * sizeof(Value);
+  }
+  static auto payloadBytes(const ClosureObject& o) -> size_t {
+    return o.frees.capacity() * sizeof(Value);
+  }
+
+  ALWAYS_INLINE auto gcDue() const -> bool {
+    return heapBytes_ >= gcThreshold_;
+  }
+
+  // Frees every object that isn't reachable from the constants, the globals, the result, the
+  // stack below `top`, or the closures of `closure` and the frames.
+  void collect(const Value* top, ClosureObject* closure);
+  void mark(Value v);
+  // End of the registers of the running function and its callers.
+  auto registersTop(Value* base, const ClosureObject* closure) const -> Value*;
+
+  // Boxes the integers that don't fit a Value inline.
+  auto integer(int64_t v) -> Value {
+    return Value::fitsInline(v) ? Value::inlineInteger(v) : boxInteger(v);
+  }
+  auto boxInteger(int64_t v) -> Value;
+
+  auto callBuiltin(uint32_t builtin, Value* args, uint32_t argc) -> Value;
+
+  // Operators shared by both bytecode formats. The arithmetic ones return false if the operands
+  // don't fit, see operandError(); the others fail on their own.
+  template <typename Op>
+  auto arith(Value l, Value r, Value* out) -> bool;
+  auto add(Value l, Value r, Value* out) -> bool;
+  auto divide(Value l, Value r, Value* out) -> bool;
+  auto negate(Value v, Value* out) -> bool;
+  auto index(Value container, Value idx, Value* out) -> bool;
+  auto setIndex(Value container, Value idx, Value v) -> bool;
+  auto operandError(const char* op, Value l, Value r) -> bool;
+
+  auto fail(std::string msg) -> bool {
+    error_ = std::format("runtime error: {}", msg);
+    return false;
+  }
+
+  const Program& program_;
+  PrettySink& out_;
+  VmDispatch dispatch_ = VmDispatch::kThreaded;
+  std::vector<Value> constants_;
+  std::vector<Value> globals_;
+  std::unique_ptr<Value[]> stack_;
+  std::vector<Frame> frames_;
+  std::vector<Allocation> objects_;
+  size_t heapBytes_ = 0;
+  size_t minGcBytes_ = kMinGcBytes;
+  size_t gcThreshold_ = kMinGcBytes;
+  // Marked objects whose references are still to be marked.
+  std::vector<Value> gray_;
+  Value result_;
+  std::string error_;
+};
+
+// Strings print bare at the top level and quoted inside arrays and hash maps. An array or hash map
+// nested in itself prints as [...] or {...} there.
+void printValue(PrettySink& out, Value v);
+
+}  // namespace tmonkey
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include <chrono>
+#include "codegen.h"
+#include "common.h"
+#include "parser.h"
+#include "reg_codegen.h"
+#include "vm.h"
+
+namespace tmonkey {
+namespace {
+
+struct Workload {
+  const char* name;
+  const char* src;
+};
+
+// Calls, a tight while loop, and hash-map stores and loads. Each runs as stack and as register
+// code.
+constexpr Workload kWorkloads[] = {
+    {"fib",
+     "let fib = fn(n) { if (n < 2) { return n; }; fib(n - 1) + fib(n - 2) };\n"
+     "return fib(27);"},
+    {"loop",
+     "let i = 0;\n"
+     "let s = 0;\n"
+     "while (i < 5000000) { s = s + i * 2 - 1; i = i + 1; };\n"
+     "return s;"},
+    {"hash-map",
+     "let m = {0: 0};\n"
+     "let i = 0;\n"
+     "let j = 0;\n"
+     "while (i < 300000) {\n"
+     "  m[j] = i; m[i] = m[j] + 1;\n"
+     "  j = j + 1; if (j == 1024) { j = 0; };\n"
+     "  i = i + 1;\n"
+     "};\n"
+     "return m[1023];"},
+};
+
+auto measure(const Program& program, VmDispatch dispatch, int iters) -> double {
+  std::string sink;
+  PrettySink out(sink);
+  auto best = std::numeric_limits<double>::max();
+  for (int i = 0; i < iters; i++) {
+    Vm vm(program, out);
+    vm.setDispatch(dispatch);
+    auto begin = std::chrono::steady_clock::now();
+    if (!vm.run()) {
+      std::cerr << vm.error() << "\n";
+      return 0;
+    }
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+}  // namespace
+}  // namespace tmonkey
+
+int main(int argc, char* argv[]) {
+  using namespace tmonkey;
+
+  int iters = argc > 1 ? std::atoi(argv[1]) : 3;
+
+  for (const auto& w : kWorkloads) {
+    Arena arena;
+    std::vector<std::string> errors;
+    auto tree = parse(w.src, arena, &errors);
+    auto stack = errors.empty() ? Codegen::compile(tree, &errors) : std::nullopt;
+    auto registers = stack ? RegCodegen::compile(tree, &errors) : std::nullopt;
+    if (!registers) {
+      std::cerr << std::format("{}: {}\n", w.name, errors.empty() ? "" : errors.front());
+      return 1;
+    }
+    for (const auto* program : {&*stack, &*registers}) {
+      auto format = program->format == Program::Format::kStack ? "stack" : "register";
+      for (auto dispatch : {VmDispatch::kSwitch, VmDispatch::kThreaded}) {
+        std::cout << std::format(
+            "{:>8} {:>8} {:>8}: {} ms\n", w.name, format, vmDispatchStringify(dispatch),
+            static_cast<int64_t>(measure(*program, dispatch, iters)));
+      }
+    }
+  }
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,239 @@
+#include <cmath>
+#include "codegen.h"
+#include "common.h"
+#include "gtest/gtest.h"
+#include "parser.h"
+#include "reg_codegen.h"
+#include "vm.h"
+
+namespace tmonkey {
+namespace {
+
+struct RunResult {
+  bool ok;
+  // What puts wrote, followed by the printed result or the error.
+  std::string output;
+};
+
+auto run(
+    std::string_view src,
+    Program::Format format,
+    VmDispatch dispatch,
+    size_t minGcBytes = Vm::kMinGcBytes) -> RunResult {
+  Arena arena;
+  std::vector<std::string> errors;
+  auto tree = parse(src, arena, &errors);
+  EXPECT_TRUE(errors.empty());
+  auto program = format == Program::Format::kStack ? Codegen::compile(tree, &errors)
+                                                   : RegCodegen::compile(tree, &errors);
+  EXPECT_TRUE(program);
+  if (!program) {
+    return {false, errors.empty() ? "" : errors.front()};
+  }
+
+  std::string output;
+  bool ok;
+  {
+    PrettySink out(output);
+    Vm vm(*program, out);
+    vm.setDispatch(dispatch);
+    vm.setMinGcBytes(minGcBytes);
+    ok = vm.run();
+    if (ok) {
+      printValue(out, vm.result());
+    } else {
+      out.write(vm.error());
+    }
+  }
+  return {ok, output};
+}
+
+// Runs `src` as stack and as register code with both dispatch modes, which all have to agree,
+// once more collecting whenever the heap has doubled.
+void expectRun(std::string_view src, std::string_view output, bool ok = true) {
+  for (auto format : {Program::Format::kStack, Program::Format::kRegister}) {
+    for (auto dispatch : {VmDispatch::kSwitch, VmDispatch::kThreaded}) {
+      for (auto minGcBytes : {Vm::kMinGcBytes, size_t{1}}) {
+        auto r = run(src, format, dispatch, minGcBytes);
+        auto mode = std::format(
+            "{} {}{}", format == Program::Format::kStack ? "stack" : "register",
+            vmDispatchStringify(dispatch), minGcBytes == 1 ? " gc" : "");
+        EXPECT_EQ(r.ok, ok) << mode << ": " << src;
+        EXPECT_EQ(r.output, output) << mode << ": " << src;
+      }
+    }
+  }
+}
+
+TEST(VmTests, Arithmetic) {
+  expectRun("return 1 + 2 * 3 - 4 / 2;", "5");
+  expectRun("return 1 + 2.5;", "3.5");
+  expectRun("return -(7 / 2);", "-3");
+  expectRun("return \"ab\" + \"cd\";", "abcd");
+  expectRun(
+      "return [1 < 2, 2 <= 1, 1 == 1.0, \"a\" != \"a\", !null, -2.5];",
+      "[true, false, true, false, true, -2.5]");
+  expectRun("return 9223372036854775807 + 1;", "-9223372036854775808");
+}
+
+TEST(VmTests, Values) {
+  for (auto v : {Value::kMinInline, int64_t{-1}, int64_t{0}, Value::kMaxInline}) {
+    EXPECT_TRUE(Value::inlineInteger(v).isInteger());
+    EXPECT_EQ(Value::inlineInteger(v).asInteger(), v);
+  }
+  auto nan = std::numeric_limits<double>::quiet_NaN();
+  for (auto d : {0.0, -0.0, 1.5, -std::numeric_limits<double>::infinity(), nan, -nan}) {
+    auto v = Value::number(d);
+    EXPECT_EQ(v.kind(), Value::Kind::kFloat);
+    EXPECT_EQ(std::signbit(v.asFloat()), std::signbit(d) && d == d);
+  }
+  EXPECT_FALSE(Value().truthy());
+  EXPECT_FALSE(Value::boolean(false).truthy());
+  EXPECT_TRUE(Value::inlineInteger(0).truthy());
+  EXPECT_EQ(Value::builtin(kBuiltinPuts).kind(), Value::Kind::kBuiltin);
+
+  // Integers past 48 bits are boxed, and behave the same.
+  expectRun("return 140737488355327 + 1;", "140737488355328");
+  expectRun("return -140737488355328 - 1 + 1;", "-140737488355328");
+  expectRun("return 4294967296 * 4294967296;", "0");
+  expectRun("return -(-9223372036854775807 - 1);", "-9223372036854775808");
+  expectRun("return (-9223372036854775807 - 1) / -1;", "-9223372036854775808");
+  expectRun("return [7 / -1, -7 / -1, (0 - 140737488355328) / -1];", "[-7, 7, 140737488355328]");
+  expectRun(
+      "let m = {140737488355328: 1};\n"
+      "return [m[140737488355327 + 1], 140737488355328 == 140737488355328.0];",
+      "[1, true]");
+  // An integer equals a float only if the float holds exactly that integer, as in hashing.
+  expectRun(
+      "let big = 9007199254740992;\n"
+      "return [big + 1 == 9007199254740992.0, big == 9007199254740992.0, "
+      "9223372036854775807 == 9223372036854775808.0];",
+      "[false, true, false]");
+  expectRun(
+      "let m = {9007199254740992.0: 1};\n"
+      "return [m[9007199254740992], m[9007199254740992 + 1]];",
+      "[1, null]");
+}
+
+TEST(VmTests, Control) {
+  expectRun("let x = if (1 > 2) { 1 } else { 2 }; return x;", "2");
+  expectRun("return if (false) { 1 };", "null");
+  expectRun("let i = 0; let s = 0; while (i < 10) { s = s + i; i = i + 1; }; return s;", "45");
+  expectRun("puts(1, \"two\", [3]); puts();", "1\ntwo\n[3]\nnull");
+  expectRun(
+      "let f = fn(n) {\n"
+      "  let r = 0; if (n > 1) { r = 1; } else { r = 2; }; if (n > 3) { r = 3; }; r\n"
+      "};\n"
+      "return [f(0), f(2), f(5), fn() { if (true) { 1 } }(), fn() { while (false) {} }()];",
+      "[2, 1, 3, 1, null]");
+}
+
+TEST(VmTests, Functions) {
+  expectRun(
+      "let fib = fn(n) { if (n < 2) { return n; }; fib(n - 1) + fib(n - 2) };\n"
+      "return fib(20);",
+      "6765");
+  expectRun(
+      "let counter = fn(x) { fn() { x = x + 1 } };\n"
+      "let c = counter(10);\n"
+      "c(); c();\n"
+      "return [c(), counter(0)()];",
+      "[13, 1]");
+  expectRun("let f = fn(a, b) { let c = a * b; c + 1 }; return f(2, 3);", "7");
+  expectRun("let f = fn() { g() }; let g = fn() { 42 }; return f();", "42");
+  expectRun("let f = fn(a, b) { [a, b] }; return f(f(1, 2), f(3, [4]));", "[[1, 2], [3, [4]]]");
+}
+
+TEST(VmTests, EvaluationOrder) {
+  // Operands are read when they are evaluated, even if a later operand assigns to them.
+  expectRun("let f = fn() { let x = 1; x + (x = 10) }; return f();", "11");
+  expectRun("let f = fn() { let x = 1; [x, x = 2, x] }; return f();", "[1, 2, 2]");
+  expectRun("let f = fn() { let a = [1]; a[0] + (a = [5])[0] }; return f();", "6");
+  expectRun("let x = 1; let y = x + if (true) { x = 3; x }; return [x, y];", "[3, 4]");
+}
+
+TEST(VmTests, Collections) {
+  expectRun(
+      "let a = [1, {\"k\": 2}];\n"
+      "a[1][\"k\"] = 3;\n"
+      "a[0] = a[1][\"k\"] + 1;\n"
+      "return [a[0], a[1][\"k\"], a[2], a[1][\"missing\"]];",
+      "[4, 3, null, null]");
+  expectRun("let m = {1: \"one\"}; m[2] = \"two\"; return [m[1.0], m[2]];", "[\"one\", \"two\"]");
+}
+
+TEST(VmTests, DeepNesting) {
+  // Deep trees go through the printers, both code generators and the Vm on the walkers' stacks.
+  auto repeat = [](std::string_view s, size_t n) {
+    std::string out;
+    for (size_t i = 0; i < n; i++) {
+      out += s;
+    }
+    return out;
+  };
+  constexpr size_t kDepth = 10'000;
+  auto chain = "return 1" + repeat(" + 1", kDepth - 1) + ";";
+  auto calls = "let f = fn(x) { x + 1 }; return " + repeat("f(", kDepth) + "0" +
+               repeat(")", kDepth) + ";";
+  auto groups = "return " + repeat("-(", kDepth) + "7" + repeat(")", kDepth) + ";";
+  // Array literals nest as deep as the parser allows.
+  auto arrays = "return " + repeat("[", kMaxNestingDepth - 1) + "7" +
+                repeat("]", kMaxNestingDepth - 1) + ";";
+  expectRun(chain, std::to_string(kDepth));
+  expectRun(calls, std::to_string(kDepth));
+  expectRun(groups, "7");
+  expectRun(
+      arrays, repeat("[", kMaxNestingDepth - 1) + "7" + repeat("]", kMaxNestingDepth - 1));
+
+  // The text format indents every level, so its size is quadratic in the depth.
+  for (const auto& src : {chain, calls, groups, arrays}) {
+    Arena arena;
+    auto tree = parse(src, arena);
+    for (auto format : {PrettyFormat::kJson, PrettyFormat::kSexpr}) {
+      EXPECT_FALSE(AstPrettyfier::prettify(tree, format).empty());
+    }
+  }
+
+  // Deeper chains still compile, though their temporaries would outgrow the register Vm's stack.
+  for (const auto& src : {
+           "return 1" + repeat(" + 1", 100'000) + ";",
+           "return " + repeat("-(", 100'000) + "7" + repeat(")", 100'000) + ";",
+       }) {
+    Arena arena;
+    std::vector<std::string> errors;
+    auto tree = parse(src, arena, &errors);
+    ASSERT_TRUE(errors.empty());
+    EXPECT_TRUE(Codegen::compile(tree));
+    EXPECT_TRUE(RegCodegen::compile(tree));
+  }
+}
+
+TEST(VmTests, PrintNesting) {
+  // Containers that hold themselves print once, with [...] or {...} where they recur.
+  expectRun("let a = [1, 2]; a[0] = a; return a;", "[[...], 2]");
+  expectRun("let m = {}; m[\"k\"] = [m]; return m;", "{\"k\": [{...}]}");
+  expectRun("let a = [1]; return [a, a];", "[[1], [1]]");
+
+  // Arrays built at runtime aren't capped at kMaxNestingDepth like literals.
+  constexpr size_t kDepth = 100'000;
+  expectRun(
+      std::format(
+          "let a = []; let i = 0; while (i < {}) {{ a = [a]; i = i + 1; }}; return a;", kDepth),
+      std::string(kDepth + 1, '[') + std::string(kDepth + 1, ']'));
+}
+
+TEST(VmTests, Errors) {
+  expectRun("return 1 / 0;", "runtime error: division by zero", false);
+  expectRun(
+      "return 1 + \"a\";", "runtime error: unsupported operand types for +: integer and string",
+      false);
+  expectRun(
+      "let f = fn(a) { a }; f();", "runtime error: wrong number of arguments: want 1, got 0",
+      false);
+  expectRun("1();", "runtime error: can't call integer", false);
+  expectRun("let a = [1]; a[1] = 2;", "runtime error: array index out of range", false);
+  expectRun("let f = fn(n) { f(n + 1) }; f(0);", "runtime error: stack overflow", false);
+}
+
+}  // namespace
+}  // namespace tmonkey
\ No newline at end of file